@@ -3,10 +3,17 @@
 #include "Scene.h"
 
 #include "AssimpLoader.h"
+#include "ThreadPool.h"
+#include "VertexLayout.h"
+#include "CookedTexture.h"
+#include "TextureStreamer.h"
+#include "GpuCuller.h"
 
 namespace Nagi
 {
 
+class UploadBatch;
+
 struct Vertex
 {
 	glm::vec3 pos;
@@ -15,35 +22,53 @@ struct Vertex
 	glm::vec3 tangent;
 	glm::vec3 bitangent;
 
-	constexpr static int s_bindingSlot = 0;
-
-	static vk::VertexInputBindingDescription getBindingDescription()
+	static VertexLayout getLayout()
 	{
-		// Binding on Vertex Buffer slot 0 hardcoded
-		return 	vk::VertexInputBindingDescription{ s_bindingSlot, sizeof(Vertex) };
+		// Binding on Vertex Buffer slot 0
+		return VertexLayout(sizeof(Vertex),
+			{
+				{ 0, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, pos) },
+				{ 1, vk::Format::eR32G32Sfloat, offsetof(Vertex, uv) },
+				{ 2, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, normal) },
+				{ 3, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, tangent) },
+				{ 4, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, bitangent) }
+			});
 	}
+};
 
-	static std::array<vk::VertexInputAttributeDescription, 5> getAttributeDescriptions()
+// Quantized vertex, 20 bytes instead of 56 (decoded in shader_sponza.vert with PACKED_VERTEX)
+// Bitangent is rebuilt in the shader from normal, tangent and the handedness sign
+struct PackedVertex
+{
+	uint32_t posXY;			// snorm16x2, position quantized to the model bounds
+	uint32_t posZW;			// snorm16x2, z and the tangent handedness sign in w
+	uint32_t uv;			// half2
+	uint32_t normal;		// octahedral snorm16x2
+	uint32_t tangent;		// octahedral snorm16x2
+
+	static VertexLayout getLayout()
 	{
-		std::array<vk::VertexInputAttributeDescription, 5> dscs;
-		dscs[0] = vk::VertexInputAttributeDescription(0, s_bindingSlot, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, pos));
-		dscs[1] = vk::VertexInputAttributeDescription(1, s_bindingSlot, vk::Format::eR32G32Sfloat, offsetof(Vertex, uv));
-		dscs[2] = vk::VertexInputAttributeDescription(2, s_bindingSlot, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, normal));
-		dscs[3] = vk::VertexInputAttributeDescription(3, s_bindingSlot, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, tangent));
-		dscs[4] = vk::VertexInputAttributeDescription(4, s_bindingSlot, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, bitangent));
-		return dscs;
+		return VertexLayout(sizeof(PackedVertex),
+			{
+				{ 0, vk::Format::eR16G16B16A16Snorm, offsetof(PackedVertex, posXY) },
+				{ 1, vk::Format::eR16G16Sfloat, offsetof(PackedVertex, uv) },
+				{ 2, vk::Format::eR16G16Snorm, offsetof(PackedVertex, normal) },
+				{ 3, vk::Format::eR16G16Snorm, offsetof(PackedVertex, tangent) }
+			});
 	}
-};
 
-// Temporary, modelMat should live in Set 3 (per object data)
-struct PushConstantData
-{
-	glm::mat4 modelMat;
+	static PackedVertex pack(const Vertex& vertex, const PositionQuantization& quantization);
 };
 
-struct ObjectData
+// One entry of the material buffer (std430), indices into the bindless texture array (Set 2, binding 0)
+struct MaterialData
 {
-	glm::mat4 modelMat;
+	static constexpr uint32_t s_noTexture = ~0u;		// Normal only, the shader keeps the vertex normal (NO_TEXTURE in the shader)
+
+	uint32_t diffuseTexture;
+	uint32_t opacityTexture;
+	uint32_t specularTexture;
+	uint32_t normalTexture;
 };
 
 struct GPUCameraData
@@ -78,11 +103,11 @@ struct EngineFrameData
 };
 
 
-struct ObjectFrameData
+// Model texture in the bindless texture array, the streamer rewrites the slot when the resident mips change
+struct StreamedTextureSlot
 {
-	std::unique_ptr<Buffer> modelMatBuffer;
-
-	vk::DescriptorSet descriptorSet;
+	TextureStreamer::Handle handle;
+	uint32_t slot;
 };
 
 class SponzaApp : public Application
@@ -95,23 +120,62 @@ public:
 	SponzaApp& operator=(const Application&) = delete;
 
 private:
+	// Quantized vertices (PackedVertex) for the main pipeline, plain float vertices (Vertex) otherwise
+	static constexpr bool s_usePackedVertices = true;
+
+	// Times GPU blit vs CPU (fresh and cached) mip generation on startup
+	static constexpr bool s_benchmarkMipGeneration = false;
+
+	static VertexLayout getVertexLayout();
 
-	void drawObjects(Scene* scene, vk::CommandBuffer& cmd);
+	// LOD i is used while the projected bounding sphere covers at least s_lodScreenSizes[i] of the screen height (coarsest LOD below that)
+	// Entities smaller than s_minScreenSize are not drawn at all
+	static constexpr std::array<float, Mesh::s_maxLods - 1> s_lodScreenSizes{ 0.25f, 0.12f, 0.06f };
+	static constexpr float s_minScreenSize = 0.004f;
+
+	// Size of the bindless texture array, elements past the textures actually loaded are left unbound
+	static constexpr uint32_t s_maxBindlessTextures = 4096;
+
+	// Opacity and specular are cooked into one BC5 texture (R and G) instead of two BC4 textures, one fetch for both in the shader
+	static constexpr bool s_packMaterialMasks = true;
+
+	// Skybox is a cooked BC7 cube (cooked once from the faces) instead of RGBA8 faces decoded at every startup
+	static constexpr bool s_compressSkybox = true;
+
+	// Material textures in material order (diffuse, opacity, specular, normal), with packed masks opacity and specular are the same texture
+	static std::array<TextureSource, 4> getMaterialTextureSources(const std::array<std::string, 4>& texturePaths);
+
+	// Culling and LOD selection of the scene entities run on the GPU (outside the render pass), the draws are indirect (inside it)
+	// Also reports the screen coverage of every material drawn in the last completed use of this frame to the texture streamer
+	void cullObjects(vk::CommandBuffer& cmd, uint32_t frameIdx, const glm::mat4& viewProj, float screenHeight);
+	void drawObjects(vk::CommandBuffer& cmd, uint32_t frameIdx);
 
 	void setupResources();
 	
 	void createDescriptorPool();
 	void createUBOs();
-	void loadTextures();
+	void loadTextures(UploadBatch& batch);
+	void benchmarkMipGeneration(const std::string& filePath);
 	void setupDescriptorSetLayouts();
-	void configurePushConstantRange();
 	void allocateDescriptorSets();
 	void createGraphicsPipeline();
 
-	void createRenderModels();
-	void loadExternalModel(const std::filesystem::path& filePath);
-	void loadMaterial(std::string directory, AssimpMaterialPaths texturePaths);
-	void uploadTexture(std::string finalPathm, bool genMips, bool srgb, std::string materialParentPath, uint32_t bindingSlot);
+	void createRenderModels(UploadBatch& batch);
+	void loadExternalModel(UploadBatch& batch, const std::filesystem::path& filePath);
+	void cookExternalModel(const std::filesystem::path& sourcePath, const std::filesystem::path& cookedPath);
+	void loadMaterial(UploadBatch& batch, std::string directory, AssimpMaterialPaths texturePaths);
+	std::array<std::string, 4> getMaterialTexturePaths(const std::string& directory, const AssimpMaterialPaths& texturePaths) const;
+	void cookTexturesAsync(const std::vector<TextureSource>& textures);
+	StreamedTextureSlot uploadTexture(UploadBatch& batch, const TextureSource& source);
+
+	// Next free element of the bindless texture array
+	uint32_t allocateTextureSlot();
+	// Slot of an engine texture (m_mappedTextures), written on first use
+	uint32_t getTextureSlot(const std::string& textureName);
+	// Materials are shared by their parent (diffuse) path, a later call for the same parent replaces its textures
+	uint32_t createMaterial(const std::string& materialParentPath, const MaterialData& materialData);
+	// Every material has to be created before this, the buffer is not resized afterwards
+	void createMaterialBuffer(UploadBatch& batch);
 
 
 private:
@@ -122,14 +186,17 @@ private:
 	vk::DescriptorSet m_engineDescriptorSet;		// we will be using a single descriptor set for engine data (resources with offsets!) --> One buffer for all
 	std::unique_ptr<Buffer> m_engineFrameBuffer;
 
-	std::vector<ObjectFrameData> m_objectFrameData;		// Currently not used (planned to use for SSBO)
+	// Vertices and indices of every model, one vertex and one index buffer (outlives the models and the culler)
+	std::unique_ptr<GeometryPool> m_geometryPool;
+
+	// Draw records of the scene, model matrices and indirect commands (Set 3)
+	std::unique_ptr<GpuCuller> m_gpuCuller;
+	GpuCuller::DrawStats m_drawStats;		// Of the last recorded frame, plus the binds of drawObjects
 
 	vk::UniqueDescriptorPool m_descriptorPool;
 	vk::UniqueDescriptorSetLayout m_engineDescriptorSetLayout;
 	vk::UniqueDescriptorSetLayout m_passDescriptorSetLayout;
-	vk::UniqueDescriptorSetLayout m_materialDescriptorSetLayout;
-	vk::UniqueDescriptorSetLayout m_objectDescriptorSetLayout;
-	vk::PushConstantRange m_pushConstantRange;
+	vk::UniqueDescriptorSetLayout m_materialDescriptorSetLayout;		// Bindless texture array and material buffer
 
 	vk::UniquePipelineLayout m_mainGfxPipelineLayout;
 	vk::UniquePipelineLayout m_skyboxGfxPipelineLayout;
@@ -138,8 +205,28 @@ private:
 
 	vk::UniqueSampler m_commonSampler;
 
+	// Texture decoding/cooking is spread over worker threads, uploads pick up the results in order
+	ThreadPool m_decodePool;
+	std::unordered_map<std::string, std::future<void>> m_pendingCooks;		// By cooked path
+
+	std::unique_ptr<UploadBatch> m_uploadBatch;
+
+	// Model textures only keep their small mips resident up front, the rest is streamed in by screen coverage
+	std::unique_ptr<TextureStreamer> m_textureStreamer;
+	std::unordered_map<std::string, StreamedTextureSlot> m_streamedTextures;						// By cooked path
+	std::vector<uint32_t> m_streamedTextureSlots;													// By streamer handle (shared by identical textures)
+	std::unordered_map<uint32_t, std::vector<TextureStreamer::Handle>> m_materialTextures;		// By material index, in material order
+
+	// Set 2 is bound once per frame: every texture lives in one array and materials are indices into it
+	// One set per frame in flight, so the streamer can swap a texture in a frame's set while the other frames are still being drawn
+	TextureStreamer::FrameDescriptorSets m_materialDescriptorSets;
+	uint32_t m_textureSlotCount = 0;
+	std::unordered_map<std::string, uint32_t> m_engineTextureSlots;		// By m_mappedTextures name
+	std::vector<MaterialData> m_materialData;								// By material index
+	std::unique_ptr<Buffer> m_materialBuffer;
+
 	// Assets
-	std::map<std::string, std::unique_ptr<Texture>> m_mappedTextures;
+	std::map<std::string, std::unique_ptr<Texture>> m_mappedTextures;		// Engine textures (skybox, defaults)
 	std::map<std::string, std::unique_ptr<Material>> m_mappedMaterials;
 	std::unordered_map<std::string, std::unique_ptr<RenderModel>> m_loadedModels;
 };
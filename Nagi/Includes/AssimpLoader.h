@@ -13,11 +13,26 @@ struct aiScene;
 
 namespace Nagi
 {
+	struct AssimpIndexRange
+	{
+		unsigned int indexStart;
+		unsigned int indexCount;
+	};
+
 	struct AssimpMeshSubset
 	{
 		unsigned int vertexStart;
 		unsigned int indexStart;
 		unsigned int indexCount;
+		bool use16BitIndices = false;		// Indices are relative to vertexStart, so most subsets fit in 16 bits
+		unsigned int meshletStart = 0;
+		unsigned int meshletCount = 0;
+		std::vector<AssimpIndexRange> lods;		// Coarser LODs in the same vertex range, LOD 0 is indexStart/indexCount
+
+		// Model space bounds of the vertex range, for culling and screen size
+		glm::vec3 aabbMin = glm::vec3(0.f);
+		glm::vec3 aabbMax = glm::vec3(0.f);
+		glm::vec4 boundingSphere = glm::vec4(0.f);		// Center (xyz) and radius (w)
 
 		std::optional<std::string> diffuseFilePath;
 		std::optional<std::string> specularFilePath;
@@ -43,6 +58,11 @@ namespace Nagi
 		std::optional<std::string> opacityFilePath;
 	};
 
+	// Packs the 32-bit subset indices into one index buffer where each subset uses 16-bit indices if it can.
+	// Subset (and LOD) indexStart is rewritten to count in units of its own index type from the start of the buffer
+	// (32-bit ranges are aligned to 4 bytes), so the buffer can be bound once per index type at offset 0.
+	std::vector<uint8_t> packSubsetIndices(const std::vector<uint32_t>& indices, std::vector<AssimpMeshSubset>& subsets);
+
 	class AssimpLoader
 	{
 	public:
@@ -52,6 +72,11 @@ namespace Nagi
 
 		const std::vector<AssimpVertex>& getVertices() const;
 		const std::vector<uint32_t>& getIndices() const;
+
+		// Moves the data out instead of copying it (the loader is left empty)
+		std::vector<AssimpVertex> releaseVertices();
+		std::vector<uint32_t> releaseIndices();
+
 		const std::vector<AssimpMeshSubset>& getSubsets() const;
 		const std::vector<AssimpMaterialPaths> getMaterials() const;
 
@@ -0,0 +1,74 @@
+#pragma once
+#include "AssimpLoader.h"
+#include "VertexLayout.h"
+#include "Meshlet.h"
+
+namespace Nagi
+{
+	class MappedFile;
+
+	// Cooked binary mesh (.nagimesh)
+	// Holds GPU-ready vertices and indices, the subset table and the material paths of an imported model.
+	// It is written once from the AssimpLoader output and memory mapped on subsequent loads so that the
+	// vertex/index bytes can go straight into a staging buffer without running the Assimp import again.
+	class CookedMesh
+	{
+	public:
+		static constexpr const char* s_fileExtension = ".nagimesh";
+		static constexpr uint32_t s_version = 8;
+
+	public:
+		CookedMesh() = delete;
+		CookedMesh(const std::filesystem::path& cookedPath);
+		~CookedMesh();
+
+		CookedMesh(const CookedMesh&) = delete;
+		CookedMesh& operator=(const CookedMesh&) = delete;
+
+		// Cooked file exists, has a matching version/vertex layout and is not older than the source asset
+		static bool isUpToDate(const std::filesystem::path& cookedPath, const std::filesystem::path& sourcePath, uint32_t vertexStride);
+
+		static void write(
+			const std::filesystem::path& cookedPath,
+			const void* vertexData, uint32_t vertexStride, uint32_t vertexCount,
+			const PositionQuantization& quantization,
+			const glm::vec4& boundingSphere,
+			const std::vector<uint8_t>& indexData,		// From packSubsetIndices (mixed 16/32-bit ranges)
+			const std::vector<AssimpMeshSubset>& subsets,
+			const std::vector<Meshlet>& meshlets,
+			const std::vector<AssimpMaterialPaths>& materials);
+
+		// Views into the mapped file, valid for the lifetime of this object
+		const void* getVertexData() const;
+		size_t getVertexDataSize() const;
+		uint32_t getVertexStride() const;
+		uint32_t getVertexCount() const;
+		const PositionQuantization& getPositionQuantization() const;
+		const glm::vec4& getBoundingSphere() const;
+
+		const void* getIndexData() const;
+		size_t getIndexDataSize() const;
+
+		const std::vector<AssimpMeshSubset>& getSubsets() const;
+		const std::vector<Meshlet>& getMeshlets() const;
+		const std::vector<AssimpMaterialPaths>& getMaterials() const;
+
+	private:
+		std::unique_ptr<MappedFile> m_file;
+
+		const uint8_t* m_vertexData = nullptr;
+		size_t m_vertexDataSize = 0;
+		uint32_t m_vertexStride = 0;
+		uint32_t m_vertexCount = 0;
+		PositionQuantization m_quantization;
+		glm::vec4 m_boundingSphere;
+
+		const uint8_t* m_indexData = nullptr;
+		size_t m_indexDataSize = 0;
+
+		// Small tables are unpacked on load
+		std::vector<AssimpMeshSubset> m_subsets;
+		std::vector<Meshlet> m_meshlets;
+		std::vector<AssimpMaterialPaths> m_materials;
+	};
+}
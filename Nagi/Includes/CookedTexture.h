@@ -0,0 +1,92 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include "TextureCompression.h"
+
+namespace Nagi
+{
+	class MappedFile;
+	class ThreadPool;
+
+	// Source image(s) of a cooked texture
+	struct TextureSource
+	{
+		std::filesystem::path path;
+		std::filesystem::path secondaryPath;		// MaskPair only: R is the mask of 'path', G the mask of 'secondaryPath'
+		TextureUsage usage = TextureUsage::Color;
+	};
+
+	// Block compressed texture with its full mip chain in a KTX2 container (.ktx2)
+	// Cooked once from the source image (BC7 for color, BC4 for masks, BC5 for normals) and memory mapped on load
+	// so that the mip levels can be copied straight into staging memory without decoding or runtime mip blits.
+	// Only what we write is supported: single 2D image or cube (six faces per level), no supercompression.
+	// The key/value data holds the hash of the block data (computed at cook time), other entries are ignored.
+	class CookedTexture
+	{
+	public:
+		static constexpr const char* s_fileExtension = ".ktx2";
+
+	public:
+		CookedTexture() = delete;
+		CookedTexture(const std::filesystem::path& cookedPath);
+		~CookedTexture();
+
+		CookedTexture(const CookedTexture&) = delete;
+		CookedTexture& operator=(const CookedTexture&) = delete;
+
+		// Source path with the extension replaced by the block format and .ktx2 (e.g foo.png -> foo.bc7.ktx2)
+		// Mask pairs are named after both sources (e.g opacity.png + spec.png -> opacity+spec.bc5.ktx2)
+		static std::filesystem::path getCookedPath(const TextureSource& source);
+		static vk::Format getFormat(TextureUsage usage);
+
+		// Cooked file exists, has the format for this usage and is not older than the source image(s)
+		static bool isUpToDate(const std::filesystem::path& cookedPath, const TextureSource& source);
+
+		// Decodes the source image(s), builds and compresses the mip chain and writes the KTX2 file (safe to run on worker threads)
+		static void cook(const TextureSource& source, const std::filesystem::path& cookedPath);
+		// Every level of a cube holds the faces back to back in layer order (+X, -X, +Y, -Y, +Z, -Z)
+		static void write(const std::filesystem::path& cookedPath, vk::Format format, const std::vector<CompressedMip>& mips, uint32_t faceCount = 1);
+
+		// Color cube (BC7) from six square face images of the same size, named after the directory of the faces (e.g Skybox/ -> Skybox/cube.bc7.ktx2)
+		static std::filesystem::path getCubeCookedPath(const std::filesystem::path& directory);
+		static bool isCubeUpToDate(const std::filesystem::path& cookedPath, const std::array<std::filesystem::path, 6>& facePaths);
+		// Faces are decoded and compressed in parallel on the pool, waits for them (don't call it from a worker of that pool)
+		static void cookCube(ThreadPool& pool, const std::array<std::filesystem::path, 6>& facePaths, const std::filesystem::path& cookedPath);
+
+		vk::Format getFormat() const;
+		uint32_t getWidth() const;
+		uint32_t getHeight() const;
+		uint32_t getLevelCount() const;
+		uint32_t getFaceCount() const;			// 1 or 6
+
+		// Hash of the block data of every level and the format, identical for identical content (the encoders are deterministic)
+		uint64_t getContentHash() const;
+
+		// All levels are stored in one contiguous range of the mapped file, level offsets are relative to its start
+		const uint8_t* getData() const;
+		size_t getDataSize() const;
+		size_t getLevelOffset(uint32_t level) const;
+		size_t getLevelSize(uint32_t level) const;
+
+		// Starts reading the levels from firstLevel down to 1x1 in the background (front of the data)
+		void prefetch(uint32_t firstLevel) const;
+
+	private:
+		struct Level
+		{
+			size_t offset;
+			size_t size;
+		};
+
+		std::unique_ptr<MappedFile> m_file;
+
+		vk::Format m_format = vk::Format::eUndefined;
+		uint32_t m_width = 0;
+		uint32_t m_height = 0;
+		uint32_t m_faceCount = 1;
+		uint64_t m_contentHash = 0;
+
+		const uint8_t* m_data = nullptr;
+		size_t m_dataSize = 0;
+		std::vector<Level> m_levels;
+	};
+}
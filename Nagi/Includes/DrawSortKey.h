@@ -0,0 +1,46 @@
+#pragma once
+
+namespace Nagi
+{
+	// Draw order packed into 64 bits, most significant field first, so sorting the keys sorts the draws by
+	// pass, then pipeline state, material, mesh and finally front to back depth.
+	// Fields are dense ranks (not handles), the caller maps its pipelines, materials and meshes to them.
+	//
+	//   63    62 61         52 51         36 35         16 15          0
+	//  [ pass ][   pipeline   ][  material   ][    mesh     ][   depth    ]
+	class DrawSortKey
+	{
+	public:
+		static constexpr uint32_t s_passBits = 2;
+		static constexpr uint32_t s_pipelineBits = 10;
+		static constexpr uint32_t s_materialBits = 16;
+		static constexpr uint32_t s_meshBits = 20;
+		static constexpr uint32_t s_depthBits = 16;
+
+	public:
+		// Throws if a field does not fit its bits
+		static uint64_t make(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, uint32_t depth);
+
+		// [0, 1] from the nearest to the furthest draw, clamped
+		static uint32_t quantizeDepth(float normalizedDepth);
+
+		static uint32_t getPass(uint64_t key);
+		static uint32_t getPipeline(uint64_t key);
+		static uint32_t getMaterial(uint64_t key);
+		static uint32_t getMesh(uint64_t key);
+		static uint32_t getDepth(uint64_t key);
+
+	private:
+		static constexpr uint32_t s_depthShift = 0;
+		static constexpr uint32_t s_meshShift = s_depthShift + s_depthBits;
+		static constexpr uint32_t s_materialShift = s_meshShift + s_meshBits;
+		static constexpr uint32_t s_pipelineShift = s_materialShift + s_materialBits;
+		static constexpr uint32_t s_passShift = s_pipelineShift + s_pipelineBits;
+		static_assert(s_passShift + s_passBits == 64);
+	};
+
+	// Stable LSD radix sort of the keys, one byte per pass. 'order' gets the key indices in sorted order, the keys are not moved.
+	// All byte histograms are built in one read of the keys, and passes over bytes that are the same in every key are skipped
+	// (with dense fields most of the high bytes are).
+	void radixSort(const std::vector<uint64_t>& keys, std::vector<uint32_t>& order);
+}
@@ -25,6 +25,13 @@ namespace Nagi
 			m_registry.remove_if_exists<T>(m_enttID);
 		}
 
+		// Modifies the component through the given functions and notifies update observers (e.g GpuCuller picks up changed transforms)
+		template<typename T, typename... Func>
+		void patchComponent(Func &&... func)
+		{
+			m_registry.patch<T>(m_enttID, std::forward<Func>(func)...);
+		}
+
 		template<typename T>
 		T& getComponent()
 		{
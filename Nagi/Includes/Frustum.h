@@ -0,0 +1,19 @@
+#pragma once
+
+namespace Nagi
+{
+	// View frustum as six planes pointing inwards (xyz normal, w distance)
+	// Culling itself runs on the GPU (shader_cull.comp), this only extracts the planes
+	class Frustum
+	{
+	public:
+		// Planes of a [0, 1] depth projection (GLM_FORCE_DEPTH_ZERO_TO_ONE)
+		static Frustum fromViewProjection(const glm::mat4& viewProj);
+
+		// Left, right, bottom, top, near, far (normalized)
+		const std::array<glm::vec4, 6>& getPlanes() const;
+
+	private:
+		std::array<glm::vec4, 6> m_planes;
+	};
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "VulkanContext.h"
+
+namespace Nagi
+{
+	class Buffer;
+
+	// Offset ranges of a fixed size space, free ranges are kept sorted by offset and merged with their neighbours when freed
+	// Allocation is first fit, alignments do not have to be powers of two (e.g a vertex stride)
+	class FreeListAllocator
+	{
+	public:
+		FreeListAllocator() = delete;
+		FreeListAllocator(vk::DeviceSize size);
+		~FreeListAllocator() = default;
+
+		// Nothing if there is no free range large enough
+		std::optional<vk::DeviceSize> allocate(vk::DeviceSize size, vk::DeviceSize alignment);
+		// Offset and size as allocated
+		void free(vk::DeviceSize offset, vk::DeviceSize size);
+
+		vk::DeviceSize getSize() const;
+		vk::DeviceSize getUsedSize() const;
+		size_t getFreeRangeCount() const;
+
+	private:
+		std::map<vk::DeviceSize, vk::DeviceSize> m_freeRanges;		// Size by offset
+		vk::DeviceSize m_size;
+		vk::DeviceSize m_usedSize = 0;
+	};
+
+	// Where a model lives in the geometry pool
+	struct GeometryRange
+	{
+		vk::DeviceSize vertexOffset = 0;		// Bytes, a whole number of vertices from the start of the vertex buffer
+		vk::DeviceSize vertexSize = 0;
+		vk::DeviceSize indexOffset = 0;			// Bytes, 4 byte aligned so that 16 and 32-bit indices both start on a whole index
+		vk::DeviceSize indexSize = 0;
+		uint32_t vertexStride = 0;
+
+		// Add to the model relative vertex offset and first index of a mesh to get its absolute ones
+		uint32_t getBaseVertex() const;
+		uint32_t getBaseIndex(vk::IndexType indexType) const;
+	};
+
+	// Every vertex and index of the loaded models in one device local vertex buffer and one index buffer.
+	// Models get a range of both, so draws of different models need no buffer binds in between and can be merged into one indirect draw.
+	// The vertex buffer is bound at offset 0 and meshes address it through their vertex offset, which is why vertex ranges are aligned to the stride.
+	// Freed ranges are reused once the frames that may still draw from them have finished.
+	class GeometryPool
+	{
+	public:
+		static constexpr vk::DeviceSize s_defaultVertexCapacity = 256ull * 1024 * 1024;
+		static constexpr vk::DeviceSize s_defaultIndexCapacity = 128ull * 1024 * 1024;
+
+	public:
+		GeometryPool() = delete;
+		GeometryPool(VulkanContext& context, vk::DeviceSize vertexCapacity = s_defaultVertexCapacity, vk::DeviceSize indexCapacity = s_defaultIndexCapacity);
+		~GeometryPool();
+
+		GeometryPool(const GeometryPool&) = delete;
+		GeometryPool& operator=(const GeometryPool&) = delete;
+		GeometryPool(GeometryPool&&) = delete;
+		GeometryPool& operator=(GeometryPool&&) = delete;
+
+		// Fill the range through UploadBatch::copyToBuffer/mapBufferCopy at its offsets into getVertexBuffer()/getIndexBuffer()
+		// Throws if the pool is full. Waits for the frames in flight if freed ranges are pending, so call it outside beginFrame/endFrame
+		GeometryRange allocate(vk::DeviceSize vertexSize, uint32_t vertexStride, vk::DeviceSize indexSize);
+		// Reusable after the frames in flight at the next allocation
+		void free(const GeometryRange& range);
+
+		const vk::Buffer& getVertexBuffer() const;
+		const vk::Buffer& getIndexBuffer() const;
+
+		const FreeListAllocator& getVertexAllocator() const;
+		const FreeListAllocator& getIndexAllocator() const;
+
+	private:
+		void reclaimFreed();
+
+	private:
+		VulkanContext& m_context;
+
+		std::unique_ptr<Buffer> m_vertexBuffer;
+		std::unique_ptr<Buffer> m_indexBuffer;
+		FreeListAllocator m_vertexAllocator;
+		FreeListAllocator m_indexAllocator;
+
+		std::vector<GeometryRange> m_pendingFrees;		// Possibly still read by frames in flight
+	};
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include "VulkanContext.h"
+#include "ResourceTypes.h"
+#include "Scene.h"
+
+namespace Nagi
+{
+	class UploadBatch;
+
+	// One entry of the draw record buffer (std430, DrawRecord in Shaders/draw_record)
+	struct DrawRecordData
+	{
+		glm::vec4 aabbMin;				// Model space box of the mesh (xyz)
+		glm::vec4 aabbMax;
+		glm::vec4 meshSphere;			// Model space sphere of the mesh (texture streaming coverage)
+		glm::vec4 modelSphere;			// Model space sphere of the whole model (LOD selection)
+		PositionQuantization positionQuantization;
+		glm::uvec4 firstIndex;			// Per LOD
+		glm::uvec4 indexCount;
+		uint32_t objectIndex;			// Into the object buffer (model matrix)
+		uint32_t materialIndex;
+		int32_t vertexOffset;
+		uint32_t batchIndex;
+		uint32_t batchFirstCommand;
+		uint32_t padding[3];
+	};
+
+	// GPU driven culling and draw submission for every entity with a render model
+	// build() turns every render unit of every entity into a draw record (index ranges of all LODs, bounds, material) in a device local buffer
+	// and uploads the entity transforms into the device local object buffer.
+	// Every frame cull() copies the transforms patched since the last frame into the object buffer and runs a compute pass that frustum culls the records,
+	// selects their LOD by the screen size of their model and writes a VkDrawIndexedIndirectCommand for the visible ones into the batch
+	// of their index type and pipeline. Every model lives in the geometry pool, so a batch spans all models and draw() binds the buffers
+	// once and submits one indirect draw per batch. The CPU cost of a frame depends on the number of batches rather than on the number
+	// of entities and render units (only the changed transforms are copied).
+	// The vertex shader finds its record, and the model matrix, dequantization and material through it, by gl_InstanceIndex.
+	// Records are ordered by DrawSortKey (pipeline state, material, mesh, depth), which lays out the batches and the commands in them.
+	class GpuCuller
+	{
+	public:
+		// Binds and state changes recorded by draw()
+		struct DrawStats
+		{
+			uint32_t pipelineBinds = 0;
+			uint32_t descriptorBinds = 0;
+			uint32_t bufferBinds = 0;			// Vertex and index buffer
+			uint32_t indirectDraws = 0;			// Indirect draw calls, not the draws they execute
+			uint32_t materialChanges = 0;		// Between consecutive records of a batch, counted once at build over all records (culled ones included)
+			uint32_t visibleDraws = 0;			// Draws left after culling, read back from the last completed use of this frame index
+		};
+
+	public:
+		// LOD i is used while the model covers at least lodScreenSizes[i] of the screen height (coarsest LOD below that)
+		// Models smaller than minScreenSize are not drawn at all
+		// Every model drawn through this has to be in 'geometryPool'
+		GpuCuller(VulkanContext& context, const GeometryPool& geometryPool, const std::array<float, Mesh::s_maxLods - 1>& lodScreenSizes, float minScreenSize);
+		~GpuCuller();
+
+		GpuCuller() = delete;
+		GpuCuller(const GpuCuller&) = delete;
+		GpuCuller& operator=(const GpuCuller&) = delete;
+		GpuCuller(GpuCuller&&) = delete;
+		GpuCuller& operator=(GpuCuller&&) = delete;
+
+		// Set 3 of the graphics pipelines drawn through this (object buffer and draw records, vertex stage)
+		vk::DescriptorSetLayout getDrawSetLayout() const;
+
+		// Records the draws of every entity with a TransformComponent and ModelRefComponent, usable once the batch has completed
+		// Instances of a mesh are ordered front to back from viewPosition at build time (compacted commands keep that order)
+		// Entities added or removed later are not drawn until the next build
+		// Later transform changes have to go through registry.patch/replace (Entity::patchComponent), writing the component directly goes unnoticed
+		// Call outside beginFrame/endFrame, waits for the frames in flight when rebuilding
+		void build(UploadBatch& batch, Scene& scene, const glm::vec3& viewPosition);
+
+		// Outside the render pass, after beginFrame
+		void cull(vk::CommandBuffer cmd, uint32_t frameIdx, const glm::mat4& viewProj, float screenHeight);
+
+		// Inside the render pass after cull, binds Set 3 through the given layout, the geometry pool buffers and the pipelines of the batches
+		DrawStats draw(vk::CommandBuffer cmd, uint32_t frameIdx, vk::PipelineLayout pipelineLayout);
+
+		// Largest screen coverage (pixels along the screen height) of the visible render units of every material, by material index
+		// From the last completed use of this frame, read it after beginFrame and before cull
+		std::span<const float> getMaterialCoverage(uint32_t frameIdx);
+
+		uint32_t getRecordCount() const;
+		uint32_t getBatchCount() const;
+
+	private:
+		struct CullConstants
+		{
+			std::array<glm::vec4, 6> planes;
+			glm::vec4 depthRow;
+			float projectionScale;
+			float screenHeight;
+			uint32_t recordCount;
+			uint32_t phase;			// Cull, scan or compact, see shader_cull.comp
+		};
+
+		struct Batch
+		{
+			vk::IndexType indexType;
+			vk::Pipeline pipeline;
+			uint32_t firstCommand;
+			uint32_t commandCount;
+		};
+
+		struct FrameData
+		{
+			std::unique_ptr<Buffer> transformStaging;	// Persistently mapped, the patched transforms of this frame are copied from here
+			std::unique_ptr<Buffer> commandBuffer;
+			std::unique_ptr<Buffer> countBuffer;		// Draw count per batch
+			std::unique_ptr<Buffer> coverageBuffer;		// Read back, per material
+			std::unique_ptr<Buffer> recordStateBuffer;	// Compaction only, culling result per record
+			std::unique_ptr<Buffer> groupBuffer;		// Compaction only, visible records per workgroup
+			std::unique_ptr<Buffer> statsBuffer;		// Read back, visible draws
+
+			vk::DescriptorSet cullSet;
+			vk::DescriptorSet drawSet;
+		};
+
+		static constexpr uint32_t s_workGroupSize = 64;
+
+		// CullConstants::phase
+		static constexpr uint32_t s_cullPhase = 0;
+		static constexpr uint32_t s_scanPhase = 1;
+		static constexpr uint32_t s_compactPhase = 2;
+
+		// Every record is drawn in the main pass
+		static constexpr uint32_t s_opaquePass = 0;
+
+		void createPipeline(const std::array<float, Mesh::s_maxLods - 1>& lodScreenSizes, float minScreenSize);
+		void createFrameData();
+
+	private:
+		VulkanContext& m_context;
+		const GeometryPool& m_geometryPool;
+		bool m_compactCommands;					// Draw count written by the GPU (drawIndexedIndirectCount)
+
+		vk::UniqueDescriptorPool m_descriptorPool;
+		vk::UniqueDescriptorSetLayout m_cullSetLayout;
+		vk::UniqueDescriptorSetLayout m_drawSetLayout;
+		vk::UniquePipelineLayout m_cullPipelineLayout;
+		vk::UniquePipeline m_cullPipeline;
+
+		Scene* m_scene = nullptr;
+		std::vector<entt::entity> m_entities;		// By object index
+		std::unordered_map<entt::entity, uint32_t> m_objectIndices;
+		entt::observer m_transformObserver;			// Entities whose TransformComponent was patched since the last cull
+		std::unique_ptr<Buffer> m_objectBuffer;		// Model matrices by object index, shared by the frames (copies are ordered on the graphics queue)
+		std::vector<Batch> m_batches;
+		std::unique_ptr<Buffer> m_recordBuffer;
+		uint32_t m_recordCount = 0;
+		uint32_t m_materialCount = 0;
+		uint32_t m_materialChanges = 0;
+		uint32_t m_visibleDraws = 0;				// Of the last completed use of the frame index passed to cull
+
+		std::vector<FrameData> m_frameData;		// Per frame in flight
+	};
+}
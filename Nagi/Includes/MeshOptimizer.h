@@ -0,0 +1,72 @@
+#pragma once
+#include "AssimpLoader.h"
+#include "Meshlet.h"
+
+namespace Nagi
+{
+	// Import time mesh optimization (run before cooking)
+	// Assimp gives us one vertex per face corner, so identical vertices are welded first.
+	// Triangles are reordered with Tipsify (Sander et al. 2007, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw")
+	// for post-transform vertex cache locality, the resulting clusters are sorted front to back for less overdraw
+	// and vertices are then renumbered in first use order for fetch locality.
+	// All index functions work on indices relative to the start of the vertex range (like our subsets).
+	struct VertexCacheStats
+	{
+		float acmr = 0.f;		// Average cache miss ratio: transformed vertices per triangle (0.5 at best, 3 at worst)
+		float atvr = 0.f;		// Average transform to vertex ratio: transformed vertices per referenced vertex (1 at best)
+	};
+
+	// Attributes within these distances of each other (after snapping to a grid of this size) are considered identical
+	struct WeldEpsilon
+	{
+		float position = 1e-5f;
+		float normal = 1e-3f;
+		float uv = 1e-5f;
+		float tangent = 1e-3f;		// Also used for the bitangent
+	};
+
+	// Merges identical vertices within every subset and rewrites the indices.
+	// Subset vertex ranges shrink, so vertexStart is updated as well. Prints the reduction.
+	void weldVertices(std::vector<AssimpVertex>& vertices, std::vector<uint32_t>& indices, std::vector<AssimpMeshSubset>& subsets, const WeldEpsilon& epsilon = {});
+
+	// Most GPUs behave roughly like a FIFO cache of this size or larger
+	constexpr uint32_t DEFAULT_VERTEX_CACHE_SIZE = 16;
+
+	// Simulates a FIFO post-transform cache
+	VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize = DEFAULT_VERTEX_CACHE_SIZE);
+
+	// Tipsify, reorders triangles in place.
+	// Optionally outputs the first triangle of every cluster (a new cluster starts whenever the fanning restarts outside the cache)
+	void optimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize = DEFAULT_VERTEX_CACHE_SIZE, std::vector<uint32_t>* clusters = nullptr);
+
+	// Reorders the clusters from optimizeVertexCache so that the ones facing away from the mesh center (likely occluders) are drawn first.
+	// The triangle order inside a cluster is kept so cache efficiency is mostly unaffected.
+	void optimizeOverdraw(uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& clusters, const AssimpVertex* vertices);
+
+	// Reorders vertices in first use order and remaps the indices, returns the new position of every old vertex.
+	// Unreferenced vertices are moved to the end.
+	std::vector<uint32_t> optimizeVertexFetchRemap(uint32_t* indices, size_t indexCount, uint32_t vertexCount);
+
+	// Runs all of the above on every subset and prints ACMR/ATVR before and after
+	void optimizeMesh(std::vector<AssimpVertex>& vertices, std::vector<uint32_t>& indices, const std::vector<AssimpMeshSubset>& subsets, bool reduceOverdraw = true);
+
+	// Splits every subset into meshlets by scanning its triangles in order (run after optimizeMesh so the meshlets are spatially coherent).
+	// Triangles are not reordered, a meshlet is simply closed when adding the next triangle would exceed the limits.
+	// Fills meshletStart/meshletCount of the subsets.
+	std::vector<Meshlet> buildMeshlets(const std::vector<AssimpVertex>& vertices, const std::vector<uint32_t>& indices, std::vector<AssimpMeshSubset>& subsets,
+		uint32_t maxVertices = MESHLET_MAX_VERTICES, uint32_t maxTriangles = MESHLET_MAX_TRIANGLES);
+
+	// Quadric error edge collapse (Garland & Heckbert) that only moves vertices onto existing vertices, so the result keeps using the same vertex buffer.
+	// Open edges (mesh borders and attribute seams) are locked so that simplified subsets never crack apart.
+	// Stops at targetIndexCount or when the next collapse would exceed targetError (relative to the mesh extent).
+	// Returns the simplified indices, resultError receives the largest relative error introduced.
+	std::vector<uint32_t> simplifyIndices(const uint32_t* indices, size_t indexCount, const AssimpVertex* vertices, uint32_t vertexCount,
+		size_t targetIndexCount, float targetError, float* resultError = nullptr);
+
+	// Appends up to maxLods - 1 coarser LODs (each about half of the previous one) of every subset to the indices and fills subset.lods.
+	// A subset gets fewer LODs if simplification stops making progress.
+	void buildLods(const std::vector<AssimpVertex>& vertices, std::vector<uint32_t>& indices, std::vector<AssimpMeshSubset>& subsets, uint32_t maxLods, float targetError = 0.02f);
+
+	// Sphere around the AABB center, model space center (xyz) and radius (w)
+	glm::vec4 computeBoundingSphere(const std::vector<AssimpVertex>& vertices);
+}
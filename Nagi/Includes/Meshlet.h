@@ -0,0 +1,24 @@
+#pragma once
+
+namespace Nagi
+{
+	// A small run of triangles (at most MESHLET_MAX_VERTICES unique vertices / MESHLET_MAX_TRIANGLES triangles)
+	// that is contiguous in the index buffer of its Mesh, so it can be culled and drawn on its own.
+	// Laid out for std430 so the same data can go into a storage buffer.
+	struct Meshlet
+	{
+		glm::vec4 boundingSphere;	// Model space center (xyz) and radius (w)
+
+		// Normal cone for backface culling, all triangles face away from a camera at position c if:
+		// dot(center - c, axis) >= cutoff * length(center - c) + radius
+		// cutoff is 1 when the triangles spread too much for the cone to ever cull
+		glm::vec4 cone;				// axis (xyz), cutoff (w)
+
+		uint32_t firstIndex;		// Relative to the first index of the owning Mesh
+		uint32_t indexCount;
+		uint32_t padding[2];
+	};
+
+	constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+	constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+namespace Nagi
+{
+	// CPU mip chain generation (runs on the decode worker threads instead of as a blit chain on the graphics queue)
+	// Levels are 2x2 box filtered in float with SSE. sRGB images are filtered in linear space so that mips do not darken.
+
+	// Levels of a full chain down to 1x1
+	uint32_t getMipLevelCount(uint32_t width, uint32_t height);
+
+	// Offset of every level (and the total size as the last element) of an RGBA8 chain stored back to back, level 0 first
+	std::vector<size_t> getMipChainOffsets(uint32_t width, uint32_t height);
+
+	// One 2x2 box filter step (the last row/column is repeated for odd sizes), dst is max(size / 2, 1)
+	void downsampleBox(const glm::vec4* src, uint32_t srcWidth, uint32_t srcHeight, glm::vec4* dst);
+
+	// Writes the full RGBA8 chain (level 0 copied as is) into dst, which must hold getMipChainOffsets().back() bytes
+	void generateMipChain(const uint8_t* rgba, uint32_t width, uint32_t height, bool srgb, uint8_t* dst);
+}
@@ -1,9 +1,15 @@
 #pragma once
 #include "VulkanContext.h"
+#include "VertexLayout.h"
+#include "Meshlet.h"
+#include "GeometryPool.h"
 
 
 namespace Nagi
 {
+	class UploadBatch;
+	class CookedTexture;
+	class ThreadPool;
 
 	// RAII Buffer (Vma destroy on dtor)
 	class Buffer
@@ -16,49 +22,32 @@ namespace Nagi
 		void putData(const void* inData, size_t dataSize, size_t offset = 0);
 		const vk::Buffer& getBuffer() const;
 
+		// Host visible buffers only, maps on first use and stays mapped
+		uint8_t* getMappedData();
+
 		// createView(const vk::BufferViewCreateInfo& viewCI);
 
 		// Helper designed for VB/IB
 		template <typename T>
-		static std::unique_ptr<Buffer> loadImmutable(const VulkanContext& context, const std::vector<T>& inData, vk::BufferUsageFlagBits usage)
+		static std::unique_ptr<Buffer> loadImmutable(VulkanContext& context, const std::vector<T>& inData, vk::BufferUsageFlagBits usage)
 		{
-			if (!(usage & vk::BufferUsageFlagBits::eVertexBuffer || usage & vk::BufferUsageFlagBits::eIndexBuffer))
-				throw std::runtime_error("loadVkImmutableBuffer suitability with non Vertex/Index buffers have not been checked! (Temporarily disabled for non Vertex/Index buffers");
-
-			uint32_t dataSizeInBytes = static_cast<uint32_t>(inData.size() * sizeof(T));
-			VmaAllocator allocator = context.getAllocator();
-
-			// Create staging buffer
-			vk::BufferCreateInfo stagingCI({}, dataSizeInBytes, vk::BufferUsageFlagBits::eTransferSrc);
-			VmaAllocationCreateInfo stagingBufAllocCI{};
-			stagingBufAllocCI.usage = VMA_MEMORY_USAGE_CPU_ONLY;
-
-			auto stagingBuffer = std::make_unique<Buffer>(allocator, stagingCI, stagingBufAllocCI);
-
-			// Copy data from CPU to staging buffer
-			stagingBuffer->putData(inData.data(), dataSizeInBytes);
-
-
-
-			// Create immutable buffer (device only) and copy data to it from staging
-			vk::BufferCreateInfo immutableBufCI({}, dataSizeInBytes, usage | vk::BufferUsageFlagBits::eTransferDst);
-			VmaAllocationCreateInfo immutableBufAllocCI{};
-			immutableBufAllocCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+			return loadImmutable(context, inData.data(), inData.size() * sizeof(T), usage);
+		}
 
-			auto immutableBuf = std::make_unique<Buffer>(allocator, immutableBufCI, immutableBufAllocCI);
+		template <typename T>
+		static std::unique_ptr<Buffer> loadImmutable(UploadBatch& batch, const std::vector<T>& inData, vk::BufferUsageFlagBits usage)
+		{
+			return loadImmutable(batch, inData.data(), inData.size() * sizeof(T), usage);
+		}
 
-			// Copy data from staging buffer to vertex buffer
-			auto& uploadContext = context.getUploadContext();
-			uploadContext.submitWork(
-				[&](const vk::CommandBuffer& cmd)
-				{
-					vk::BufferCopy copyRegion(0, 0, dataSizeInBytes);
-					cmd.copyBuffer(stagingBuffer->getBuffer(), immutableBuf->getBuffer(), copyRegion);
-				});
+		// Device local buffer without contents, fill it through UploadBatch::mapBufferCopy/copyToBuffer
+		static std::unique_ptr<Buffer> createDeviceLocal(VulkanContext& context, size_t sizeInBytes, vk::BufferUsageFlags usage);
 
+		// Raw byte variant (e.g data straight from a memory mapped file)
+		static std::unique_ptr<Buffer> loadImmutable(VulkanContext& context, const void* inData, size_t dataSizeInBytes, vk::BufferUsageFlagBits usage);
 
-			return immutableBuf;
-		}
+		// Batched variant, the buffer is only valid for use once the batch submit has completed (wait on its upload timeline value)
+		static std::unique_ptr<Buffer> loadImmutable(UploadBatch& batch, const void* inData, size_t dataSizeInBytes, vk::BufferUsageFlagBits usage);
 
 	private:
 		// Non owning 
@@ -74,6 +63,47 @@ namespace Nagi
 	bool operator==(const Buffer& a, const Buffer& b);
 	bool operator!=(const Buffer& a, const Buffer& b);
 
+	// Decoded 8-bit RGBA pixels on the CPU (stbi free on dtor)
+	// Decoding does not touch any Vulkan state so it is safe to do on worker threads
+	// With generateMips the full chain is built on the CPU (sRGB correct) and cached on disk by the hash of the source file,
+	// later loads map the cached chain directly and skip decoding altogether.
+	class ImageData
+	{
+	public:
+		static constexpr const char* s_mipCacheDirectory = "Cache/Mips/";
+
+	public:
+		ImageData() = default;
+		~ImageData();
+
+		ImageData(ImageData&& other) noexcept;
+		ImageData& operator=(ImageData&& other) noexcept;
+		ImageData(const ImageData&) = delete;
+		ImageData& operator=(const ImageData&) = delete;
+
+		static ImageData fromFile(const std::string& filePath, bool generateMips = false, bool srgb = true, bool useMipCache = true);
+		static std::filesystem::path getMipCachePath(uint64_t sourceHash, bool srgb);
+
+		const uint8_t* getPixels() const;		// Level 0, the other levels follow back to back
+		uint32_t getWidth() const;
+		uint32_t getHeight() const;
+		size_t getSizeInBytes() const;			// Level 0 only
+
+		uint32_t getMipLevelCount() const;		// 1 unless the chain was generated
+		size_t getMipLevelOffset(uint32_t level) const;
+		size_t getMipChainSize() const;			// All levels
+
+	private:
+		uint8_t* m_pixels = nullptr;				// stbi owned
+		std::vector<uint8_t> m_mipChain;			// Freshly generated chain
+		std::unique_ptr<MappedFile> m_cacheFile;	// Chain mapped from the mip cache
+		const uint8_t* m_data = nullptr;			// Points into one of the above
+		std::vector<size_t> m_mipOffsets;			// Level offsets + total size (empty without mips)
+
+		uint32_t m_width = 0;
+		uint32_t m_height = 0;
+	};
+
 	// RAII texture (Vma destroy on dtor)
 	class Texture
 	{
@@ -87,8 +117,24 @@ namespace Nagi
 		const vk::Image& getImage() const;
 		const vk::ImageView& getImageView() const;
 
+		// Cooked .ktx2 files are detected by extension and uploaded with their own mip chain and format (generateMips/srgb are ignored)
 		static std::unique_ptr<Texture> fromFile(VulkanContext& context, const std::string& filePath, bool generateMips = false, bool srgb = true);
-		static std::unique_ptr<Texture> cubeFromFile(VulkanContext& context, const std::filesystem::path& filePath, bool srgb = true);
+		static std::unique_ptr<Texture> fromImageData(VulkanContext& context, const ImageData& image, bool generateMips = false, bool srgb = true);
+		static std::unique_ptr<Texture> cubeFromFile(VulkanContext& context, ThreadPool& decodePool, const std::filesystem::path& filePath, bool srgb = true);
+
+		// Face images of a cube in layer order (+X, -X, +Y, -Y, +Z, -Z) inside the given directory
+		static std::array<std::filesystem::path, 6> getCubeFacePaths(const std::filesystem::path& directory);
+
+		// Batched variants, the texture is only valid for use once the batch submit has completed (wait on its upload timeline value)
+		// generateMips uses the chain already in the ImageData (ImageData::fromFile with mips) and only falls back to GPU blits without one
+		static std::unique_ptr<Texture> fromImageData(UploadBatch& batch, const ImageData& image, bool generateMips = false, bool srgb = true);
+		// Only levels from firstLevel on are uploaded, the image is created with the size of firstLevel (used by texture streaming)
+		static std::unique_ptr<Texture> fromCooked(UploadBatch& batch, const CookedTexture& cooked, uint32_t firstLevel = 0);
+		// Faces are decoded in parallel on the decode pool with their mip chains built on the CPU (or loaded from the mip cache)
+		// Waits for the faces, so don't call it from a worker of that pool
+		static std::unique_ptr<Texture> cubeFromFile(UploadBatch& batch, ThreadPool& decodePool, const std::filesystem::path& filePath, bool srgb = true);
+		// Six square faces of the same size in layer order, all levels the faces carry are uploaded
+		static std::unique_ptr<Texture> cubeFromImageData(UploadBatch& batch, const std::vector<ImageData>& faces, bool srgb = true);
 
 	private:
 		// Non owning
@@ -109,17 +155,17 @@ namespace Nagi
 	{
 	public:
 		Material() = default;
-		Material(vk::Pipeline pipeline, vk::PipelineLayout pipelineLayout, vk::DescriptorSet descriptorSet);
+		Material(vk::Pipeline pipeline, vk::PipelineLayout pipelineLayout, uint32_t index);
 		~Material() = default;
 
 		const vk::Pipeline& getPipeline() const;
 		const vk::PipelineLayout& getPipelineLayout() const;
-		const vk::DescriptorSet& getDescriptorSet() const;
+		uint32_t getIndex() const;
 
 	private:
 		vk::Pipeline m_pipeline;						// actual pipeline (e.g full graphics pipeline states)
 		vk::PipelineLayout m_pipelineLayout;			// has descriptor set layout and push range info (needed for setting descriptor sets and pushing data for push constants)
-		vk::DescriptorSet m_descriptorSet;				// has the resource bindings
+		uint32_t m_index = 0;							// entry in the material buffer, which holds the indices of its textures in the bindless texture array
 	};
 
 	bool operator==(const Material& a, const Material& b);
@@ -128,19 +174,57 @@ namespace Nagi
 
 	class Mesh
 	{
+	public:
+		static constexpr uint32_t s_maxLods = 4;
+
 	public:
 		Mesh() = delete;
-		Mesh(uint32_t firstIndex, uint32_t numIndices, uint32_t vbOffset = 0);
+		// firstIndex counts in units of indexType from the start of the index buffer, vbOffset in vertices from the start of the vertex buffer
+		// Both are absolute positions in the geometry pool (see GeometryRange::getBaseIndex/getBaseVertex)
+		// firstMeshlet/numMeshlets index into the meshlets of the owning RenderModel (none if the mesh was not split)
+		Mesh(uint32_t firstIndex, uint32_t numIndices, uint32_t vbOffset = 0, vk::IndexType indexType = vk::IndexType::eUint32,
+			uint32_t firstMeshlet = 0, uint32_t numMeshlets = 0);
 		~Mesh() = default;
 
-		uint32_t getFirstIndex() const;
-		uint32_t getNumIndices() const;
+		// Coarser index range using the same vertices and index type, LOD 0 is the range given on construction
+		void addLod(uint32_t firstIndex, uint32_t numIndices);
+
+		// LODs past the last one clamp to the last one
+		uint32_t getFirstIndex(uint32_t lod = 0) const;
+		uint32_t getNumIndices(uint32_t lod = 0) const;
+		uint32_t getLodCount() const;
 		uint32_t getVertexBufferOffset() const;
+		vk::IndexType getIndexType() const;
+
+		// Meshlets only cover LOD 0
+		uint32_t getFirstMeshlet() const;
+		uint32_t getNumMeshlets() const;
+
+		// Model space center (xyz) and radius (w), by default the mesh is treated as always large on screen
+		void setBoundingSphere(const glm::vec4& boundingSphere);
+		const glm::vec4& getBoundingSphere() const;
+
+		// Model space box for frustum culling, by default unbounded (never culled)
+		void setAabb(const glm::vec3& aabbMin, const glm::vec3& aabbMax);
+		const glm::vec3& getAabbMin() const;
+		const glm::vec3& getAabbMax() const;
 
 	private:
-		uint32_t m_ibFirstIndex;
-		uint32_t m_numIndices;
+		struct IndexRange
+		{
+			uint32_t firstIndex;
+			uint32_t numIndices;
+		};
+
+		std::array<IndexRange, s_maxLods> m_lods;
+		uint32_t m_lodCount;
 		uint32_t m_vbOffset;
+		vk::IndexType m_indexType;
+		uint32_t m_firstMeshlet;
+		uint32_t m_numMeshlets;
+		glm::vec4 m_boundingSphere;
+		glm::vec3 m_aabbMin;
+		glm::vec3 m_aabbMax;
 	};
 
 	class RenderUnit
@@ -163,29 +247,41 @@ namespace Nagi
 	bool operator<(const RenderUnit& a, const RenderUnit& b);
 
 	// A collection of coherent meshes to be rendered
+	// Vertices and indices live in a range of the geometry pool, which is given back when the model is destroyed
 	class RenderModel
 	{
 	public:
 		RenderModel() = delete;
-		RenderModel(std::unique_ptr<Buffer> vb, std::unique_ptr<Buffer> ib, std::vector<RenderUnit> renderUnits);
-		~RenderModel() = default;
+		// The bounding sphere (model space) is used for LOD selection, by default the model is treated as always large on screen
+		RenderModel(GeometryPool& geometryPool, const GeometryRange& geometry, std::vector<RenderUnit> renderUnits, const PositionQuantization& quantization = {},
+			std::vector<Meshlet> meshlets = {}, const glm::vec4& boundingSphere = glm::vec4(0.f, 0.f, 0.f, std::numeric_limits<float>::max()));
+		~RenderModel();
 
+		// Shared by every model in the pool
 		const vk::Buffer& getVertexBuffer() const;
 		const vk::Buffer& getIndexBuffer() const;
+		const GeometryRange& getGeometry() const;
+		const PositionQuantization& getPositionQuantization() const;
+		const glm::vec4& getBoundingSphere() const;
 
 		const std::vector<RenderUnit>& getRenderUnits() const;
+		const std::vector<Meshlet>& getMeshlets() const;
 
+		// Moving hands the geometry range over, the moved-from model no longer frees it
 		RenderModel(const RenderModel&) = delete;
 		RenderModel& operator=(const RenderModel&) = delete;
-		RenderModel(RenderModel&&) = delete;
-		RenderModel operator=(RenderModel&&) = delete;
+		RenderModel(RenderModel&& other) noexcept;
+		RenderModel& operator=(RenderModel&& other) noexcept;
 
 	private:
 		std::vector<RenderUnit> m_renderUnits;
+		PositionQuantization m_quantization;		// Decodes the vertex positions if they are quantized
+		std::vector<Meshlet> m_meshlets;			// Referenced by the meshes of the render units
+		glm::vec4 m_boundingSphere;
 
-		// Owning
-		std::unique_ptr<Buffer> m_vb;
-		std::unique_ptr<Buffer> m_ib;
+		// Non-owning, the range is owned (no pool once moved from)
+		GeometryPool* m_geometryPool;
+		GeometryRange m_geometry;
 
 	};
 
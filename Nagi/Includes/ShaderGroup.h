@@ -1,5 +1,6 @@
 #pragma once
 #include <vulkan/vulkan.hpp>
+#include "VertexLayout.h"
 
 namespace spv_reflect { class ShaderModule; }
 
@@ -13,11 +14,16 @@ namespace Nagi
 		~ShaderGroup();
 
 		ShaderGroup& addStage(vk::ShaderStageFlagBits stage, const std::filesystem::path& path);
+
+		// Vertex buffer layout that the reflected vertex inputs are matched against (formats/offsets/stride come from here)
+		// Without it, unpacked float attributes on 16 byte boundaries are assumed
+		ShaderGroup& setVertexLayout(const VertexLayout& layout);
 		ShaderGroup& build(vk::Device dev);
 
 		vk::PipelineLayout getPipelineLayout();
 		vk::DescriptorSetLayout getPerMaterialSetLayout();
 		const std::vector<vk::DescriptorSetLayout>& getSetLayouts();
+		// Points into this ShaderGroup, keep it alive until the pipeline is created
 		vk::PipelineVertexInputStateCreateInfo getVertexInputStateCI();
 
 	private:
@@ -39,7 +45,7 @@ namespace Nagi
 		struct StageInfo
 		{
 			vk::ShaderStageFlagBits stage;
-			std::vector<uint8_t> code;
+			std::unique_ptr<MappedFile> code;		// SPIR-V, module creation and reflection read the mapping directly
 			vk::ShaderModule module;
 		};
 		
@@ -54,7 +60,9 @@ namespace Nagi
 		std::array<DescriptorSetLayoutData, 4> m_setLayoutsData;
 		std::vector<vk::DescriptorSetLayout> m_setLayouts;
 		std::vector<vk::PushConstantRange> m_pushConstantRanges;
-		vk::PipelineVertexInputStateCreateInfo m_vertInputState;
+		std::optional<VertexLayout> m_vertexLayout;
+		std::vector<vk::VertexInputBindingDescription> m_vertInputBindings;
+		std::vector<vk::VertexInputAttributeDescription> m_vertInputAttributes;
 		vk::PipelineLayout m_pipelineLayout;
 
 		std::vector<std::function<void()>> m_deletionQueue;
@@ -0,0 +1,69 @@
+#pragma once
+#include "VulkanContext.h"
+
+namespace Nagi
+{
+	class Buffer;
+
+	// One persistently mapped staging buffer shared by every upload, suballocated front to back and wrapping around.
+	// Allocations belong to an owner (the batch that records the copies) until the owner submits them with retire(),
+	// after which the space is reclaimed in order as soon as the upload timeline has passed the submit.
+	// Staging memory stays at the ring size no matter how much is loaded, and nothing is allocated or mapped per resource.
+	class StagingRing
+	{
+	public:
+		static constexpr vk::DeviceSize s_defaultSize = 128ull * 1024 * 1024;
+
+		struct Allocation
+		{
+			vk::Buffer buffer;
+			vk::DeviceSize offset;
+			uint8_t* mapped;
+		};
+
+	public:
+		StagingRing() = delete;
+		StagingRing(VmaAllocator allocator, const UploadContext& uploadContext, vk::DeviceSize size = s_defaultSize);
+		~StagingRing();
+
+		StagingRing(const StagingRing&) = delete;
+		StagingRing& operator=(const StagingRing&) = delete;
+		StagingRing(StagingRing&&) = delete;
+		StagingRing& operator=(StagingRing&&) = delete;
+
+		// Waits for submitted uploads to free up space if needed
+		// Returns nothing if the request is larger than the ring or the space is held by allocations that were never submitted
+		std::optional<Allocation> allocate(const void* owner, vk::DeviceSize size, vk::DeviceSize alignment);
+
+		// Everything the owner allocated so far is read by the upload signaling 'timelineValue' (0 drops allocations that were never submitted)
+		void retire(const void* owner, uint64_t timelineValue);
+
+		vk::DeviceSize getSize() const;
+		vk::DeviceSize getUsedSize() const;
+		vk::DeviceSize getPeakUsedSize() const;
+
+	private:
+		struct Region
+		{
+			vk::DeviceSize begin;
+			vk::DeviceSize end;
+			const void* owner;
+			bool retired;
+			uint64_t timelineValue;		// Free once the upload timeline reaches it
+		};
+
+		std::optional<vk::DeviceSize> findSpace(vk::DeviceSize size, vk::DeviceSize alignment) const;
+		void reclaimCompleted();
+
+	private:
+		const UploadContext& m_uploadContext;
+		std::unique_ptr<Buffer> m_buffer;
+		uint8_t* m_mapped = nullptr;
+		vk::DeviceSize m_size;
+
+		std::deque<Region> m_regions;		// Allocation order, the front is the tail of the ring
+		vk::DeviceSize m_head = 0;
+		vk::DeviceSize m_usedSize = 0;
+		vk::DeviceSize m_peakUsedSize = 0;
+	};
+}
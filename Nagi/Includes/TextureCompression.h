@@ -0,0 +1,37 @@
+#pragma once
+
+namespace Nagi
+{
+	// What a texture holds decides its block format
+	enum class TextureUsage
+	{
+		Color,		// BC7 sRGB, RGBA
+		Mask,		// BC4, single channel (opacity, specular)
+		Normal,		// BC5, tangent space XY (Z is reconstructed in the shader)
+		MaskPair	// BC5, two independent masks in R and G (opacity and specular packed into one texture)
+	};
+
+	// One level of a block compressed mip chain
+	struct CompressedMip
+	{
+		uint32_t width = 0;
+		uint32_t height = 0;
+		std::vector<uint8_t> data;		// Blocks in row major order
+	};
+
+	// Size in bytes of one 4x4 block
+	uint32_t getBlockSize(TextureUsage usage);
+
+	// Block encoders, src is a 4x4 block of RGBA8 pixels in row major order
+	void encodeBC7Block(const uint8_t* src, uint8_t* dst);		// Mode 6 only (single subset, RGBA 7.7.7.7 + p-bit endpoints, 4-bit indices)
+	void encodeBC4Block(const uint8_t* src, uint8_t* dst, uint32_t channel);
+	void encodeBC5Block(const uint8_t* src, uint8_t* dst);
+
+	// Channel a single channel mask is taken from: alpha if the image has any transparency, otherwise red
+	uint32_t getMaskChannel(const uint8_t* rgba, uint32_t width, uint32_t height);
+
+	// Builds the full mip chain down to 1x1 on the CPU and block compresses every level.
+	// Mips are box filtered in linear space for color, renormalized for normals.
+	// Masks are taken from getMaskChannel, mask pairs from R and G as they are.
+	std::vector<CompressedMip> compressTexture(const uint8_t* rgba, uint32_t width, uint32_t height, TextureUsage usage);
+}
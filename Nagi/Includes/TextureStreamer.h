@@ -0,0 +1,112 @@
+#pragma once
+#include "VulkanContext.h"
+
+namespace Nagi
+{
+	class Texture;
+	class CookedTexture;
+	class UploadBatch;
+
+	// Mip residency streaming for cooked (.ktx2) textures
+	// Textures start out with only their small mips resident (the tail, at most s_residentTailSize texels on a side).
+	// Every frame the renderer reports how many pixels each texture covers on screen, update() then decides how many mips
+	// every texture should have within the VRAM budget (largest coverage first) and brings in the missing ones in the background.
+	// Mips are only dropped when the budget is exceeded, starting with the textures that matter least.
+	// A residency change re-uploads the texture at its new size from the mapped file and swaps it in once the copy has landed.
+	// Bindings have one descriptor set per frame in flight, each is rewritten at the start of its own frame (when no submitted frame uses it),
+	// and the replaced image is freed once every frame that could still read it has finished, so a swap never stalls the CPU.
+	// Textures are deduplicated by content: cooked files with identical block data (identical source pixels and usage) share one texture.
+	class TextureStreamer
+	{
+	public:
+		using Handle = uint32_t;
+		using FrameDescriptorSets = std::array<vk::DescriptorSet, VulkanContext::getMaxFramesInFlight()>;		// By frame index
+
+		struct DedupStats
+		{
+			uint32_t hits = 0;
+			uint32_t misses = 0;
+			vk::DeviceSize bytesSaved = 0;		// Full mip chains that did not have to be stored and streamed again
+		};
+
+		static constexpr uint32_t s_residentTailSize = 128;
+		static constexpr vk::DeviceSize s_defaultBudget = 512ull * 1024 * 1024;
+		static constexpr vk::DeviceSize s_maxStreamedPerUpdate = 32ull * 1024 * 1024;		// Keeps the staging memory and copy time per update bounded
+
+	public:
+		TextureStreamer() = delete;
+		TextureStreamer(VulkanContext& context, vk::DeviceSize budget = s_defaultBudget);
+		~TextureStreamer();
+
+		TextureStreamer(const TextureStreamer&) = delete;
+		TextureStreamer& operator=(const TextureStreamer&) = delete;
+		TextureStreamer(TextureStreamer&&) = delete;
+		TextureStreamer& operator=(TextureStreamer&&) = delete;
+
+		// Uploads the mip tail through the given batch (valid once that batch has completed), the rest is streamed on demand
+		// Returns the handle of an existing texture if one with the same content was added before
+		Handle addTexture(UploadBatch& batch, const std::filesystem::path& cookedPath);
+
+		// Writes the current image into the descriptor (array element) of every frame's set now, and again every time the texture is swapped
+		void addBinding(Handle handle, const FrameDescriptorSets& descriptorSets, uint32_t binding, uint32_t arrayElement, vk::Sampler sampler);
+
+		// Screen coverage (in pixels along the larger side) the texture is drawn at, the largest request since the last update wins
+		void request(Handle handle, float screenPixels);
+
+		// Call once per frame right after beginFrame and before recording anything that binds the sets
+		void update(uint32_t frameIdx);
+
+		void setBudget(vk::DeviceSize budget);
+		vk::DeviceSize getBudget() const;
+		vk::DeviceSize getResidentSize() const;
+		uint32_t getTextureCount() const;
+		uint32_t getStreamingCount() const;			// Textures with an upload in flight
+		const DedupStats& getDedupStats() const;
+
+	private:
+		struct Binding
+		{
+			FrameDescriptorSets descriptorSets;
+			uint32_t binding;
+			uint32_t arrayElement;
+			vk::Sampler sampler;
+		};
+
+		struct StreamedTexture
+		{
+			std::unique_ptr<CookedTexture> cooked;
+			std::unique_ptr<Texture> texture;
+			uint32_t residentLevel;			// First level of the cooked chain that is in 'texture'
+			uint32_t tailLevel;				// Coarsest residentLevel, always resident
+
+			std::unique_ptr<Texture> pendingTexture;
+			uint32_t pendingLevel;
+
+			float requestedPixels = 0.f;
+			std::vector<Binding> bindings;
+			uint32_t staleFrames = 0;		// Bit per frame index whose sets still hold the previous image
+		};
+
+		// VRAM taken by the levels from 'level' down to 1x1
+		static vk::DeviceSize getSizeFrom(const StreamedTexture& texture, uint32_t level);
+		static uint32_t getDesiredLevel(const StreamedTexture& texture);
+		static bool hasSameContent(const CookedTexture& a, const CookedTexture& b);
+
+		void swapPendingTextures(uint32_t frameIdx);
+		void writeBindings(const StreamedTexture& texture, uint32_t frameIdx);
+
+	private:
+		VulkanContext& m_context;
+		std::unique_ptr<UploadBatch> m_batch;
+
+		std::vector<StreamedTexture> m_textures;
+		std::unordered_multimap<uint64_t, Handle> m_texturesByHash;		// By CookedTexture::getContentHash
+		DedupStats m_dedupStats;
+		vk::DeviceSize m_budget;
+		vk::DeviceSize m_residentSize = 0;
+		uint64_t m_pendingValue = 0;		// Upload timeline value of the uploads in flight (0 if none)
+
+		// Replaced images by the frame index they were swapped out in, freed the next time that frame starts (its fence has signaled)
+		std::array<std::vector<std::unique_ptr<Texture>>, VulkanContext::getMaxFramesInFlight()> m_retiredTextures;
+	};
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+
+namespace Nagi
+{
+	// Fixed size worker pool for CPU heavy asset work (e.g image decoding)
+	// Tasks are picked up in submission order, results (and exceptions) are returned through std::future
+	class ThreadPool
+	{
+	public:
+		ThreadPool(uint32_t threadCount = getDefaultThreadCount());
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		ThreadPool(ThreadPool&&) = delete;
+		ThreadPool& operator=(ThreadPool&&) = delete;
+
+		template <typename Func>
+		auto submit(Func&& func) -> std::future<std::invoke_result_t<Func>>
+		{
+			using ResultType = std::invoke_result_t<Func>;
+
+			// packaged_task is move only, std::function requires copyable targets
+			auto task = std::make_shared<std::packaged_task<ResultType()>>(std::forward<Func>(func));
+			auto result = task->get_future();
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_tasks.push_back([task]() { (*task)(); });
+			}
+			m_cv.notify_one();
+			return result;
+		}
+
+		uint32_t getThreadCount() const;
+
+		// Leave one core for the thread submitting the work (it is usually busy with GPU uploads)
+		static uint32_t getDefaultThreadCount();
+
+	private:
+		void workerLoop();
+
+	private:
+		std::vector<std::thread> m_workers;
+		std::deque<std::function<void()>> m_tasks;
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		bool m_stopping = false;
+	};
+}
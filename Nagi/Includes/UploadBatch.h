@@ -0,0 +1,117 @@
+#pragma once
+#include "VulkanContext.h"
+
+namespace Nagi
+{
+	class Buffer;
+
+	// Gathers uploads from many resources (buffer copies, image copies, layout transitions and mip blits)
+	// and submits them together through the UploadContext.
+	// Copies run on the transfer queue, ownership is then handed over to the graphics queue which finishes the images (mip blits, final layouts).
+	// Submission is asynchronous: graphics submits that use the resources wait on the UploadContext timeline semaphore.
+	// Staging memory comes from the staging ring of the UploadContext. Large copies are split into pieces, and when the ring
+	// is full (or the staging budget of the batch is exceeded) the pending work is submitted early so that the ring can move on.
+	class UploadBatch
+	{
+	public:
+		static constexpr vk::DeviceSize s_defaultStagingBudget = 64ull * 1024 * 1024;
+
+	public:
+		UploadBatch() = delete;
+		UploadBatch(VulkanContext& context, vk::DeviceSize stagingBudget = s_defaultStagingBudget);
+		~UploadBatch();
+
+		UploadBatch(const UploadBatch&) = delete;
+		UploadBatch& operator=(const UploadBatch&) = delete;
+		UploadBatch(UploadBatch&&) = delete;
+		UploadBatch& operator=(UploadBatch&&) = delete;
+
+		// Copy CPU data into staging memory and record a copy to the destination
+		// The written range of the destination buffer is handed over to the graphics queue on submit (the rest of it is left alone,
+		// so ranges of a buffer the GPU is drawing from can be filled as long as the draws do not read them)
+		// dstUsage is the usage the buffer was created with, the handoff makes the data visible to the stages that read it that way
+		void copyToBuffer(const void* data, vk::DeviceSize size, vk::Buffer dst, vk::BufferUsageFlags dstUsage, vk::DeviceSize dstOffset = 0);
+
+		// Same as copyToBuffer but returns the staging memory for the caller to write the data into, saving the intermediate CPU copy.
+		// The memory must be filled before the next call into the batch (which may submit).
+		// The range can't be split, sizes beyond the ring get a staging buffer of their own.
+		void* mapBufferCopy(vk::DeviceSize size, vk::Buffer dst, vk::BufferUsageFlags dstUsage, vk::DeviceSize dstOffset = 0);
+
+		// Region buffer offsets are relative to the start of 'data'. Image must be in TransferDstOptimal.
+		void copyToImage(const void* data, vk::DeviceSize size, vk::Image dst, const std::vector<vk::BufferImageCopy>& regions);
+
+		// Recorded on the transfer side, so only transfer stages/accesses are valid (e.g Undefined -> TransferDstOptimal)
+		void transitionImage(vk::Image image, const vk::ImageSubresourceRange& range,
+			vk::ImageLayout oldLayout, vk::ImageLayout newLayout,
+			vk::PipelineStageFlags srcStage, vk::PipelineStageFlags dstStage,
+			vk::AccessFlags srcAccess, vk::AccessFlags dstAccess);
+
+		// Hands a fully copied image (TransferDstOptimal) over to the graphics queue in ShaderReadOnlyOptimal
+		void finalizeImage(vk::Image image, const vk::ImageSubresourceRange& range);
+
+		// Expects every level to be in TransferDstOptimal with level 0 filled. Blits run on the graphics queue.
+		// All levels end up in ShaderReadOnlyOptimal.
+		void generateMips(vk::Image image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t layerCount = 1);
+
+		// Submit everything recorded so far, returns the upload timeline value to wait on (0 if there was nothing to submit)
+		uint64_t submit();
+		void submitAndWait();
+
+		// Free dedicated staging buffers (uploads that did not fit the ring) that are no longer used by the GPU
+		void trim();
+
+		bool isEmpty() const;
+		uint64_t getLastSubmittedValue() const;
+		VulkanContext& getContext() const;
+
+	private:
+		struct StagingAllocation
+		{
+			vk::Buffer buffer;
+			vk::DeviceSize offset;
+			uint8_t* mapped;
+		};
+
+		struct DedicatedStaging
+		{
+			std::unique_ptr<Buffer> buffer;
+			uint64_t lastUseValue;		// Timeline value after which the GPU is done reading from the buffer (0 until submitted)
+		};
+
+		// Ownership transfers (or plain barriers if transfer and graphics share the family) done on submit
+		struct BufferHandoff
+		{
+			vk::Buffer buffer;
+			vk::DeviceSize offset;
+			vk::DeviceSize size;
+			vk::PipelineStageFlags dstStage;
+			vk::AccessFlags dstAccess;
+		};
+
+		struct ImageHandoff
+		{
+			vk::Image image;
+			vk::ImageSubresourceRange range;
+			vk::ImageLayout newLayout;
+			vk::PipelineStageFlags dstStage;
+			vk::AccessFlags dstAccess;
+		};
+
+		StagingAllocation stage(vk::DeviceSize size, vk::DeviceSize alignment);
+		// Region offsets relative to 'data', everything they read has to be within [data, data + size)
+		void recordImageCopy(const uint8_t* data, vk::DeviceSize size, vk::Image dst, std::vector<vk::BufferImageCopy> regions);
+
+	private:
+		VulkanContext& m_context;
+		vk::DeviceSize m_stagingBudget;
+
+		std::vector<std::function<void(const vk::CommandBuffer&)>> m_transferCommands;
+		std::vector<std::function<void(const vk::CommandBuffer&)>> m_graphicsCommands;
+		std::vector<BufferHandoff> m_bufferHandoffs;
+		std::vector<ImageHandoff> m_imageHandoffs;
+
+		std::vector<DedicatedStaging> m_dedicatedStaging;
+		vk::DeviceSize m_stagedThisBatch = 0;
+		uint64_t m_lastSubmittedValue = 0;
+	};
+}
@@ -1,14 +1,50 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <filesystem>
 
 namespace Nagi
 {
 
-std::vector<uint8_t> readFile(const std::string& filePath);
+uint32_t getAlignedSize(uint32_t size, uint32_t toAlignWith);
 
+// Peak resident memory of the process in bytes (0 if unavailable)
+size_t getPeakMemoryUsage();
 
-uint32_t getAlignedSize(uint32_t size, uint32_t toAlignWith);
+// Fast non-cryptographic 64-bit hash (XXH64), used to key caches by content
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+
+// Read-only memory mapped file (unmapped on dtor), the asset I/O path for everything we load from disk
+// The OS pages the file in on demand, so decoders and uploads read straight from the mapping without an intermediate read buffer
+class MappedFile
+{
+public:
+	MappedFile() = delete;
+	MappedFile(const std::filesystem::path& filePath);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&&) = delete;
+	MappedFile& operator=(MappedFile&&) = delete;
+
+	const uint8_t* getData() const;
+	size_t getSize() const;
+
+	// Asks the OS to start reading the range in the background (madvise WILLNEED), call well ahead of touching large ranges
+	// The range is clamped to the file, this is only a hint and never fails
+	void prefetch(size_t offset = 0, size_t size = SIZE_MAX) const;
+
+private:
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+
+	// Native handles
+	void* m_fileHandle = nullptr;
+	void* m_mappingHandle = nullptr;
+	int m_fd = -1;
+};
 
 
 }
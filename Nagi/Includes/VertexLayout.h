@@ -0,0 +1,53 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+
+namespace Nagi
+{
+	// Describes how vertices are laid out in a vertex buffer (binding stride and per location format/offset)
+	// Pipelines get their vertex input state from this through ShaderGroup, which matches it against the reflected shader inputs
+	class VertexLayout
+	{
+	public:
+		struct Attribute
+		{
+			uint32_t location;
+			vk::Format format;
+			uint32_t offset;
+		};
+
+	public:
+		VertexLayout() = default;
+		VertexLayout(uint32_t stride, std::vector<Attribute> attributes, uint32_t binding = 0);
+		~VertexLayout() = default;
+
+		uint32_t getStride() const;
+		uint32_t getBinding() const;
+		const std::vector<Attribute>& getAttributes() const;
+
+		// nullptr if the layout does not provide the location
+		const Attribute* findAttribute(uint32_t location) const;
+
+		vk::VertexInputBindingDescription getBindingDescription() const;
+
+	private:
+		uint32_t m_stride = 0;
+		uint32_t m_binding = 0;
+		std::vector<Attribute> m_attributes;
+	};
+
+	// Positions stored as snorm16 are decoded in the vertex shader with: position * scale + offset
+	// vec4s so that it can go straight into push constants
+	struct PositionQuantization
+	{
+		glm::vec4 scale{ 1.f };
+		glm::vec4 offset{ 0.f };
+
+		static PositionQuantization fromBounds(const glm::vec3& min, const glm::vec3& max);
+
+		// Maps a position within the bounds to [-1, 1]
+		glm::vec3 quantize(const glm::vec3& position) const;
+	};
+
+	// Octahedral mapping of a unit vector onto [-1, 1]^2 (see octDecode in shader_sponza.vert)
+	glm::vec2 octEncode(const glm::vec3& n);
+}
@@ -8,11 +8,13 @@ namespace Nagi
 
 class Window;
 class UploadContext;
+class StagingRing;
 
 struct QueueFamilies
 {
 	std::optional<uint32_t> gphIdx;
 	std::optional<uint32_t> presentIdx;
+	std::optional<uint32_t> transferIdx;		// Dedicated transfer family if the device has one, otherwise same as graphics
 
 	bool isComplete()
 	{
@@ -51,6 +53,7 @@ public:
 	FrameResource beginFrame();
 	void endFrame();								// Last external subpass must transition the swapchain image to proper presentation layout! 
 	void submitQueue(const vk::SubmitInfo& info); 	// One queue submit per frame is assumed right now until further exploration
+	void waitForFramesInFlight();					// Blocks until every submitted frame has finished, only valid outside beginFrame/endFrame
 
 
 
@@ -61,6 +64,10 @@ public:
 	UploadContext& getUploadContext() const;
 	const vk::PhysicalDeviceProperties& getPhysicalDeviceProperties() const;
 
+	// Optional indirect draw features, enabled when the device has them
+	bool hasDrawIndirectCount() const;			// vkCmdDrawIndexedIndirectCount (Vulkan 1.2 feature)
+	bool hasMultiDrawIndirect() const;			// drawCount > 1 in vkCmdDrawIndexedIndirect
+
 	// Maybe we can refactor to SwapchainInfo and DepthInfo
 	uint32_t getSwapchainImageCount() const;
 	const std::vector<vk::ImageView>& getSwapchainViews() const;
@@ -114,9 +121,12 @@ private:
 	vk::PhysicalDevice m_physicalDevice;
 	QueueFamilies m_queueFamilies;
 	vk::PhysicalDeviceProperties m_physicalDeviceProperties;
+	bool m_drawIndirectCount = false;
+	bool m_multiDrawIndirect = false;
 	vk::Device m_device;
 	vk::Queue m_gfxQueue;
 	vk::Queue m_presentQueue;
+	vk::Queue m_transferQueue;
 
 	vk::DispatchLoaderDynamic m_dld;
 	vk::DebugUtilsMessengerEXT m_debugMessenger;
@@ -151,27 +161,72 @@ private:
 
 };
 
+// Uploads go through the dedicated transfer queue when there is one, the graphics queue otherwise (e.g lavapipe, single family devices).
+// Async submissions signal a timeline semaphore which graphics submits can wait on instead of stalling the CPU.
+// All upload staging memory comes from the one staging ring owned here.
 class UploadContext
 {
 public:
 	UploadContext() = delete;
-	UploadContext(vk::Device& dev, vk::Queue& queue, uint32_t queueFamily);
-	~UploadContext() = default;
+	UploadContext(vk::Device& dev, VmaAllocator allocator, vk::Queue& gfxQueue, uint32_t gfxFamily, vk::Queue& transferQueue, uint32_t transferFamily);
+	~UploadContext();
 
 	UploadContext(const UploadContext&) = delete;
 	UploadContext& operator=(const UploadContext&) = delete;
 	UploadContext(UploadContext&&) = delete;
 	UploadContext operator=(UploadContext&&) = delete;
 
+	// One-off work on the graphics queue, blocks until it is done
 	void submitWork(const std::function<void(const vk::CommandBuffer& cmd)>& work);
 
+	// 'transferWork' runs on the transfer queue and 'graphicsWork' on the graphics queue after it (ownership acquires, blits..)
+	// With a single queue family both are recorded into one command buffer on the graphics queue.
+	// Returns the timeline value that is signaled once all of it has completed.
+	uint64_t submitAsync(const std::function<void(const vk::CommandBuffer& cmd)>& transferWork, const std::function<void(const vk::CommandBuffer& cmd)>& graphicsWork);
+
+	bool isComplete(uint64_t timelineValue) const;
+	void wait(uint64_t timelineValue) const;
+
+	const vk::Semaphore& getTimelineSemaphore() const;
+	uint64_t getLastSubmittedValue() const;
+
+	bool hasDedicatedTransferQueue() const;
+	uint32_t getGraphicsQueueFamily() const;
+	uint32_t getTransferQueueFamily() const;
+
+	StagingRing& getStagingRing() const;
+
 private:
+	void reclaimCompleted();
+
+private:
+	struct InFlightUpload
+	{
+		uint64_t timelineValue;
+		vk::CommandBuffer transferCmd;
+		vk::CommandBuffer gfxCmd;
+	};
+
 	vk::Device& m_dev;
-	vk::Queue& m_queue;
-	uint32_t m_queueFamily;
+	vk::Queue& m_gfxQueue;
+	vk::Queue& m_transferQueue;
+	uint32_t m_gfxFamily;
+	uint32_t m_transferFamily;
+
+	// Blocking path
 	vk::UniqueFence m_fence;
 	vk::UniqueCommandPool m_pool;
 
+	// Async path
+	vk::UniqueCommandPool m_asyncTransferPool;
+	vk::UniqueCommandPool m_asyncGfxPool;
+	vk::UniqueSemaphore m_timeline;
+	uint64_t m_lastSubmittedValue = 0;
+	std::deque<InFlightUpload> m_inFlight;
+
+	// Destroyed first, it waits on the timeline
+	std::unique_ptr<StagingRing> m_stagingRing;
+
 };
 
 
@@ -13,6 +13,7 @@
 #include <fstream>
 #include <vector>
 #include <array>
+#include <span>
 #include <functional>
 #include <exception>
 #include <optional>
@@ -1,8 +1,14 @@
 glslc.exe shader_sponza.vert -o ..\..\bin\compiled_shaders\vertSponza.spv
+glslc.exe shader_sponza.vert -DPACKED_VERTEX -o ..\..\bin\compiled_shaders\vertSponzaPacked.spv
 glslc.exe shader_sponza.frag -o ..\..\bin\compiled_shaders\fragSponza.spv
 
 glslc.exe shader_skybox.vert -o ..\..\bin\compiled_shaders\vertSkybox.spv
 glslc.exe shader_skybox.frag -o ..\..\bin\compiled_shaders\fragSkybox.spv
 
+glslc.exe shader_cull.comp -o ..\..\bin\compiled_shaders\compCull.spv
+
+rem Validate every module against the Vulkan 1.2 rules the renderer targets (both vertex variants included)
+for %%f in (vertSponza vertSponzaPacked fragSponza vertSkybox fragSkybox compCull) do spirv-val.exe --target-env vulkan1.2 ..\..\bin\compiled_shaders\%%f.spv
+
 
 pause
\ No newline at end of file
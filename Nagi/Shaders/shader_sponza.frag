@@ -1,5 +1,6 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
 
 #include "per_frame_res"
         
@@ -9,6 +10,7 @@ layout(location = 1) in vec2 fragUV;
 layout(location = 2) in vec3 fragPos;
 layout(location = 3) in vec3 fragTangent;
 layout(location = 4) in vec3 fragBitangent;
+layout(location = 5) flat in uint fragMaterialIndex;
 
 
 //const uint POINT_LIGHT_COUNT = 2;
@@ -37,10 +39,31 @@ layout(location = 4) in vec3 fragBitangent;
 //} sceneData;
 //layout(set = 0, binding = 2) uniform samplerCube skyboxTexture;
 
-layout(set = 2, binding = 0) uniform sampler2D diffuseTexture;
-layout(set = 2, binding = 1) uniform sampler2D opacityTexture;
-layout(set = 2, binding = 2) uniform sampler2D specularTexture;
-layout(set = 2, binding = 3) uniform sampler2D normalTexture;
+// Bindless: every texture is in one array, materials hold the indices of theirs (MaterialData on the CPU side)
+layout(set = 2, binding = 0) uniform sampler2D textures[];
+
+struct MaterialData
+{
+    uint diffuseTexture;
+    uint opacityTexture;
+    uint specularTexture;
+    uint normalTexture;
+};
+
+layout(std430, set = 2, binding = 1) readonly buffer MaterialBuffer
+{
+    MaterialData materials[];
+} materialBuffer;
+
+// Texture index of a material without that texture (MaterialData::s_noTexture), only used for normal maps
+const uint NO_TEXTURE = 0xFFFFFFFFu;
+
+// Same for the whole draw (one draw record per indirect draw), so the indices are dynamically uniform
+MaterialData material;
+
+// Fetched once per fragment in main
+vec3 diffuseColor;
+float specularMask;
 
 
 layout(location = 0) out vec4 outColor; 
@@ -52,7 +75,7 @@ vec3 calculateSpecularColor(vec3 normal, vec3 lightDirection, vec3 lightColor)
     vec3 fragToLightDir = normalize(-lightDirection);
     vec3 halfwayDir = normalize(fragToCamDir + fragToLightDir);
 
-    vec3 specular = pow(max(dot(normal, halfwayDir), 0.f), 64) * texture(specularTexture, fragUV).xyz * lightColor;
+    vec3 specular = pow(max(dot(normal, halfwayDir), 0.f), 64) * specularMask * lightColor;
 
     return specular;
 }
@@ -60,8 +83,8 @@ vec3 calculateSpecularColor(vec3 normal, vec3 lightDirection, vec3 lightColor)
 
 vec3 calculateDirectionalLight(vec3 direction, vec3 lightColor, vec3 normal)
 {
-    //vec3 diffuse = clamp(dot(-direction, normal), 0.f, 1.f) * lightColor * texture(diffuseTexture, fragUV).xyz;
-    vec3 diffuse = max(dot(-direction, normal), 0.f) * lightColor * texture(diffuseTexture, fragUV).xyz;
+    //vec3 diffuse = clamp(dot(-direction, normal), 0.f, 1.f) * lightColor * diffuseColor;
+    vec3 diffuse = max(dot(-direction, normal), 0.f) * lightColor * diffuseColor;
     vec3 specular = calculateSpecularColor(normal, direction, lightColor);
 
     return diffuse + specular;
@@ -86,7 +109,7 @@ vec3 calculatePointLight(vec3 normal, vec3 attenuation, vec3 color, vec3 positio
     //float cullDot = ceil(dot(dirToLight, normal)); // if above 0, always ceil to 1, if below 0 --> 0
     //float cullDot = max(dot(dirToLight, normal), 0.f);
 
-    vec3 diffuse = pointLightContrib * color * texture(diffuseTexture, fragUV).xyz;
+    vec3 diffuse = pointLightContrib * color * diffuseColor;
 
     // Specular
     vec3 specular = pointLightContrib * calculateSpecularColor(normal, -dirToLight, color);
@@ -111,7 +134,7 @@ vec3 calculateSpotlight()
     float edgeIntensity = clamp( (sceneData.spotlightDirectionAndCutoff.w - factorFromView) / (outerCutoff - sceneData.spotlightDirectionAndCutoff.w) , 0.f, 1.f);
 
     if (factorFromView > sceneData.spotlightDirectionAndCutoff.w)
-        return vec3(spotlightStrength) * texture(diffuseTexture, fragUV).xyz * distanceFallOffFactor * edgeIntensity;
+        return vec3(spotlightStrength) * diffuseColor * distanceFallOffFactor * edgeIntensity;
 
     return vec3(0.f);
 }
@@ -119,13 +142,14 @@ vec3 calculateSpotlight()
 // Get normal from normal map if it exists
 vec3 getFinalNormal(vec3 inputNormal)
 {
-    vec3 mapNorTangent = texture(normalTexture, fragUV).xyz;
-    if (!(mapNorTangent == vec3(0.f)))  // If valid normal exists
+    if (material.normalTexture != NO_TEXTURE)  // If valid normal exists (uniform for the draw, so the sample keeps its derivatives)
     {
         mat3 tbn = mat3(fragTangent, fragBitangent, inputNormal);
 
         // Normal map is in [0, 1] space so we need to transform it to [-1, 1] space
-        vec3 mapNorTangent = mapNorTangent * 2.f - 1.f;
+        // Only XY are stored (BC5), Z is reconstructed from the unit length
+        vec2 mapNorXY = texture(textures[material.normalTexture], fragUV).xy * 2.f - 1.f;
+        vec3 mapNorTangent = vec3(mapNorXY, sqrt(max(1.f - dot(mapNorXY, mapNorXY), 0.f)));
 
         // Orient the tangent space correctly in world space
         // Transform the tanget space TO world space.
@@ -139,8 +163,16 @@ vec3 getFinalNormal(vec3 inputNormal)
 
 void main() 
 {
+    material = materialBuffer.materials[fragMaterialIndex];
+    diffuseColor = texture(textures[material.diffuseTexture], fragUV).xyz;
+
+    // Opacity is in R and specular in G, either one packed texture (BC5) or two single channel ones (BC4, swizzled to RRR1)
+    vec2 masks = texture(textures[material.opacityTexture], fragUV).rg;
+    if (material.specularTexture != material.opacityTexture)
+        masks.g = texture(textures[material.specularTexture], fragUV).g;
+    specularMask = masks.g;
+
     vec3 normal = normalize(fragNormal);
-    vec3 diffuseColor = texture(diffuseTexture, fragUV).xyz;
     
     normal = getFinalNormal(normal);
 
@@ -167,5 +199,5 @@ void main()
     //finalColor = finalColor / (finalColor + vec3(1.f));
     //finalColor = vec3(1.0) - exp(-finalColor * 5.f);
 
-    outColor = vec4(finalColor, texture(opacityTexture, fragUV).r);
+    outColor = vec4(finalColor, masks.r);
 }
\ No newline at end of file
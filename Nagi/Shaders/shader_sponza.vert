@@ -2,50 +2,81 @@
 #extension GL_ARB_separate_shader_objects : enable
 
 #include "per_frame_res"
+#include "draw_record"
 
 // Location can be seen as the identifier used for in/out from this stage to other stages
+#ifdef PACKED_VERTEX
+// PackedVertex (20 bytes), formats come from the vertex layout on the CPU side
+layout(location = 0) in vec4 inPos;			// snorm16 xyz quantized to model bounds, w = tangent handedness
+layout(location = 1) in vec2 inUV;			// half
+layout(location = 2) in vec2 inNormal;		// octahedral snorm16
+layout(location = 3) in vec2 inTangent;		// octahedral snorm16
+#else
 layout(location = 0) in vec3 inPos;
 layout(location = 1) in vec2 inUV;
 layout(location = 2) in vec3 inNormal;
 layout(location = 3) in vec3 inTangent;
 layout(location = 4) in vec3 inBitangent;
+#endif
 
 layout(location = 0) out vec3 fragNormal;
 layout(location = 1) out vec2 fragUV;
 layout(location = 2) out vec3 fragPos;
 layout(location = 3) out vec3 fragTangent;
 layout(location = 4) out vec3 fragBitangent;
+layout(location = 5) flat out uint fragMaterialIndex;
 
-//layout(push_constant) uniform Constants
-//{
-//	mat4 modelMat;
-//} pushConstants;
-//
-//layout(set = 0, binding = 0) uniform EngineUBO
-//{
-//	mat4 viewMat;
-//	mat4 projMat;
-//	mat4 viewProjMat;
-//} engineUBO;
-//
-//
-//layout(set = 3, binding = 0) uniform ObjectUBO
-//{
-//	mat4 modelMat;
-//} objectUBO;
+// Model matrices of every drawn entity this frame, and the draw records pointing into it
+// Every indirect draw is one record, its firstInstance is the record index
+layout(std430, set = 3, binding = 0) readonly buffer ObjectBuffer
+{
+	ObjectData objects[];
+} objectBuffer;
+
+layout(std430, set = 3, binding = 1) readonly buffer DrawRecordBuffer
+{
+	DrawRecord records[];
+} drawRecordBuffer;
+
+#ifdef PACKED_VERTEX
+// Inverse of octEncode in VertexLayout.cpp
+vec3 octDecode(vec2 e)
+{
+	vec3 v = vec3(e, 1.f - abs(e.x) - abs(e.y));
+	float t = max(-v.z, 0.f);
+	v.x += v.x >= 0.f ? -t : t;
+	v.y += v.y >= 0.f ? -t : t;
+	return normalize(v);
+}
+#endif
 
 void main() 
 {
-	vec4 worldPos = pushConstants.modelMat * vec4(inPos, 1.f);
+	DrawRecord record = drawRecordBuffer.records[gl_InstanceIndex];
+
+#ifdef PACKED_VERTEX
+	vec3 position = inPos.xyz * record.positionScale.xyz + record.positionOffset.xyz;
+	vec3 normal = octDecode(inNormal);
+	vec3 tangent = octDecode(inTangent);
+	vec3 bitangent = cross(normal, tangent) * (inPos.w < 0.f ? -1.f : 1.f);
+#else
+	vec3 position = inPos;
+	vec3 normal = inNormal;
+	vec3 tangent = normalize(inTangent);
+	vec3 bitangent = normalize(inBitangent);
+#endif
+
+	mat4 modelMat = objectBuffer.objects[record.objectIndex].modelMat;
+	fragMaterialIndex = record.materialIndex;
+
+	vec4 worldPos = modelMat * vec4(position, 1.f);
 	gl_Position = engineUBO.viewProjMat * worldPos;
 	fragPos = worldPos.xyz;
 	fragUV = inUV;
-	fragNormal = normalize((pushConstants.modelMat * vec4(inNormal, 0.f)).xyz);
+	fragNormal = normalize((modelMat * vec4(normal, 0.f)).xyz);
 
-	//vec3 tangent = normalize((pushConstants.modelMat * vec4(inTangent, 0.f)).xyz);
-	fragTangent = normalize((pushConstants.modelMat * vec4(normalize(inTangent), 0.f)).xyz);
-	//vec3 bitangent = normalize((pushConstants.modelMat * vec4(inBitangent, 0.f)).xyz);
-	fragBitangent = normalize((pushConstants.modelMat * vec4(normalize(inBitangent), 0.f)).xyz);
+	fragTangent = normalize((modelMat * vec4(tangent, 0.f)).xyz);
+	fragBitangent = normalize((modelMat * vec4(bitangent, 0.f)).xyz);
 
 	//fragTBN = mat3(tangent, bitangent, fragNormal);
 
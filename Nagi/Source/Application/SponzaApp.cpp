@@ -2,6 +2,11 @@
 #include "Application/SponzaApp.h"
 
 #include "AssimpLoader.h"
+#include "CookedMesh.h"
+#include "CookedTexture.h"
+#include "MeshOptimizer.h"
+#include "UploadBatch.h"
+#include "StagingRing.h"
 #include "Camera.h"
 #include "VulkanImGuiContext.h"
 #include "Timer.h"
@@ -10,9 +15,123 @@
 
 #include "ShaderGroup.h"
 
+#include <glm/packing.hpp>
+
 namespace Nagi
 {
 
+PackedVertex PackedVertex::pack(const Vertex& vertex, const PositionQuantization& quantization)
+{
+	// Handedness of the tangent frame, lets the shader rebuild the bitangent as cross(normal, tangent) * sign
+	float handedness = glm::dot(glm::cross(vertex.normal, vertex.tangent), vertex.bitangent) < 0.f ? -1.f : 1.f;
+	glm::vec3 pos = quantization.quantize(vertex.pos);
+
+	PackedVertex packed{};
+	packed.posXY = glm::packSnorm2x16(glm::vec2(pos.x, pos.y));
+	packed.posZW = glm::packSnorm2x16(glm::vec2(pos.z, handedness));
+	packed.uv = glm::packHalf2x16(vertex.uv);
+	packed.normal = glm::packSnorm2x16(octEncode(vertex.normal));
+	packed.tangent = glm::packSnorm2x16(octEncode(vertex.tangent));
+	return packed;
+}
+
+VertexLayout SponzaApp::getVertexLayout()
+{
+	return s_usePackedVertices ? PackedVertex::getLayout() : Vertex::getLayout();
+}
+
+static Vertex toVertex(const Vertex& vertex)
+{
+	return vertex;
+}
+
+static Vertex toVertex(const AssimpVertex& vert)
+{
+	Vertex vertex;
+	vertex.pos = glm::vec3(vert.position.x, vert.position.y, vert.position.z);
+	vertex.uv = glm::vec2(vert.uv.x, vert.uv.y);
+	vertex.normal = glm::vec3(vert.normal.x, vert.normal.y, vert.normal.z);
+	vertex.tangent = glm::vec3(vert.tangent.x, vert.tangent.y, vert.tangent.z);
+	vertex.bitangent = glm::vec3(vert.bitangent.x, vert.bitangent.y, vert.bitangent.z);
+	return vertex;
+}
+
+// Converts to the vertex format used by the main pipeline one vertex at a time (no intermediate std::vector<Vertex>), returns the raw vertex buffer bytes
+template <typename T>
+static std::vector<uint8_t> buildVertexData(const std::vector<T>& vertices, bool packed, PositionQuantization& quantization)
+{
+	std::vector<uint8_t> data;
+	if (!packed)
+	{
+		quantization = PositionQuantization();
+		data.resize(vertices.size() * sizeof(Vertex));
+		auto dst = reinterpret_cast<Vertex*>(data.data());
+		for (size_t i = 0; i < vertices.size(); ++i)
+			dst[i] = toVertex(vertices[i]);
+		return data;
+	}
+
+	// Quantize positions relative to the bounds of the whole model
+	glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+	for (const auto& vert : vertices)
+	{
+		boundsMin = glm::min(boundsMin, toVertex(vert).pos);
+		boundsMax = glm::max(boundsMax, toVertex(vert).pos);
+	}
+	quantization = vertices.empty() ? PositionQuantization() : PositionQuantization::fromBounds(boundsMin, boundsMax);
+
+	data.resize(vertices.size() * sizeof(PackedVertex));
+	auto packedVerts = reinterpret_cast<PackedVertex*>(data.data());
+	for (size_t i = 0; i < vertices.size(); ++i)
+		packedVerts[i] = PackedVertex::pack(toVertex(vertices[i]), quantization);
+	return data;
+}
+
+// Copies the VB bytes of one vertex range and the IB bytes of one subset at a time from the mapped cooked file straight into the staging ring, without an intermediate CPU copy.
+// Large ranges go in ring sized pieces, so staging stays at the ring size however large the model is. Returns the bytes streamed.
+static size_t streamCookedGeometry(UploadBatch& batch, const CookedMesh& cooked, const GeometryPool& pool, const GeometryRange& geometry)
+{
+	const auto* vertexBytes = static_cast<const uint8_t*>(cooked.getVertexData());
+	const auto* indexBytes = static_cast<const uint8_t*>(cooked.getIndexData());
+	const auto& subsets = cooked.getSubsets();
+	size_t streamed = 0;
+
+	auto stream = [&](vk::Buffer dst, vk::BufferUsageFlags dstUsage, vk::DeviceSize dstBase, const uint8_t* src, size_t offset, size_t size)
+	{
+		if (size == 0)
+			return;
+		batch.copyToBuffer(src + offset, size, dst, dstUsage, dstBase + offset);
+		streamed += size;
+	};
+
+	// Vertex ranges are contiguous, a range runs up to the next one. Subsets can share a range (e.g empty ones), so each is streamed once
+	std::vector<uint32_t> rangeStarts;
+	rangeStarts.reserve(subsets.size());
+	for (const auto& subset : subsets)
+		rangeStarts.push_back(subset.vertexStart);
+	std::sort(rangeStarts.begin(), rangeStarts.end());
+	rangeStarts.erase(std::unique(rangeStarts.begin(), rangeStarts.end()), rangeStarts.end());
+
+	for (size_t i = 0; i < rangeStarts.size(); ++i)
+	{
+		uint32_t vertexEnd = i + 1 < rangeStarts.size() ? rangeStarts[i + 1] : cooked.getVertexCount();
+		stream(pool.getVertexBuffer(), vk::BufferUsageFlagBits::eVertexBuffer, geometry.vertexOffset, vertexBytes, static_cast<size_t>(rangeStarts[i]) * cooked.getVertexStride(), static_cast<size_t>(vertexEnd - rangeStarts[i]) * cooked.getVertexStride());
+	}
+
+	for (const auto& subset : subsets)
+	{
+		// LODs are packed right behind their subset
+		size_t indexSize = subset.use16BitIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+		size_t indexEnd = subset.indexStart + subset.indexCount;
+		for (const auto& lod : subset.lods)
+			indexEnd = std::max<size_t>(indexEnd, lod.indexStart + lod.indexCount);
+		stream(pool.getIndexBuffer(), vk::BufferUsageFlagBits::eIndexBuffer, geometry.indexOffset, indexBytes, subset.indexStart * indexSize, (indexEnd - subset.indexStart) * indexSize);
+	}
+
+	return streamed;
+}
+
 SponzaApp::SponzaApp(Window& window, VulkanContext& vkCon) :
 	Application(window, vkCon)
 {
@@ -80,6 +199,10 @@ SponzaApp::SponzaApp(Window& window, VulkanContext& vkCon) :
 		p2.addComponent<PointLightComponent>(glm::vec4(1.f, 0.f, 0.f, 0.f), glm::vec4(1.f, 0.09f, 0.016f, 0.f));
 
 		d1.addComponent<DirectionalLightComponent>(glm::vec4(1.f), glm::vec4(-0.35f, -1.f, -1.f, 0.f));
+
+		// Draw records of every entity with a model, patched transforms are picked up every frame
+		m_gpuCuller->build(*m_uploadBatch, s1, fpsCam.getPosition());
+		m_uploadBatch->submit();
 	
 		float dt = 0.f;
 		float timeElapsed = 0.f;
@@ -98,6 +221,31 @@ SponzaApp::SponzaApp(Window& window, VulkanContext& vkCon) :
 			// ============================================= IMGUI WINDOWS
 			ImGui::ShowDemoWindow(&showImGuiDemo);
 
+			ImGui::Begin("Texture streaming");
+			{
+				int budgetMB = static_cast<int>(m_textureStreamer->getBudget() / (1024 * 1024));
+				ImGui::Text("Resident: %.1f MB (%u textures, %u streaming)", m_textureStreamer->getResidentSize() / (1024.f * 1024.f),
+					m_textureStreamer->getTextureCount(), m_textureStreamer->getStreamingCount());
+				if (ImGui::SliderInt("Budget (MB)", &budgetMB, 16, 2048))
+					m_textureStreamer->setBudget(static_cast<vk::DeviceSize>(budgetMB) * 1024 * 1024);
+
+				const auto& dedup = m_textureStreamer->getDedupStats();
+				ImGui::Text("Deduplicated: %u hits, %u misses, %.1f MB saved", dedup.hits, dedup.misses, dedup.bytesSaved / (1024.f * 1024.f));
+			}
+			ImGui::End();
+
+			ImGui::Begin("Draws");
+			{
+				ImGui::Text("%u draw records in %u batches", m_gpuCuller->getRecordCount(), m_gpuCuller->getBatchCount());
+				ImGui::Text("Indirect draws: %u", m_drawStats.indirectDraws);
+				ImGui::Text("Pipeline binds: %u", m_drawStats.pipelineBinds);
+				ImGui::Text("Descriptor set binds: %u", m_drawStats.descriptorBinds);
+				ImGui::Text("Buffer binds: %u", m_drawStats.bufferBinds);
+				ImGui::Text("Material changes (all records, at build): %u", m_drawStats.materialChanges);
+				ImGui::Text("Visible draws (read back %u frames late): %u", VulkanContext::getMaxFramesInFlight(), m_drawStats.visibleDraws);
+			}
+			ImGui::End();
+
 			// ============================================= HANDLE INPUT RESPONSE
 			if (keyboard->isKeyDown(KeyName::A))		fpsCam.move(MoveDirection::Left);
 			if (keyboard->isKeyDown(KeyName::D))		fpsCam.move(MoveDirection::Right);
@@ -114,15 +262,22 @@ SponzaApp::SponzaApp(Window& window, VulkanContext& vkCon) :
 				spotlightStrength = 0.2f;
 
 			// =============================================== UPDATE OBJECTS
-			e4.getComponent<TransformComponent>().mat =
-				glm::translate(glm::mat4(1.f), glm::vec3(0.f, 10.f + 2.f * cosf(timeElapsed), 0.f)) *
-				glm::rotate(glm::mat4(1.f), glm::radians(timeElapsed * 21.f), glm::vec3(0.f, 1.f, 0.f)) *
-				glm::scale(glm::mat4(1.f), glm::vec3(1.f));
+			// Patched so that the GPU culler uploads the new transforms (and only those)
+			e4.patchComponent<TransformComponent>([timeElapsed](TransformComponent& transform)
+				{
+					transform.mat =
+						glm::translate(glm::mat4(1.f), glm::vec3(0.f, 10.f + 2.f * cosf(timeElapsed), 0.f)) *
+						glm::rotate(glm::mat4(1.f), glm::radians(timeElapsed * 21.f), glm::vec3(0.f, 1.f, 0.f)) *
+						glm::scale(glm::mat4(1.f), glm::vec3(1.f));
+				});
 
-			e2.getComponent<TransformComponent>().mat =
-				glm::translate(glm::mat4(1.f), glm::vec3(9.f, 0.f, -9.f)) *
-				glm::rotate(glm::mat4(1.f), glm::radians(timeElapsed * 45.f), glm::vec3(0.f, 1.f, 0.f)) *
-				glm::scale(glm::mat4(1.f), glm::vec3(1.f));
+			e2.patchComponent<TransformComponent>([timeElapsed](TransformComponent& transform)
+				{
+					transform.mat =
+						glm::translate(glm::mat4(1.f), glm::vec3(9.f, 0.f, -9.f)) *
+						glm::rotate(glm::mat4(1.f), glm::radians(timeElapsed * 45.f), glm::vec3(0.f, 1.f, 0.f)) *
+						glm::scale(glm::mat4(1.f), glm::vec3(1.f));
+				});
 
 			// =============================================== UPDATE ENGINE WIDE DATA
 			GPUCameraData cameraData{};
@@ -151,6 +306,10 @@ SponzaApp::SponzaApp(Window& window, VulkanContext& vkCon) :
 			auto frameRes = vkCon.beginFrame();
 			auto& cmd = frameRes.gfxCmdBuffer;
 
+			// ================================================ STREAM TEXTURES
+			// Swaps finished mip uploads into this frame's set (the old images are freed once no frame reads them) and starts new ones from last frame's requests
+			m_textureStreamer->update(frameRes.frameIdx);
+
 
 			// ================================================ UPDATE FRAME UBOS
 
@@ -176,6 +335,9 @@ SponzaApp::SponzaApp(Window& window, VulkanContext& vkCon) :
 			// ================================================ RECORD COMMANDS
 			cmd.begin(vk::CommandBufferBeginInfo());
 
+			// ================================================ CULL OBJECTS (compute, outside of the render pass)
+			cullObjects(cmd, frameRes.frameIdx, fpsCam.getViewProjectionMatrix(), static_cast<float>(scExtent.height));
+
 			// Bind engine wide resources with offsets into Dynamic UB (per frame resources) (Camera, Scene, Set 0)
 			//cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_mainGfxPipelineLayout.get(), 0, m_engineDescriptorSet, engineBufferOffsets);
 			cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_mainGfxPipelineLayout.get(), 0, m_engineDescriptorSet, engineBufferOffsets);
@@ -196,7 +358,7 @@ SponzaApp::SponzaApp(Window& window, VulkanContext& vkCon) :
 				cmd.draw(36, 1, 0, 0);
 
 				// ================================================ RECORD OBJECTS DRAW CMDS
-				drawObjects(&s1, cmd);		// Submitting entities from scene which have render model refs, no instancing.
+				drawObjects(cmd, frameRes.frameIdx);		// Indirect draws of the entities from scene which have render model refs
 				// ================================================ RECORD IMGUI DRAW CMDS
 				imGuiContext->render(cmd);
 
@@ -207,17 +369,27 @@ SponzaApp::SponzaApp(Window& window, VulkanContext& vkCon) :
 
 			// ================================================ END GPU FRAME
 			// Setup submit info
-			std::array<vk::PipelineStageFlags, 1> waitStages{ vk::PipelineStageFlagBits::eColorAttachmentOutput };
+			// Uploads may still be in flight on the transfer queue, so vertex fetch and shader reads also wait on the upload timeline
+			// Only the scene load is waited on, streamed textures are not used before their upload has completed
+			auto& uploadContext = vkCon.getUploadContext();
+			std::array<vk::Semaphore, 2> waitSemaphores{ frameRes.sync.imageAvailableSemaphore, uploadContext.getTimelineSemaphore() };
+			std::array<vk::PipelineStageFlags, 2> waitStages{ vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader };
+			std::array<uint64_t, 2> waitValues{ 0, m_uploadBatch->getLastSubmittedValue() };		// binary semaphore value is ignored
 			// Queue waits at just before this stage executes for the sem signal with a full mem barrier
 
+			vk::TimelineSemaphoreSubmitInfo timelineInfo(waitValues, {});
 			vk::SubmitInfo submitInfo(
-				frameRes.sync.imageAvailableSemaphore,
+				waitSemaphores,
 				waitStages,
 				cmd,
 				frameRes.sync.renderFinishedSemaphore
 			);
+			submitInfo.setPNext(&timelineInfo);
 
 			vkCon.submitQueue(submitInfo);
+
+			// Give back staging memory once the uploads have landed
+			m_uploadBatch->trim();
 			vkCon.endFrame();
 
 			dt = timer.time();
@@ -277,83 +449,104 @@ void SponzaApp::createUBOs()
 
 
 
-	// Create UBO for per object data (e.g SSBO)
-	vk::BufferCreateInfo objectUBOCI({}, sizeof(ObjectData), vk::BufferUsageFlagBits::eStorageBuffer);
-	VmaAllocationCreateInfo objectUBOAllocCI{};
-	objectUBOAllocCI.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+	// Per object data (model matrices and draw records) is owned by the GpuCuller
+}
 
-	for (auto i = 0ul; i < VulkanContext::getMaxFramesInFlight(); ++i)
+void SponzaApp::loadTextures(UploadBatch& batch)
+{
+	// Decode all in parallel, upload in order as they finish
+	// Mip chains are built by the workers as well (or loaded from the mip cache)
+	auto rimuru = m_decodePool.submit([]() { return ImageData::fromFile("Resources/Textures/rimuru.jpg", true); });
+	auto rimuru2 = m_decodePool.submit([]() { return ImageData::fromFile("Resources/Textures/rimuru2.jpg", true); });
+
+	// Skybox faces go to the workers as well, the cooked cube only has to be (re)cooked when the faces changed
+	const std::filesystem::path skyboxDirectory = "Resources/Textures/Skybox/";
+	auto skyboxFaces = Texture::getCubeFacePaths(skyboxDirectory);
+	auto skyboxCookedPath = CookedTexture::getCubeCookedPath(skyboxDirectory);
+	std::vector<std::future<ImageData>> skyboxDecodes;
+	if (!s_compressSkybox)
 	{
-		ObjectFrameData dat{};
-		dat.modelMatBuffer = std::make_unique<Buffer>(m_vkCon.getAllocator(), objectUBOCI, objectUBOAllocCI);
-		
-		m_objectFrameData.push_back(std::move(dat));
+		for (const auto& facePath : skyboxFaces)
+			skyboxDecodes.push_back(m_decodePool.submit([facePath]() { return ImageData::fromFile(facePath.string(), true); }));
+	}
+	else if (!CookedTexture::isCubeUpToDate(skyboxCookedPath, skyboxFaces))
+	{
+		CookedTexture::cookCube(m_decodePool, skyboxFaces, skyboxCookedPath);
 	}
 
-}
+	m_mappedTextures.insert({ "rimuru", Texture::fromImageData(batch, rimuru.get(), true) });
+	m_mappedTextures.insert({ "rimuru2", Texture::fromImageData(batch, rimuru2.get(), true) });
 
-void SponzaApp::loadTextures()
-{
-	m_mappedTextures.insert({ "rimuru", Texture::fromFile(m_vkCon, "Resources/Textures/rimuru.jpg", true) });
-	m_mappedTextures.insert({ "rimuru2", Texture::fromFile(m_vkCon, "Resources/Textures/rimuru2.jpg", true) });
-	m_mappedTextures.insert({ "defaultopacity", Texture::fromFile(m_vkCon, "Resources/Textures/defaultopacity.jpg") });
-	m_mappedTextures.insert({ "defaultspecular", Texture::fromFile(m_vkCon, "Resources/Textures/defaultspecular.jpg") });
-	m_mappedTextures.insert({ "defaultnormal", Texture::fromFile(m_vkCon, "Resources/Textures/defaultnormal.jpg") });
-	m_mappedTextures.insert({ "yokohamaSB", Texture::cubeFromFile(m_vkCon, "Resources/Textures/Skybox/") });
+	if (s_compressSkybox)
+	{
+		CookedTexture cookedSkybox(skyboxCookedPath);
+		m_mappedTextures.insert({ "yokohamaSB", Texture::fromCooked(batch, cookedSkybox) });
+	}
+	else
+	{
+		std::vector<ImageData> faces;
+		faces.reserve(skyboxDecodes.size());
+		for (auto& decode : skyboxDecodes)
+			faces.push_back(decode.get());
+		m_mappedTextures.insert({ "yokohamaSB", Texture::cubeFromImageData(batch, faces) });
+	}
+
+	if (s_benchmarkMipGeneration)
+		benchmarkMipGeneration("Resources/Textures/rimuru.jpg");
 }
 
-void SponzaApp::drawObjects(Scene* scene, vk::CommandBuffer& cmd)
+void SponzaApp::benchmarkMipGeneration(const std::string& filePath)
 {
-	auto view = scene->getRegistry().view<TransformComponent, ModelRefComponent>();
-
-	// We can batch the transforms by ModelRefs, put transforms in SSBO and use draw instanced using InstanceID as lookup for world matrix in SSBO
-
-	int materialChangeThisFrame = 0;
-	Material lastMaterial;
-	for (auto e : view)
+	// Every path includes getting the pixels off disk, the upload and waiting for it to finish
+	constexpr uint32_t iterations = 5;
+	auto measure = [&](const char* name, auto&& load)
 	{
-		auto model = scene->getRegistry().get<ModelRefComponent>(e).model;
-		auto& mat = scene->getRegistry().get<TransformComponent>(e).mat;
-		PushConstantData perObjectData{ mat };
+		float total = 0.f;
+		for (uint32_t i = 0; i < iterations; ++i)
+		{
+			Timer timer;
+			auto texture = load();
+			total += timer.time();
+		}
+		std::cout << "Mips " << name << ": " << total / iterations * 1000.f << " ms\n";
+	};
 
-		const auto& renderUnits = model->getRenderUnits();
-		const auto& vb = model->getVertexBuffer();
-		const auto& ib = model->getIndexBuffer();
+	measure("GPU blit", [&]() { return Texture::fromImageData(m_vkCon, ImageData::fromFile(filePath), true); });
+	measure("CPU fresh", [&]() { return Texture::fromImageData(m_vkCon, ImageData::fromFile(filePath, true, true, false), true); });
 
-		std::array<vk::Buffer, 1> vbs{ vb };
-		std::array<vk::DeviceSize, 1> offsets{ 0 };
-		cmd.bindVertexBuffers(0, vbs, offsets);
-		cmd.bindIndexBuffer(ib, 0, vk::IndexType::eUint32);
+	ImageData::fromFile(filePath, true);		// Make sure the cache entry exists
+	measure("CPU cached", [&]() { return Texture::fromImageData(m_vkCon, ImageData::fromFile(filePath, true), true); });
+}
 
-		for (const auto& renderUnit : renderUnits)
-		{
-			const auto& mesh = renderUnit.getMesh();
-			const auto& mat = renderUnit.getMaterial();
+void SponzaApp::cullObjects(vk::CommandBuffer& cmd, uint32_t frameIdx, const glm::mat4& viewProj, float screenHeight)
+{
+	// Streamed textures get the mips their materials needed on screen when this frame slot was last used
+	// (uv density is assumed to be about one texture per subset)
+	auto coverage = m_gpuCuller->getMaterialCoverage(frameIdx);
+	for (uint32_t materialIndex = 0; materialIndex < coverage.size(); ++materialIndex)
+	{
+		if (coverage[materialIndex] <= 0.f)
+			continue;
 
-			if (mat != lastMaterial)
-			{
-				// we technically dont have to check this every material change because we may still be using the same pipeline but simply different set of resources
-				// (textures). We could check the pipeline independently to avoid this state change.
-				cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, mat.getPipeline());
-
-				// Bind per material resources (Textures, Set 2)
-				cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, mat.getPipelineLayout(), 2, mat.getDescriptorSet(), {});
-				lastMaterial = mat;
-				materialChangeThisFrame++;
-			}
+		auto texturesIt = m_materialTextures.find(materialIndex);
+		if (texturesIt == m_materialTextures.cend())
+			continue;
 
-			// Upload model matrix through push constant
-			// This is easiest as each Draw call in our current case is one instance of some model
-			cmd.pushConstants<PushConstantData>(mat.getPipelineLayout(), vk::ShaderStageFlagBits::eVertex, 0, { perObjectData });
+		for (auto handle : texturesIt->second)
+			m_textureStreamer->request(handle, coverage[materialIndex]);
+	}
 
-			cmd.drawIndexed(mesh.getNumIndices(), 1, mesh.getFirstIndex(), mesh.getVertexBufferOffset(), 0);
-		}
+	m_gpuCuller->cull(cmd, frameIdx, viewProj, screenHeight);
+}
 
-	}
+void SponzaApp::drawObjects(vk::CommandBuffer& cmd, uint32_t frameIdx)
+{
+	// Every material texture and the material buffer are in Set 2, bound once (the draw records carry the material index)
+	cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_mainGfxPipelineLayout.get(), 2, m_materialDescriptorSets[frameIdx], {});
 
-	// use this to check the std::sort on RenderUnits to see that the material change count is lower!
-	// because we are sorting the renderunits by material, we can have less state change
-	//std::cout << "material change this frame: " << materialChangeThisFrame << '\n';
+	// One indirect draw per index type and pipeline, the compute pass has written the commands of the visible render units
+	m_drawStats = m_gpuCuller->draw(cmd, frameIdx, m_mainGfxPipelineLayout.get());
+	++m_drawStats.descriptorBinds;
 }
 
 void SponzaApp::createDescriptorPool()
@@ -361,12 +554,12 @@ void SponzaApp::createDescriptorPool()
 	// Make pool large enough for our needs (arbitrary)
 	std::vector<vk::DescriptorPoolSize> descriptorPoolSizes{
 		vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, 10),
-		vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 500),
+		vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 500 + s_maxBindlessTextures * VulkanContext::getMaxFramesInFlight()),
 		vk::DescriptorPoolSize(vk::DescriptorType::eUniformBufferDynamic, 10),		// Testing Dynamic Uniform Buffer (we can bind offset in BindDescriptor!)
 		vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 10)				// Testing Dynamic Uniform Buffer (we can bind offset in BindDescriptor!)
 	};
 
-	vk::DescriptorPoolCreateInfo poolCI({}, 
+	vk::DescriptorPoolCreateInfo poolCI(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind,		// Bindless texture array
 		150,										
 		descriptorPoolSizes
 	);
@@ -374,10 +567,8 @@ void SponzaApp::createDescriptorPool()
 	m_descriptorPool = m_vkCon.getDevice().createDescriptorPoolUnique(poolCI);
 }
 
-void SponzaApp::createRenderModels()
+void SponzaApp::createRenderModels(UploadBatch& batch)
 {
-	auto dev = m_vkCon.getDevice();
-
 	// Local space (RH)
 	std::vector<Vertex> vertices{
 		{ { -0.5f, 0.5f, 0.f }, { 0.f, 0.f }, { 0.f, 0.f, 1.f } },
@@ -387,45 +578,41 @@ void SponzaApp::createRenderModels()
 	};
 
 	// CCW
-	std::vector<uint32_t> indices{
+	std::vector<uint16_t> indices{
 		0, 2, 1,
 		0, 3, 2
 	};
 
 	// Create buffer resources
-	auto vb = Buffer::loadImmutable(m_vkCon, vertices, vk::BufferUsageFlagBits::eVertexBuffer);
-	auto ib = Buffer::loadImmutable(m_vkCon, indices, vk::BufferUsageFlagBits::eIndexBuffer);
-
-	// Create descriptor set with new material
-	vk::DescriptorSetAllocateInfo texAllocInfo(m_descriptorPool.get(), m_materialDescriptorSetLayout.get());
-	auto newMatDescSet = m_vkCon.getDevice().allocateDescriptorSets(texAllocInfo).front();
-
-	// Write to it (bind image and sampler)
-	vk::DescriptorImageInfo imageInfo(m_commonSampler.get(), m_mappedTextures["rimuru2"]->getImageView(), vk::ImageLayout::eShaderReadOnlyOptimal);
-	vk::WriteDescriptorSet imageSetWrite(newMatDescSet, 0, 0, vk::DescriptorType::eCombinedImageSampler, imageInfo, {}, {});
-	vk::DescriptorImageInfo opacityImageInfo(m_commonSampler.get(), m_mappedTextures["defaultopacity"]->getImageView(), vk::ImageLayout::eShaderReadOnlyOptimal);
-	vk::WriteDescriptorSet opacityImageSetWrite(newMatDescSet, 1, 0, vk::DescriptorType::eCombinedImageSampler, opacityImageInfo, {}, {});
-	vk::DescriptorImageInfo specularImageInfo(m_commonSampler.get(), m_mappedTextures["defaultspecular"]->getImageView(), vk::ImageLayout::eShaderReadOnlyOptimal);
-	vk::WriteDescriptorSet specularImageSetWrite(newMatDescSet, 2, 0, vk::DescriptorType::eCombinedImageSampler, specularImageInfo, {}, {});
-	vk::DescriptorImageInfo normalImageInfo(m_commonSampler.get(), m_mappedTextures["defaultnormal"]->getImageView(), vk::ImageLayout::eShaderReadOnlyOptimal);
-	vk::WriteDescriptorSet normalImageSetWrite(newMatDescSet, 3, 0, vk::DescriptorType::eCombinedImageSampler, normalImageInfo, {}, {});
-	dev.updateDescriptorSets({ imageSetWrite, opacityImageSetWrite, specularImageSetWrite, normalImageSetWrite}, {});
-
+	PositionQuantization quantization;
+	auto vertexData = buildVertexData(vertices, s_usePackedVertices, quantization);
+	auto geometry = m_geometryPool->allocate(vertexData.size(), getVertexLayout().getStride(), indices.size() * sizeof(uint16_t));
+	batch.copyToBuffer(vertexData.data(), vertexData.size(), m_geometryPool->getVertexBuffer(), vk::BufferUsageFlagBits::eVertexBuffer, geometry.vertexOffset);
+	batch.copyToBuffer(indices.data(), indices.size() * sizeof(uint16_t), m_geometryPool->getIndexBuffer(), vk::BufferUsageFlagBits::eIndexBuffer, geometry.indexOffset);
 
 	// ==== Create render unit(s)
-	// Create material
-	//m_loadedMaterials.push_back(std::make_unique<Material>(m_mainGfxPipeline.get(), m_mainGfxPipelineLayout.get(), newMatDescSet));
-	m_mappedMaterials.insert({ "rimuruMaterial", std::make_unique<Material>(m_mainGfxPipeline.get(), m_mainGfxPipelineLayout.get(), newMatDescSet) });
+	// Create material (engine textures go into the bindless array on first use, the default masks are cooked like model textures)
+	auto sources = getMaterialTextureSources({ "", "Resources/Textures/defaultopacity.jpg", "Resources/Textures/defaultspecular.jpg", "" });
+	MaterialData materialData{
+		getTextureSlot("rimuru2"),
+		uploadTexture(batch, sources[1]).slot,
+		uploadTexture(batch, sources[2]).slot,
+		MaterialData::s_noTexture
+	};
+	createMaterial("rimuruMaterial", materialData);
 
 	// Create mesh for each Render Unit(data into VB/IB)
-	auto mesh = Mesh(0, static_cast<uint32_t>(indices.size()));
+	auto mesh = Mesh(geometry.getBaseIndex(vk::IndexType::eUint16), static_cast<uint32_t>(indices.size()), geometry.getBaseVertex(), vk::IndexType::eUint16);
+	glm::vec4 boundingSphere(0.f, 0.f, 0.f, glm::length(glm::vec2(0.5f)));
+	mesh.setAabb(glm::vec3(-0.5f, -0.5f, 0.f), glm::vec3(0.5f, 0.5f, 0.f));
+	mesh.setBoundingSphere(boundingSphere);
 
 	// Combine to mesh and material into a render unit
 	RenderUnit renderUnit(mesh, *m_mappedMaterials["rimuruMaterial"].get());		// Use the newly created material
 
 	// Create render model
 	std::vector<RenderUnit> renderUnits{ renderUnit };
-	m_loadedModels.insert({ "rimuru", std::make_unique<RenderModel>(std::move(vb), std::move(ib), renderUnits) });
+	m_loadedModels.insert({ "rimuru", std::make_unique<RenderModel>(*m_geometryPool, geometry, renderUnits, quantization, std::vector<Meshlet>{}, boundingSphere) });
 }
 
 void SponzaApp::setupDescriptorSetLayouts()
@@ -448,38 +635,31 @@ void SponzaApp::setupDescriptorSetLayouts()
 	vk::DescriptorSetLayoutCreateInfo passSetLayoutCI({}, {});
 	//vk::DescriptorSetLayoutCreateInfo passSetLayoutCI({}, passBindings);
 
-	// Per material layout
+	// Material layout, shared by every material (bindless)
 	std::vector<vk::DescriptorSetLayoutBinding> materialBindings{
-		vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment),	// Diffuse 
-		vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment),	// Opacity
-		vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment),	// Specular
-		vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment)		// Normal
+		vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, s_maxBindlessTextures, vk::ShaderStageFlagBits::eFragment),	// All textures
+		vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eFragment)								// MaterialData per material
 	};
-	vk::DescriptorSetLayoutCreateInfo materialSetLayoutCI({}, materialBindings);
 
-	// Per object layout (not used currently)
-	std::vector<vk::DescriptorSetLayoutBinding> objectBindings{
-		vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex)	// SSBO for model matrices
+	// Only the elements in use are written (partially bound), update after bind lifts the per stage sampler limits on some devices
+	std::vector<vk::DescriptorBindingFlags> materialBindingFlags{
+		vk::DescriptorBindingFlagBits::ePartiallyBound | vk::DescriptorBindingFlagBits::eUpdateAfterBind,
+		{}
 	};
+	vk::DescriptorSetLayoutBindingFlagsCreateInfo materialBindingFlagsCI(materialBindingFlags);
+	vk::DescriptorSetLayoutCreateInfo materialSetLayoutCI(vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool, materialBindings);
+	materialSetLayoutCI.setPNext(&materialBindingFlagsCI);
 
-	//vk::DescriptorSetLayoutCreateInfo objectSetLayoutCI({}, {});
-	vk::DescriptorSetLayoutCreateInfo objectSetLayoutCI({}, objectBindings);
+	// Per object layout (Set 3) comes from the GpuCuller
 
 	// Create layouts
 	auto dev = m_vkCon.getDevice();
 	m_engineDescriptorSetLayout = dev.createDescriptorSetLayoutUnique(engineSetLayoutCI);
 	m_passDescriptorSetLayout = dev.createDescriptorSetLayoutUnique(passSetLayoutCI);
 	m_materialDescriptorSetLayout = dev.createDescriptorSetLayoutUnique(materialSetLayoutCI);
-	m_objectDescriptorSetLayout = dev.createDescriptorSetLayoutUnique(objectSetLayoutCI);
 
 }
 
-void SponzaApp::configurePushConstantRange()
-{
-	// This is used to configure the PipelineLayout when creating a Graphics Pipeline
-	m_pushConstantRange = vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(PushConstantData));
-}
-
 void SponzaApp::allocateDescriptorSets()
 {
 	auto dev = m_vkCon.getDevice();
@@ -505,25 +685,15 @@ void SponzaApp::allocateDescriptorSets()
 
 
 
-	// ======================================= Allocate Sets 2 and bind resources to it (per material)
-	
-
+	// ======================================= Allocate Set 2 (bindless textures and material buffer, written as textures and materials are loaded)
+	// One per frame in flight, every write goes to all of them
+	std::vector<vk::DescriptorSetLayout> materialSetLayouts(m_materialDescriptorSets.size(), m_materialDescriptorSetLayout.get());
+	vk::DescriptorSetAllocateInfo materialSetAllocInfo(m_descriptorPool.get(), materialSetLayouts);
+	auto materialSets = dev.allocateDescriptorSets(materialSetAllocInfo);
+	std::copy(materialSets.cbegin(), materialSets.cend(), m_materialDescriptorSets.begin());
 
-	// ======================================= Allocate Sets 3 (for per-object)
-	vk::DescriptorSetAllocateInfo objectSetAllocInfo(m_descriptorPool.get(), m_objectDescriptorSetLayout.get());
 
-	// We need to allocate 'frame in flight' number of sets since they need to be updated while the other set may still be in flight
-	for (auto i = 0ul; i < VulkanContext::getMaxFramesInFlight(); ++i)
-	{
-		m_objectFrameData[i].descriptorSet = dev.allocateDescriptorSets(objectSetAllocInfo).front();
-
-		// Write to the set (bind actual resource)
-		// We use one buffer per frame because SSBOs can be read AND written to! Its not exposed the same way as normal UBs (look at shader)
-		// Its not like UBs where the shader is only exposed to the offset and range of a buffer memory.
-		vk::DescriptorBufferInfo binfo(m_objectFrameData[i].modelMatBuffer->getBuffer(), 0, sizeof(ObjectData));
-		vk::WriteDescriptorSet writeInfo(m_objectFrameData[i].descriptorSet, 0, 0, vk::DescriptorType::eStorageBuffer, {}, binfo);
-		dev.updateDescriptorSets(writeInfo, {});
-	}
+	// ======================================= Sets 3 (per-object) are allocated by the GpuCuller, one per frame in flight
 }
 
 
@@ -533,10 +703,11 @@ void SponzaApp::createGraphicsPipeline()
 	auto dev = m_vkCon.getDevice();
 
 	// ======== Shader
-	auto vertBin = readFile("compiled_shaders/vertSponza.spv");
-	auto fragBin = readFile("compiled_shaders/fragSponza.spv");
-	auto vertMod = dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo({}, vertBin.size(), reinterpret_cast<uint32_t*>(vertBin.data())));
-	auto fragMod = dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo({}, fragBin.size(), reinterpret_cast<uint32_t*>(fragBin.data())));
+	const char* vertPath = s_usePackedVertices ? "compiled_shaders/vertSponzaPacked.spv" : "compiled_shaders/vertSponza.spv";
+	MappedFile vertBin(vertPath);
+	MappedFile fragBin("compiled_shaders/fragSponza.spv");
+	auto vertMod = dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo({}, vertBin.getSize(), reinterpret_cast<const uint32_t*>(vertBin.getData())));
+	auto fragMod = dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo({}, fragBin.getSize(), reinterpret_cast<const uint32_t*>(fragBin.getData())));
 	std::array<vk::PipelineShaderStageCreateInfo, 2> shaderStageC = {
 		vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, vertMod.get(), "main"),
 		vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, fragMod.get(), "main")
@@ -546,8 +717,9 @@ void SponzaApp::createGraphicsPipeline()
 	// Perhaps we dont need to have all bindings everywhere for per frame?
 	ShaderGroup shdGrp;
 	shdGrp
-		.addStage(vk::ShaderStageFlagBits::eVertex, "compiled_shaders/vertSponza.spv")
+		.addStage(vk::ShaderStageFlagBits::eVertex, vertPath)
 		.addStage(vk::ShaderStageFlagBits::eFragment, "compiled_shaders/fragSponza.spv")
+		.setVertexLayout(getVertexLayout())
 		.build(m_vkCon.getDevice());
 
 	ShaderGroup shdGrp2;
@@ -558,9 +730,8 @@ void SponzaApp::createGraphicsPipeline()
 	
 
 	// ======== Vertex Input Binding Description (Vertex Shader)
-	std::vector<vk::VertexInputBindingDescription> bindingDescs{ Vertex::getBindingDescription() };
-	auto inputAttrDescs{ Vertex::getAttributeDescriptions() };
-	vk::PipelineVertexInputStateCreateInfo vertInC({}, bindingDescs, inputAttrDescs);
+	// Reflected shader inputs matched against the vertex layout in use
+	auto vertInC = shdGrp.getVertexInputStateCI();
 
 	// ======== Pipeline Layout (Layouts for Shader Inputs + Push Constant)
 	// Order matters here
@@ -568,11 +739,11 @@ void SponzaApp::createGraphicsPipeline()
 		m_engineDescriptorSetLayout.get(),		// Set 0
 		m_passDescriptorSetLayout.get(),		// Set 1
 		m_materialDescriptorSetLayout.get(),	// Set 2
-		m_objectDescriptorSetLayout.get()		// Set 3
+		m_gpuCuller->getDrawSetLayout()			// Set 3
 	};
 
-	m_mainGfxPipelineLayout = dev.createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, compatibleLayouts, m_pushConstantRange));
-	//m_mainGfxPipelineLayout = dev.createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, compatibleLayouts));
+	// No push constants, everything per draw comes from the draw record (Set 3) by instance index
+	m_mainGfxPipelineLayout = dev.createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, compatibleLayouts));
 
 
 
@@ -657,17 +828,16 @@ void SponzaApp::createGraphicsPipeline()
 		m_engineDescriptorSetLayout.get(),		// Set 0
 	};
 
-	// Why do we need the push constant range?
 	// Spec @Pipeline Layout Compatibility 14.2.2
-	// Two pipeline layouts are defined to be compatible for push constants if they were created with identical push constant ranges. 
 	// Two pipeline layouts are defined to be compatible for set N if they were created with 
 	// identically defined descriptor set layouts for sets zero through N, || and if they were created with identical push constant ranges. || <-- Last bit 
-	m_skyboxGfxPipelineLayout = dev.createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, compatibleLayoutsSB, m_pushConstantRange));
+	// Neither layout has push constants, so Set 0 bound through the main layout stays valid for the skybox
+	m_skyboxGfxPipelineLayout = dev.createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, compatibleLayoutsSB));
 
-	auto vertBinSB = readFile("compiled_shaders/vertSkybox.spv");
-	auto fragBinSB = readFile("compiled_shaders/fragSkybox.spv");
-	auto vertModSB = dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo({}, vertBinSB.size(), reinterpret_cast<uint32_t*>(vertBinSB.data())));
-	auto fragModSB = dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo({}, fragBinSB.size(), reinterpret_cast<uint32_t*>(fragBinSB.data())));
+	MappedFile vertBinSB("compiled_shaders/vertSkybox.spv");
+	MappedFile fragBinSB("compiled_shaders/fragSkybox.spv");
+	auto vertModSB = dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo({}, vertBinSB.getSize(), reinterpret_cast<const uint32_t*>(vertBinSB.getData())));
+	auto fragModSB = dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo({}, fragBinSB.getSize(), reinterpret_cast<const uint32_t*>(fragBinSB.getData())));
 
 
 
@@ -711,8 +881,14 @@ void SponzaApp::setupResources()
 	// Create UBOs that will be used in this App
 	createUBOs();
 
+	// All texture and VB/IB uploads below are recorded into one batch and submitted together at the end
+	m_uploadBatch = std::make_unique<UploadBatch>(m_vkCon);
+	auto& uploadBatch = *m_uploadBatch;
+	m_textureStreamer = std::make_unique<TextureStreamer>(m_vkCon);
+	m_geometryPool = std::make_unique<GeometryPool>(m_vkCon);
+
 	// Set up Texture
-	loadTextures();
+	loadTextures(uploadBatch);
 
 	// Setup global sampler that will be used for all images
 	vk::SamplerCreateInfo sCI({},
@@ -728,26 +904,42 @@ void SponzaApp::setupResources()
 
 	// ============ Setup the layout for our 4 sets and possible push constants (for PipelineLayout)
 	setupDescriptorSetLayouts();
-	configurePushConstantRange();
 
 	// Setup descriptor sets
 	// Engine Global (Set 0) (e.g Camera)
 	// Per Pass (Set 1)
-	// Per Material (Set 2)
-	// Per Object (Set 3)
+	// Materials (Set 2) (bindless)
+	// Per Object (Set 3) (GpuCuller)
 	allocateDescriptorSets();
+	m_gpuCuller = std::make_unique<GpuCuller>(m_vkCon, *m_geometryPool, s_lodScreenSizes, s_minScreenSize);
 
 	// ============
 	createGraphicsPipeline();
 
 	// ======== Load scene data
 	// Create custom render model
-	createRenderModels();
+	createRenderModels(uploadBatch);
 
 	// Load with assimp
-	loadExternalModel("Resources/Objs/nanosuit_gunnar/nanosuit.obj");
-	loadExternalModel("Resources/Objs/sponza_new/Sponza.obj");
-	loadExternalModel("Resources/Objs/survival_backpack/backpack.obj");
+	loadExternalModel(uploadBatch, "Resources/Objs/nanosuit_gunnar/nanosuit.obj");
+	loadExternalModel(uploadBatch, "Resources/Objs/sponza_new/Sponza.obj");
+	loadExternalModel(uploadBatch, "Resources/Objs/survival_backpack/backpack.obj");
+
+	// Material indices into the bindless texture array
+	createMaterialBuffer(uploadBatch);
+
+	const auto& dedup = m_textureStreamer->getDedupStats();
+	std::cout << "Textures: " << dedup.misses << " unique, " << dedup.hits << " duplicates by content ("
+		<< dedup.bytesSaved / (1024 * 1024) << " MB saved)\n";
+	// Free ranges beyond one per allocator are holes left by freed models
+	const auto& vertexAllocator = m_geometryPool->getVertexAllocator();
+	const auto& indexAllocator = m_geometryPool->getIndexAllocator();
+	std::cout << "Geometry pool: " << vertexAllocator.getUsedSize() / (1024 * 1024) << " / " << vertexAllocator.getSize() / (1024 * 1024) << " MB vertices ("
+		<< vertexAllocator.getFreeRangeCount() << " free ranges), " << indexAllocator.getUsedSize() / (1024 * 1024) << " / " << indexAllocator.getSize() / (1024 * 1024)
+		<< " MB indices (" << indexAllocator.getFreeRangeCount() << " free ranges)\n";
+
+	// Does not block, the frame submits wait on the upload timeline instead
+	uploadBatch.submit();
 
 	// Write skybox data
 	vk::DescriptorImageInfo skyboxImageInfo(m_commonSampler.get(), m_mappedTextures["yokohamaSB"]->getImageView(), vk::ImageLayout::eShaderReadOnlyOptimal);
@@ -756,7 +948,7 @@ void SponzaApp::setupResources()
 }
 
 
-void SponzaApp::loadMaterial(std::string directory, AssimpMaterialPaths texturePaths)
+std::array<std::string, 4> SponzaApp::getMaterialTexturePaths(const std::string& directory, const AssimpMaterialPaths& texturePaths) const
 {
 	// Get final diffuse path
 	std::string diffusePath(directory);
@@ -779,84 +971,212 @@ void SponzaApp::loadMaterial(std::string directory, AssimpMaterialPaths textureP
 	else
 		specularPath = "Resources/Textures/defaultspecular.jpg";
 
-	// Get final normal path
-	std::string normalPath(directory);
+	// Get final normal path (none if the material has no normal map)
+	std::string normalPath;
 	if (texturePaths.normalFilePath.has_value())
-		normalPath += texturePaths.normalFilePath.value();
-	else
-		normalPath = "Resources/Textures/defaultnormal.jpg";
+		normalPath = directory + texturePaths.normalFilePath.value();
 
-	// Parent paths is diffuse (identifier for descriptor set)
-	uploadTexture(diffusePath, true, true, diffusePath, 0);
-	uploadTexture(opacityPath, true, false, diffusePath, 1);
-	uploadTexture(specularPath, true, false, diffusePath, 2);
-	uploadTexture(normalPath, true, false, diffusePath, 3);
+	return { diffusePath, opacityPath, specularPath, normalPath };
+}
+
+void SponzaApp::loadMaterial(UploadBatch& batch, std::string directory, AssimpMaterialPaths texturePaths)
+{
+	auto paths = getMaterialTexturePaths(directory, texturePaths);
+	auto sources = getMaterialTextureSources(paths);
+	const auto& diffusePath = paths[0];
+
+	std::array<StreamedTextureSlot, 3> textures{
+		uploadTexture(batch, sources[0]),
+		uploadTexture(batch, sources[1]),
+		uploadTexture(batch, sources[2])
+	};
+	std::vector<TextureStreamer::Handle> handles{ textures[0].handle, textures[1].handle, textures[2].handle };
+
+	// Materials without a normal map are flagged in the material data rather than pointed at a placeholder texture
+	uint32_t normalSlot = MaterialData::s_noTexture;
+	if (!sources[3].path.empty())
+	{
+		auto normal = uploadTexture(batch, sources[3]);
+		normalSlot = normal.slot;
+		handles.push_back(normal.handle);
+	}
 
+	// Parent paths is diffuse (identifier for the material)
+	uint32_t materialIndex = createMaterial(diffusePath, { textures[0].slot, textures[1].slot, textures[2].slot, normalSlot });
+	m_materialTextures[materialIndex] = handles;
 }
 
-void SponzaApp::uploadTexture(std::string finalPath, bool genMips, bool srgb, std::string materialParentPath, uint32_t bindingSlot)
+std::array<TextureSource, 4> SponzaApp::getMaterialTextureSources(const std::array<std::string, 4>& texturePaths)
 {
-	if (m_mappedTextures.find(finalPath) == m_mappedTextures.cend())
-		m_mappedTextures.insert({ finalPath, std::move(Texture::fromFile(m_vkCon, finalPath, genMips, srgb)) });
+	TextureSource diffuse{ texturePaths[0], {}, TextureUsage::Color };
+	TextureSource normal{ texturePaths[3], {}, TextureUsage::Normal };
+	if (s_packMaterialMasks)
+	{
+		TextureSource masks{ texturePaths[1], texturePaths[2], TextureUsage::MaskPair };
+		return { diffuse, masks, masks, normal };
+	}
+	return { diffuse, TextureSource{ texturePaths[1], {}, TextureUsage::Mask }, TextureSource{ texturePaths[2], {}, TextureUsage::Mask }, normal };
+}
 
-	// Parent (diffuse) (responsible for descriptor not yet initialized)
-	if (m_mappedMaterials.find(materialParentPath) == m_mappedMaterials.cend())
+void SponzaApp::cookTexturesAsync(const std::vector<TextureSource>& textures)
+{
+	for (const auto& source : textures)
 	{
-		// Create descriptor set with new material
-		vk::DescriptorSetAllocateInfo texAllocInfo(m_descriptorPool.get(), m_materialDescriptorSetLayout.get());
-		auto newMatDescSet = m_vkCon.getDevice().allocateDescriptorSets(texAllocInfo).front();
-		m_mappedMaterials.insert({ materialParentPath, std::make_unique<Material>(m_mainGfxPipeline.get(), m_mainGfxPipelineLayout.get(), newMatDescSet) });
+		auto cookedPath = CookedTexture::getCookedPath(source).string();
+
+		// No texture (a material without a normal map)
+		if (source.path.empty())
+			continue;
+
+		// Already uploaded, already being cooked or nothing to do
+		if (m_streamedTextures.find(cookedPath) != m_streamedTextures.cend() || m_pendingCooks.find(cookedPath) != m_pendingCooks.cend())
+			continue;
+		if (CookedTexture::isUpToDate(cookedPath, source))
+			continue;
+
+		m_pendingCooks.insert({ cookedPath, m_decodePool.submit([source, cookedPath]() { CookedTexture::cook(source, cookedPath); }) });
 	}
+}
 
+StreamedTextureSlot SponzaApp::uploadTexture(UploadBatch& batch, const TextureSource& source)
+{
+	// Textures are block compressed with a full mip chain offline, the upload is a copy of the mapped .ktx2 levels
+	// Only the mip tail is uploaded here, the streamer brings in the larger levels once the texture shows up on screen
+	auto cookedPath = CookedTexture::getCookedPath(source).string();
+	if (m_streamedTextures.find(cookedPath) == m_streamedTextures.cend())
+	{
+		// Wait for the cook on the worker pool if it was queued, only blocks until this specific texture is done
+		auto pendingIt = m_pendingCooks.find(cookedPath);
+		if (pendingIt != m_pendingCooks.end())
+		{
+			pendingIt->second.get();
+			m_pendingCooks.erase(pendingIt);
+		}
+		else if (!CookedTexture::isUpToDate(cookedPath, source))
+			CookedTexture::cook(source, cookedPath);
 
-	// Write to existing descriptor set (existing material that was made from diffuse) (bind image and sampler)
-	vk::DescriptorImageInfo imageInfo(m_commonSampler.get(), m_mappedTextures[finalPath]->getImageView(), vk::ImageLayout::eShaderReadOnlyOptimal);
-	vk::WriteDescriptorSet imageSetWrite(m_mappedMaterials[materialParentPath]->getDescriptorSet(), bindingSlot, 0, vk::DescriptorType::eCombinedImageSampler, imageInfo, {}, {});
-	m_vkCon.getDevice().updateDescriptorSets(imageSetWrite, {});
+		// Each unique texture gets its own element of the bindless array, rewritten by the streamer on every swap
+		// Identical content under another path comes back as the existing handle and shares its element
+		auto handle = m_textureStreamer->addTexture(batch, cookedPath);
+		if (handle == m_streamedTextureSlots.size())
+		{
+			m_streamedTextureSlots.push_back(allocateTextureSlot());
+			m_textureStreamer->addBinding(handle, m_materialDescriptorSets, 0, m_streamedTextureSlots[handle], m_commonSampler.get());
+		}
+		m_streamedTextures.insert({ cookedPath, { handle, m_streamedTextureSlots[handle] } });
+	}
+
+	return m_streamedTextures[cookedPath];
 }
 
-void SponzaApp::loadExternalModel(const std::filesystem::path& filePath)
+uint32_t SponzaApp::allocateTextureSlot()
 {
-	auto dev = m_vkCon.getDevice();
-	std::string directory = filePath.parent_path().string() + "/";
+	if (m_textureSlotCount == s_maxBindlessTextures)
+		throw std::runtime_error("Bindless texture array is full");
+	return m_textureSlotCount++;
+}
+
+uint32_t SponzaApp::getTextureSlot(const std::string& textureName)
+{
+	auto it = m_engineTextureSlots.find(textureName);
+	if (it != m_engineTextureSlots.cend())
+		return it->second;
+
+	uint32_t slot = allocateTextureSlot();
+	vk::DescriptorImageInfo imageInfo(m_commonSampler.get(), m_mappedTextures[textureName]->getImageView(), vk::ImageLayout::eShaderReadOnlyOptimal);
+	std::vector<vk::WriteDescriptorSet> imageSetWrites;
+	for (auto materialSet : m_materialDescriptorSets)
+		imageSetWrites.push_back(vk::WriteDescriptorSet(materialSet, 0, slot, vk::DescriptorType::eCombinedImageSampler, imageInfo, {}, {}));
+	m_vkCon.getDevice().updateDescriptorSets(imageSetWrites, {});
+
+	m_engineTextureSlots.insert({ textureName, slot });
+	return slot;
+}
+
+uint32_t SponzaApp::createMaterial(const std::string& materialParentPath, const MaterialData& materialData)
+{
+	auto it = m_mappedMaterials.find(materialParentPath);
+	if (it != m_mappedMaterials.cend())
+	{
+		m_materialData[it->second->getIndex()] = materialData;
+		return it->second->getIndex();
+	}
+
+	uint32_t index = static_cast<uint32_t>(m_materialData.size());
+	m_materialData.push_back(materialData);
+	m_mappedMaterials.insert({ materialParentPath, std::make_unique<Material>(m_mainGfxPipeline.get(), m_mainGfxPipelineLayout.get(), index) });
+	return index;
+}
+
+void SponzaApp::createMaterialBuffer(UploadBatch& batch)
+{
+	// loadImmutable is limited to VB/IB, so fill a device local buffer through the batch directly
+	size_t materialDataSize = m_materialData.size() * sizeof(MaterialData);
+	m_materialBuffer = Buffer::createDeviceLocal(m_vkCon, materialDataSize, vk::BufferUsageFlagBits::eStorageBuffer);
+	batch.copyToBuffer(m_materialData.data(), materialDataSize, m_materialBuffer->getBuffer(), vk::BufferUsageFlagBits::eStorageBuffer);
+
+	vk::DescriptorBufferInfo bufferInfo(m_materialBuffer->getBuffer(), 0, VK_WHOLE_SIZE);
+	std::vector<vk::WriteDescriptorSet> bufferSetWrites;
+	for (auto materialSet : m_materialDescriptorSets)
+		bufferSetWrites.push_back(vk::WriteDescriptorSet(materialSet, 1, 0, vk::DescriptorType::eStorageBuffer, {}, bufferInfo));
+	m_vkCon.getDevice().updateDescriptorSets(bufferSetWrites, {});
+}
 
-	auto loader = AssimpLoader(filePath);
-	auto& vertices = loader.getVertices();
-	auto& indices = loader.getIndices();
-	auto& subsets = loader.getSubsets();
+void SponzaApp::cookExternalModel(const std::filesystem::path& sourcePath, const std::filesystem::path& cookedPath)
+{
+	auto loader = AssimpLoader(sourcePath);
+	auto vertices = loader.releaseVertices();
+	auto indices = loader.releaseIndices();
+	auto subsets = loader.getSubsets();
 	auto& materials = loader.getMaterials();
 
+	// Merge the per face corner vertices, then reorder triangles/vertices for the post-transform cache, overdraw and vertex fetch
+	std::cout << "Optimizing " << sourcePath.filename().string() << '\n';
+	weldVertices(vertices, indices, subsets);
+	optimizeMesh(vertices, indices, subsets);
 
+	// Split into cullable clusters
+	auto meshlets = buildMeshlets(vertices, indices, subsets);
+	std::cout << "Built " << meshlets.size() << " meshlets\n";
 
+	// Coarser index ranges sharing the vertices
+	buildLods(vertices, indices, subsets, Mesh::s_maxLods);
+	auto boundingSphere = computeBoundingSphere(vertices);
 
 	// PACK DATA FOR VULKAN
+	PositionQuantization quantization;
+	auto vertexData = buildVertexData(vertices, s_usePackedVertices, quantization);
+
+	// Subsets referencing less than 64k vertices get 16-bit indices
+	auto indexData = packSubsetIndices(indices, subsets);
+
+	CookedMesh::write(cookedPath, vertexData.data(), getVertexLayout().getStride(), static_cast<uint32_t>(vertices.size()), quantization, boundingSphere, indexData, subsets, meshlets, materials);
+}
+
+void SponzaApp::loadExternalModel(UploadBatch& batch, const std::filesystem::path& filePath)
+{
+	std::string directory = filePath.parent_path().string() + "/";
+
+	// Assimp import only runs when the cooked mesh is missing or stale, otherwise the load is a single file map
+	auto cookedPath = filePath;
+	cookedPath.replace_extension(CookedMesh::s_fileExtension);
+	if (!CookedMesh::isUpToDate(cookedPath, filePath, getVertexLayout().getStride()))
+		cookExternalModel(filePath, cookedPath);
+
+	CookedMesh cooked(cookedPath);
+	auto& subsets = cooked.getSubsets();
+	auto& materials = cooked.getMaterials();
+
+
+
 	// ======== Handle VB/IB
-	// Pack data
-	std::vector<Vertex> finalVerts;
-	finalVerts.reserve(vertices.size());
-	for (const auto& vert : vertices)
-	{
-		Vertex vertex;
-		vertex.pos.x = vert.position.x;
-		vertex.pos.y = vert.position.y;
-		vertex.pos.z = vert.position.z;
-		vertex.uv.x = vert.uv.x;
-		vertex.uv.y = vert.uv.y;
-		vertex.normal.x = vert.normal.x;
-		vertex.normal.y = vert.normal.y;
-		vertex.normal.z = vert.normal.z;
-		vertex.tangent.x = vert.tangent.x;
-		vertex.tangent.y = vert.tangent.y;
-		vertex.tangent.z = vert.tangent.z;
-		vertex.bitangent.x = vert.bitangent.x;
-		vertex.bitangent.y = vert.bitangent.y;
-		vertex.bitangent.z = vert.bitangent.z;
-		finalVerts.push_back(vertex);
-	}
+	// Mapped bytes are already in the final vertex layout and go straight into the staging buffers, and from there into the model's pool range
+	auto geometry = m_geometryPool->allocate(cooked.getVertexDataSize(), cooked.getVertexStride(), cooked.getIndexDataSize());
+	size_t streamed = streamCookedGeometry(batch, cooked, *m_geometryPool, geometry);
 
-	// Push into VB/IB pair
-	auto vb = Buffer::loadImmutable(m_vkCon, finalVerts, vk::BufferUsageFlagBits::eVertexBuffer);
-	auto ib = Buffer::loadImmutable(m_vkCon, indices, vk::BufferUsageFlagBits::eIndexBuffer);
+	std::cout << filePath.filename().string() << ": streamed " << streamed / (1024 * 1024) << " MB of geometry, "
+		<< "staging ring peak " << m_vkCon.getUploadContext().getStagingRing().getPeakUsedSize() / (1024 * 1024) << " MB, "
+		<< "peak memory " << getPeakMemoryUsage() / (1024 * 1024) << " MB\n";
 
 
 	// ======== Handle Subsets
@@ -864,14 +1184,34 @@ void SponzaApp::loadExternalModel(const std::filesystem::path& filePath)
 	// Load materials
 	// Here we should load the materials and let renderUnits below simply pick from the loaded materials
 
+	// Kick off cooking of every unique texture this model references before uploading the first one
+	std::vector<TextureSource> textures;
+	textures.reserve(materials.size() * 4);
+	for (const auto& mat : materials)
+	{
+		auto sources = getMaterialTextureSources(getMaterialTexturePaths(directory, mat));
+		textures.insert(textures.end(), sources.begin(), sources.end());
+	}
+	cookTexturesAsync(textures);
+
 	for (auto& mat : materials)
-		loadMaterial(directory, mat);
+		loadMaterial(batch, directory, mat);
 
 	std::vector<RenderUnit> renderUnits;
 	renderUnits.reserve(subsets.size());
 	for (const auto& subset : subsets)
 	{
-		auto mesh = Mesh(subset.indexStart, subset.indexCount, subset.vertexStart);
+		// Ranges in the cooked file are relative to the model, the mesh gets its absolute ones in the pool
+		auto indexType = subset.use16BitIndices ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+		uint32_t baseIndex = geometry.getBaseIndex(indexType);
+		auto mesh = Mesh(baseIndex + subset.indexStart, subset.indexCount, geometry.getBaseVertex() + subset.vertexStart, indexType,
+			subset.meshletStart, subset.meshletCount);
+		for (const auto& lod : subset.lods)
+			mesh.addLod(baseIndex + lod.indexStart, lod.indexCount);
+
+		// Subset bounds from the import, the box for frustum culling and the sphere for texture streaming
+		mesh.setAabb(subset.aabbMin, subset.aabbMax);
+		mesh.setBoundingSphere(subset.boundingSphere);
 
 		// Get final diffuse path (material parent path)
 		std::string diffusePath(directory);
@@ -889,7 +1229,7 @@ void SponzaApp::loadExternalModel(const std::filesystem::path& filePath)
 	auto fname = filePath.stem().string();
 	std::for_each(fname.begin(), fname.end(), [](char& c) { c = std::tolower(c); });
 
-	m_loadedModels.insert({ fname, std::make_unique<RenderModel>(std::move(vb), std::move(ib), renderUnits) });
+	m_loadedModels.insert({ fname, std::make_unique<RenderModel>(*m_geometryPool, geometry, renderUnits, cooked.getPositionQuantization(), cooked.getMeshlets(), cooked.getBoundingSphere()) });
 
 
 }
@@ -69,6 +69,16 @@ namespace Nagi
 		return m_indices;
 	}
 
+	std::vector<AssimpVertex> AssimpLoader::releaseVertices()
+	{
+		return std::move(m_vertices);
+	}
+
+	std::vector<uint32_t> AssimpLoader::releaseIndices()
+	{
+		return std::move(m_indices);
+	}
+
 	const std::vector<AssimpMeshSubset>& AssimpLoader::getSubsets() const
 	{
 		return m_subsets;
@@ -79,6 +89,47 @@ namespace Nagi
 		return m_materials;
 	}
 
+	std::vector<uint8_t> packSubsetIndices(const std::vector<uint32_t>& indices, std::vector<AssimpMeshSubset>& subsets)
+	{
+		std::vector<uint8_t> packed;
+		packed.reserve(indices.size() * sizeof(uint32_t));
+
+		// Returns the new start of the range
+		auto packRange = [&](unsigned int indexStart, unsigned int indexCount, bool use16BitIndices) -> unsigned int
+		{
+			const uint32_t* src = indices.data() + indexStart;
+			if (use16BitIndices)
+			{
+				size_t offset = packed.size();
+				packed.resize(offset + indexCount * sizeof(uint16_t));
+				auto dst = reinterpret_cast<uint16_t*>(packed.data() + offset);
+				for (unsigned int i = 0; i < indexCount; ++i)
+				{
+					assert(src[i] <= std::numeric_limits<uint16_t>::max());
+					dst[i] = static_cast<uint16_t>(src[i]);
+				}
+				return static_cast<unsigned int>(offset / sizeof(uint16_t));
+			}
+			else
+			{
+				size_t offset = getAlignedSize(static_cast<uint32_t>(packed.size()), sizeof(uint32_t));
+				packed.resize(offset + indexCount * sizeof(uint32_t));
+				std::memcpy(packed.data() + offset, src, indexCount * sizeof(uint32_t));
+				return static_cast<unsigned int>(offset / sizeof(uint32_t));
+			}
+		};
+
+		// LODs share the vertex range and therefore the index type of their subset
+		for (auto& subset : subsets)
+		{
+			subset.indexStart = packRange(subset.indexStart, subset.indexCount, subset.use16BitIndices);
+			for (auto& lod : subset.lods)
+				lod.indexStart = packRange(lod.indexStart, lod.indexCount, subset.use16BitIndices);
+		}
+
+		return packed;
+	}
+
 	void AssimpLoader::processMesh(aiMesh* mesh, const aiScene* scene)
 	{
 		for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
@@ -141,9 +192,31 @@ namespace Nagi
 		subsetData.specularFilePath = (specularPath.length == 0) ? std::nullopt : std::optional<std::string>(specularPath.C_Str());
 
 
+		// Sphere around the AABB center, like the model bounds
+		if (mesh->mNumVertices > 0)
+		{
+			glm::vec3 minBound(std::numeric_limits<float>::max()), maxBound(std::numeric_limits<float>::lowest());
+			for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
+			{
+				glm::vec3 p(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+				minBound = glm::min(minBound, p);
+				maxBound = glm::max(maxBound, p);
+			}
+
+			glm::vec3 center = (minBound + maxBound) * 0.5f;
+			float radius = 0.f;
+			for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
+				radius = std::max(radius, glm::length(glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z) - center));
+
+			subsetData.aabbMin = minBound;
+			subsetData.aabbMax = maxBound;
+			subsetData.boundingSphere = glm::vec4(center, radius);
+		}
+
 		subsetData.vertexStart = m_meshVertexCount;
 		m_meshVertexCount += mesh->mNumVertices;
 
+		subsetData.use16BitIndices = mesh->mNumVertices <= std::numeric_limits<uint16_t>::max();
 		subsetData.indexCount = indicesThisMesh;
 		subsetData.indexStart = m_meshIndexCount;
 		m_meshIndexCount += indicesThisMesh;
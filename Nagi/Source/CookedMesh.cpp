@@ -0,0 +1,444 @@
+#include "pch.h"
+#include "CookedMesh.h"
+
+namespace Nagi
+{
+	// File layout:
+	// [Header][SectionEntry * sectionCount][Section data ...]
+	// Every section starts on a 16 byte boundary so that the vertex/index data can be read in place from the mapping
+	static constexpr uint32_t COOKED_MESH_MAGIC = 0x4D47414E;		// 'NAGM'
+	static constexpr uint32_t SECTION_ALIGNMENT = 16;
+	static constexpr uint32_t INVALID_STRING = ~0u;
+
+	enum class SectionID : uint32_t
+	{
+		Vertices,
+		Indices,
+		Subsets,
+		Materials,
+		Strings,
+		Quantization,
+		Meshlets,
+		Lods,
+		Bounds,
+
+		Count
+	};
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vertexStride;
+		uint32_t vertexCount;
+		uint32_t indexDataSize;
+		uint32_t subsetCount;
+		uint32_t materialCount;
+		uint32_t sectionCount;
+	};
+
+	struct SectionEntry
+	{
+		uint32_t id;
+		uint32_t padding;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	// Paths are offsets into the string section (INVALID_STRING if none)
+	struct MaterialEntry
+	{
+		uint32_t diffuse;
+		uint32_t specular;
+		uint32_t normal;
+		uint32_t opacity;
+	};
+
+	struct SubsetEntry
+	{
+		uint32_t vertexStart;
+		uint32_t indexStart;
+		uint32_t indexCount;
+		uint32_t use16BitIndices;
+		uint32_t meshletStart;
+		uint32_t meshletCount;
+		uint32_t lodStart;		// Into the LOD section
+		uint32_t lodCount;
+		MaterialEntry paths;
+		float aabbMin[3];		// Plain floats, the aligned glm types would pad the entry
+		float aabbMax[3];
+		float boundingSphere[4];
+	};
+
+	struct LodEntry
+	{
+		uint32_t indexStart;
+		uint32_t indexCount;
+	};
+
+	// [offset, offset + size) lies within [0, total), without overflowing on corrupt values
+	static bool isInRange(uint64_t offset, uint64_t size, uint64_t total)
+	{
+		return offset <= total && size <= total - offset;
+	}
+
+	static FileHeader readHeader(const std::filesystem::path& cookedPath)
+	{
+		FileHeader header{};
+		std::ifstream file(cookedPath, std::ios::binary);
+		if (file.is_open())
+			file.read(reinterpret_cast<char*>(&header), sizeof(FileHeader));
+		return header;
+	}
+
+	CookedMesh::CookedMesh(const std::filesystem::path& cookedPath) :
+		m_file(std::make_unique<MappedFile>(cookedPath))
+	{
+		const uint8_t* base = m_file->getData();
+		size_t fileSize = m_file->getSize();
+
+		if (fileSize < sizeof(FileHeader))
+			throw std::runtime_error("Cooked mesh is truncated: " + cookedPath.string());
+
+		const auto& header = *reinterpret_cast<const FileHeader*>(base);
+		if (header.magic != COOKED_MESH_MAGIC || header.version != s_version)
+			throw std::runtime_error("Cooked mesh has an unsupported format: " + cookedPath.string());
+
+		// Locate sections
+		std::array<const SectionEntry*, static_cast<size_t>(SectionID::Count)> sections{};
+		const auto* sectionTable = reinterpret_cast<const SectionEntry*>(base + sizeof(FileHeader));
+		if (!isInRange(sizeof(FileHeader), static_cast<uint64_t>(header.sectionCount) * sizeof(SectionEntry), fileSize))
+			throw std::runtime_error("Cooked mesh is truncated: " + cookedPath.string());
+
+		for (uint32_t i = 0; i < header.sectionCount; ++i)
+		{
+			const auto& section = sectionTable[i];
+			if (!isInRange(section.offset, section.size, fileSize))
+				throw std::runtime_error("Cooked mesh is truncated: " + cookedPath.string());
+			if (section.offset % SECTION_ALIGNMENT != 0)
+				throw std::runtime_error("Cooked mesh is corrupt: " + cookedPath.string());
+			if (section.id < sections.size())
+				sections[section.id] = &section;
+		}
+
+		for (const auto& section : sections)
+			if (section == nullptr)
+				throw std::runtime_error("Cooked mesh is missing a section: " + cookedPath.string());
+
+		auto sectionData = [&](SectionID id) { return base + sections[static_cast<size_t>(id)]->offset; };
+		auto sectionSize = [&](SectionID id) { return sections[static_cast<size_t>(id)]->size; };
+
+		// Everything read below has to lie within its section, a truncated or corrupt file is rejected rather than read out of bounds
+		auto corrupt = [&cookedPath]() { return std::runtime_error("Cooked mesh is corrupt: " + cookedPath.string()); };
+		if (static_cast<uint64_t>(header.vertexStride) * header.vertexCount != sectionSize(SectionID::Vertices) ||
+			header.indexDataSize != sectionSize(SectionID::Indices) ||
+			static_cast<uint64_t>(header.subsetCount) * sizeof(SubsetEntry) > sectionSize(SectionID::Subsets) ||
+			static_cast<uint64_t>(header.materialCount) * sizeof(MaterialEntry) > sectionSize(SectionID::Materials))
+			throw corrupt();
+
+		m_vertexStride = header.vertexStride;
+		m_vertexCount = header.vertexCount;
+		m_vertexData = sectionData(SectionID::Vertices);
+		m_vertexDataSize = sectionSize(SectionID::Vertices);
+		if (sectionSize(SectionID::Quantization) != sizeof(PositionQuantization))
+			throw std::runtime_error("Cooked mesh has an unsupported format: " + cookedPath.string());
+		m_quantization = *reinterpret_cast<const PositionQuantization*>(sectionData(SectionID::Quantization));
+		if (sectionSize(SectionID::Bounds) != sizeof(glm::vec4))
+			throw std::runtime_error("Cooked mesh has an unsupported format: " + cookedPath.string());
+		m_boundingSphere = *reinterpret_cast<const glm::vec4*>(sectionData(SectionID::Bounds));
+
+		m_indexData = sectionData(SectionID::Indices);
+		m_indexDataSize = sectionSize(SectionID::Indices);
+
+		// The geometry is the bulk of the file and goes to staging right after load, get the reads going while the tables are unpacked
+		m_file->prefetch(sections[static_cast<size_t>(SectionID::Vertices)]->offset, m_vertexDataSize);
+		m_file->prefetch(sections[static_cast<size_t>(SectionID::Indices)]->offset, m_indexDataSize);
+
+		// Unpack path tables, strings have to start and be terminated within their section
+		const char* strings = reinterpret_cast<const char*>(sectionData(SectionID::Strings));
+		size_t stringsSize = sectionSize(SectionID::Strings);
+		auto getString = [&](uint32_t offset) -> std::optional<std::string>
+		{
+			if (offset == INVALID_STRING)
+				return std::nullopt;
+			if (offset >= stringsSize || std::memchr(strings + offset, '\0', stringsSize - offset) == nullptr)
+				throw corrupt();
+			return std::string(strings + offset);
+		};
+
+		const auto* materialEntries = reinterpret_cast<const MaterialEntry*>(sectionData(SectionID::Materials));
+		m_materials.reserve(header.materialCount);
+		for (uint32_t i = 0; i < header.materialCount; ++i)
+		{
+			const auto& entry = materialEntries[i];
+			AssimpMaterialPaths paths;
+			paths.diffuseFilePath = getString(entry.diffuse);
+			paths.specularFilePath = getString(entry.specular);
+			paths.normalFilePath = getString(entry.normal);
+			paths.opacityFilePath = getString(entry.opacity);
+			m_materials.push_back(paths);
+		}
+
+		const auto* subsetEntries = reinterpret_cast<const SubsetEntry*>(sectionData(SectionID::Subsets));
+		const auto* lodEntries = reinterpret_cast<const LodEntry*>(sectionData(SectionID::Lods));
+		size_t lodEntryCount = sectionSize(SectionID::Lods) / sizeof(LodEntry);
+		const auto& meshletSection = *sections[static_cast<size_t>(SectionID::Meshlets)];
+		if (meshletSection.size % sizeof(Meshlet) != 0)
+			throw std::runtime_error("Cooked mesh has an unsupported format: " + cookedPath.string());
+		size_t meshletCount = meshletSection.size / sizeof(Meshlet);
+
+		// Index ranges are in units of the subset index type
+		auto isIndexRangeValid = [&](uint32_t indexStart, uint32_t indexCount, bool use16BitIndices)
+		{
+			uint64_t indexSize = use16BitIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+			return isInRange(indexStart * indexSize, indexCount * indexSize, m_indexDataSize);
+		};
+
+		m_subsets.reserve(header.subsetCount);
+		for (uint32_t i = 0; i < header.subsetCount; ++i)
+		{
+			const auto& entry = subsetEntries[i];
+			AssimpMeshSubset subset{};
+			subset.vertexStart = entry.vertexStart;
+			subset.indexStart = entry.indexStart;
+			subset.indexCount = entry.indexCount;
+			subset.use16BitIndices = entry.use16BitIndices != 0;
+			subset.meshletStart = entry.meshletStart;
+			subset.meshletCount = entry.meshletCount;
+			subset.aabbMin = glm::vec3(entry.aabbMin[0], entry.aabbMin[1], entry.aabbMin[2]);
+			subset.aabbMax = glm::vec3(entry.aabbMax[0], entry.aabbMax[1], entry.aabbMax[2]);
+			subset.boundingSphere = glm::vec4(entry.boundingSphere[0], entry.boundingSphere[1], entry.boundingSphere[2], entry.boundingSphere[3]);
+			if (entry.vertexStart > m_vertexCount ||
+				!isIndexRangeValid(entry.indexStart, entry.indexCount, subset.use16BitIndices) ||
+				!isInRange(entry.meshletStart, entry.meshletCount, meshletCount) ||
+				!isInRange(entry.lodStart, entry.lodCount, lodEntryCount))
+				throw corrupt();
+			for (uint32_t lod = 0; lod < entry.lodCount; ++lod)
+			{
+				const auto& lodEntry = lodEntries[entry.lodStart + lod];
+				if (!isIndexRangeValid(lodEntry.indexStart, lodEntry.indexCount, subset.use16BitIndices))
+					throw corrupt();
+				subset.lods.push_back({ lodEntry.indexStart, lodEntry.indexCount });
+			}
+			subset.diffuseFilePath = getString(entry.paths.diffuse);
+			subset.specularFilePath = getString(entry.paths.specular);
+			subset.normalFilePath = getString(entry.paths.normal);
+			subset.opacityFilePath = getString(entry.paths.opacity);
+			m_subsets.push_back(subset);
+		}
+
+		const auto* meshlets = reinterpret_cast<const Meshlet*>(sectionData(SectionID::Meshlets));
+		m_meshlets.assign(meshlets, meshlets + meshletCount);
+	}
+
+	CookedMesh::~CookedMesh()
+	{
+	}
+
+	bool CookedMesh::isUpToDate(const std::filesystem::path& cookedPath, const std::filesystem::path& sourcePath, uint32_t vertexStride)
+	{
+		if (!std::filesystem::exists(cookedPath))
+			return false;
+
+		// Source may not be shipped at all, in which case the cooked file is authoritative
+		if (std::filesystem::exists(sourcePath) &&
+			std::filesystem::last_write_time(cookedPath) < std::filesystem::last_write_time(sourcePath))
+			return false;
+
+		auto header = readHeader(cookedPath);
+		return header.magic == COOKED_MESH_MAGIC &&
+			header.version == s_version &&
+			header.vertexStride == vertexStride;
+	}
+
+	void CookedMesh::write(
+		const std::filesystem::path& cookedPath,
+		const void* vertexData, uint32_t vertexStride, uint32_t vertexCount,
+		const PositionQuantization& quantization,
+		const glm::vec4& boundingSphere,
+		const std::vector<uint8_t>& indexData,
+		const std::vector<AssimpMeshSubset>& subsets,
+		const std::vector<Meshlet>& meshlets,
+		const std::vector<AssimpMaterialPaths>& materials)
+	{
+		// ======== Build string table (paths are shared heavily between subsets and materials)
+		std::string strings;
+		std::unordered_map<std::string, uint32_t> stringOffsets;
+		auto addString = [&](const std::optional<std::string>& str) -> uint32_t
+		{
+			if (!str.has_value())
+				return INVALID_STRING;
+
+			auto it = stringOffsets.find(str.value());
+			if (it != stringOffsets.cend())
+				return it->second;
+
+			uint32_t offset = static_cast<uint32_t>(strings.size());
+			strings.append(str.value());
+			strings.push_back('\0');
+			stringOffsets.insert({ str.value(), offset });
+			return offset;
+		};
+
+		std::vector<MaterialEntry> materialEntries;
+		materialEntries.reserve(materials.size());
+		for (const auto& mat : materials)
+			materialEntries.push_back({ addString(mat.diffuseFilePath), addString(mat.specularFilePath), addString(mat.normalFilePath), addString(mat.opacityFilePath) });
+
+		std::vector<SubsetEntry> subsetEntries;
+		std::vector<LodEntry> lodEntries;
+		subsetEntries.reserve(subsets.size());
+		for (const auto& subset : subsets)
+		{
+			SubsetEntry entry{};
+			entry.vertexStart = subset.vertexStart;
+			entry.indexStart = subset.indexStart;
+			entry.indexCount = subset.indexCount;
+			entry.use16BitIndices = subset.use16BitIndices ? 1 : 0;
+			entry.meshletStart = subset.meshletStart;
+			entry.meshletCount = subset.meshletCount;
+			for (int i = 0; i < 3; ++i)
+			{
+				entry.aabbMin[i] = subset.aabbMin[i];
+				entry.aabbMax[i] = subset.aabbMax[i];
+			}
+			for (int i = 0; i < 4; ++i)
+				entry.boundingSphere[i] = subset.boundingSphere[i];
+			entry.lodStart = static_cast<uint32_t>(lodEntries.size());
+			entry.lodCount = static_cast<uint32_t>(subset.lods.size());
+			for (const auto& lod : subset.lods)
+				lodEntries.push_back({ lod.indexStart, lod.indexCount });
+			entry.paths = { addString(subset.diffuseFilePath), addString(subset.specularFilePath), addString(subset.normalFilePath), addString(subset.opacityFilePath) };
+			subsetEntries.push_back(entry);
+		}
+
+		// ======== Lay out sections
+		struct SectionSource
+		{
+			SectionID id;
+			const void* data;
+			size_t size;
+		};
+
+		std::array<SectionSource, static_cast<size_t>(SectionID::Count)> sources
+		{
+			SectionSource{ SectionID::Vertices, vertexData, static_cast<size_t>(vertexStride) * vertexCount },
+			SectionSource{ SectionID::Indices, indexData.data(), indexData.size() },
+			SectionSource{ SectionID::Subsets, subsetEntries.data(), subsetEntries.size() * sizeof(SubsetEntry) },
+			SectionSource{ SectionID::Materials, materialEntries.data(), materialEntries.size() * sizeof(MaterialEntry) },
+			SectionSource{ SectionID::Strings, strings.data(), strings.size() },
+			SectionSource{ SectionID::Quantization, &quantization, sizeof(PositionQuantization) },
+			SectionSource{ SectionID::Meshlets, meshlets.data(), meshlets.size() * sizeof(Meshlet) },
+			SectionSource{ SectionID::Lods, lodEntries.data(), lodEntries.size() * sizeof(LodEntry) },
+			SectionSource{ SectionID::Bounds, &boundingSphere, sizeof(glm::vec4) }
+		};
+
+		FileHeader header{};
+		header.magic = COOKED_MESH_MAGIC;
+		header.version = s_version;
+		header.vertexStride = vertexStride;
+		header.vertexCount = vertexCount;
+		header.indexDataSize = static_cast<uint32_t>(indexData.size());
+		header.subsetCount = static_cast<uint32_t>(subsets.size());
+		header.materialCount = static_cast<uint32_t>(materials.size());
+		header.sectionCount = static_cast<uint32_t>(sources.size());
+
+		std::vector<SectionEntry> sectionTable;
+		sectionTable.reserve(sources.size());
+		uint64_t offset = getAlignedSize(static_cast<uint32_t>(sizeof(FileHeader) + sources.size() * sizeof(SectionEntry)), SECTION_ALIGNMENT);
+		for (const auto& source : sources)
+		{
+			sectionTable.push_back({ static_cast<uint32_t>(source.id), 0, offset, source.size });
+			offset += source.size;
+			offset += (SECTION_ALIGNMENT - offset % SECTION_ALIGNMENT) % SECTION_ALIGNMENT;
+		}
+
+		// ======== Write to a temporary file first so that a failed cook never leaves a half written file that looks valid
+		auto tmpPath = cookedPath;
+		tmpPath += ".tmp";
+		{
+			std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+				throw std::runtime_error("Could not open cooked mesh for writing: " + cookedPath.string());
+
+			const char zeros[SECTION_ALIGNMENT]{};
+			auto padTo = [&](uint64_t target)
+			{
+				uint64_t current = static_cast<uint64_t>(file.tellp());
+				if (target > current)
+					file.write(zeros, static_cast<std::streamsize>(target - current));
+			};
+
+			file.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+			file.write(reinterpret_cast<const char*>(sectionTable.data()), sectionTable.size() * sizeof(SectionEntry));
+
+			for (size_t i = 0; i < sources.size(); ++i)
+			{
+				padTo(sectionTable[i].offset);
+				if (sources[i].size > 0)
+					file.write(reinterpret_cast<const char*>(sources[i].data), static_cast<std::streamsize>(sources[i].size));
+			}
+
+			if (!file.good())
+				throw std::runtime_error("Failed writing cooked mesh: " + cookedPath.string());
+		}
+
+		std::filesystem::rename(tmpPath, cookedPath);
+	}
+
+	const void* CookedMesh::getVertexData() const
+	{
+		return m_vertexData;
+	}
+
+	size_t CookedMesh::getVertexDataSize() const
+	{
+		return m_vertexDataSize;
+	}
+
+	uint32_t CookedMesh::getVertexStride() const
+	{
+		return m_vertexStride;
+	}
+
+	uint32_t CookedMesh::getVertexCount() const
+	{
+		return m_vertexCount;
+	}
+
+	const PositionQuantization& CookedMesh::getPositionQuantization() const
+	{
+		return m_quantization;
+	}
+
+	const glm::vec4& CookedMesh::getBoundingSphere() const
+	{
+		return m_boundingSphere;
+	}
+
+	const void* CookedMesh::getIndexData() const
+	{
+		return m_indexData;
+	}
+
+	size_t CookedMesh::getIndexDataSize() const
+	{
+		return m_indexDataSize;
+	}
+
+	const std::vector<AssimpMeshSubset>& CookedMesh::getSubsets() const
+	{
+		return m_subsets;
+	}
+
+	const std::vector<Meshlet>& CookedMesh::getMeshlets() const
+	{
+		return m_meshlets;
+	}
+
+	const std::vector<AssimpMaterialPaths>& CookedMesh::getMaterials() const
+	{
+		return m_materials;
+	}
+
+}
@@ -0,0 +1,492 @@
+#include "pch.h"
+#include "CookedTexture.h"
+#include "ResourceTypes.h"
+#include "ThreadPool.h"
+
+#include <cstring>
+
+namespace Nagi
+{
+	// KTX2 layout (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html):
+	// [Header][Index][Level index * levelCount][Data format descriptor][Key/value data][Mip levels, smallest first]
+	static constexpr std::array<uint8_t, 12> KTX2_IDENTIFIER = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+	static constexpr uint32_t LEVEL_ALIGNMENT = 16;		// lcm(block size, 4)
+
+	// Our only key/value entry, the 8 byte content hash (getContentHash), written at cook time so that loading never hashes the levels
+	static constexpr std::string_view CONTENT_HASH_KEY = "NagiContentHash";
+
+	// Khronos data format descriptor values (khr_df.h)
+	static constexpr uint32_t KHR_DF_VERSION = 2;
+	static constexpr uint32_t KHR_DF_MODEL_BC4 = 131;
+	static constexpr uint32_t KHR_DF_MODEL_BC5 = 132;
+	static constexpr uint32_t KHR_DF_MODEL_BC7 = 134;
+	static constexpr uint32_t KHR_DF_PRIMARIES_BT709 = 1;
+	static constexpr uint32_t KHR_DF_TRANSFER_LINEAR = 1;
+	static constexpr uint32_t KHR_DF_TRANSFER_SRGB = 2;
+
+	struct Ktx2Header
+	{
+		uint8_t identifier[12];
+		uint32_t vkFormat;
+		uint32_t typeSize;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t layerCount;
+		uint32_t faceCount;
+		uint32_t levelCount;
+		uint32_t supercompressionScheme;
+
+		// Index
+		uint32_t dfdByteOffset;
+		uint32_t dfdByteLength;
+		uint32_t kvdByteOffset;
+		uint32_t kvdByteLength;
+		uint64_t sgdByteOffset;
+		uint64_t sgdByteLength;
+	};
+	static_assert(sizeof(Ktx2Header) == 80, "KTX2 header must be tightly packed");
+
+	struct Ktx2LevelIndex
+	{
+		uint64_t byteOffset;
+		uint64_t byteLength;
+		uint64_t uncompressedByteLength;
+	};
+
+	// Basic descriptor block with one sample per channel (BC5 has two)
+	struct Ktx2Sample
+	{
+		uint32_t bitOffsetLengthChannel;
+		uint32_t samplePosition;
+		uint32_t sampleLower;
+		uint32_t sampleUpper;
+	};
+
+	static bool isSupportedFormat(uint32_t format)
+	{
+		auto vkFormat = static_cast<vk::Format>(format);
+		return vkFormat == vk::Format::eBc7SrgbBlock || vkFormat == vk::Format::eBc4UnormBlock || vkFormat == vk::Format::eBc5UnormBlock;
+	}
+
+	static Ktx2Header readHeader(const std::filesystem::path& cookedPath)
+	{
+		Ktx2Header header{};
+		std::ifstream file(cookedPath, std::ios::binary);
+		if (file.is_open())
+			file.read(reinterpret_cast<char*>(&header), sizeof(Ktx2Header));
+		return header;
+	}
+
+	// Levels in base level order, hashed smallest first (file order) with the format as the seed
+	static uint64_t hashLevels(vk::Format format, const std::vector<std::span<const uint8_t>>& levels)
+	{
+		uint64_t hash = static_cast<uint64_t>(format);
+		for (size_t i = levels.size(); i-- > 0;)
+			hash = hashBytes(levels[i].data(), levels[i].size(), hash);
+		return hash;
+	}
+
+	// Entries are [uint32 keyAndValueByteLength][key][NUL][value], each padded to 4 bytes
+	static std::vector<uint8_t> buildKeyValueData(uint64_t contentHash)
+	{
+		uint32_t keyAndValueByteLength = static_cast<uint32_t>(CONTENT_HASH_KEY.size() + 1 + sizeof(contentHash));
+		std::vector<uint8_t> kvd(getAlignedSize(static_cast<uint32_t>(sizeof(uint32_t)) + keyAndValueByteLength, 4), 0);
+		std::memcpy(kvd.data(), &keyAndValueByteLength, sizeof(uint32_t));
+		std::memcpy(kvd.data() + sizeof(uint32_t), CONTENT_HASH_KEY.data(), CONTENT_HASH_KEY.size());
+		std::memcpy(kvd.data() + sizeof(uint32_t) + CONTENT_HASH_KEY.size() + 1, &contentHash, sizeof(contentHash));
+		return kvd;
+	}
+
+	static std::optional<uint64_t> findContentHash(const uint8_t* kvd, size_t kvdSize)
+	{
+		size_t offset = 0;
+		while (offset + sizeof(uint32_t) <= kvdSize)
+		{
+			uint32_t keyAndValueByteLength;
+			std::memcpy(&keyAndValueByteLength, kvd + offset, sizeof(uint32_t));
+			offset += sizeof(uint32_t);
+			if (keyAndValueByteLength > kvdSize - offset)
+				return std::nullopt;
+
+			const uint8_t* entry = kvd + offset;
+			if (keyAndValueByteLength == CONTENT_HASH_KEY.size() + 1 + sizeof(uint64_t) &&
+				std::memcmp(entry, CONTENT_HASH_KEY.data(), CONTENT_HASH_KEY.size()) == 0 && entry[CONTENT_HASH_KEY.size()] == 0)
+			{
+				uint64_t contentHash;
+				std::memcpy(&contentHash, entry + CONTENT_HASH_KEY.size() + 1, sizeof(contentHash));
+				return contentHash;
+			}
+			offset += getAlignedSize(keyAndValueByteLength, 4);
+		}
+		return std::nullopt;
+	}
+
+	static std::vector<uint32_t> buildDataFormatDescriptor(vk::Format format)
+	{
+		uint32_t model = KHR_DF_MODEL_BC7;
+		uint32_t transfer = KHR_DF_TRANSFER_LINEAR;
+		uint32_t blockSize = 16;
+		std::vector<Ktx2Sample> samples;
+		switch (format)
+		{
+		case vk::Format::eBc7SrgbBlock:
+			transfer = KHR_DF_TRANSFER_SRGB;
+			samples.push_back({ 127u << 16, 0, 0, ~0u });
+			break;
+		case vk::Format::eBc4UnormBlock:
+			model = KHR_DF_MODEL_BC4;
+			blockSize = 8;
+			samples.push_back({ 63u << 16, 0, 0, ~0u });
+			break;
+		case vk::Format::eBc5UnormBlock:
+			model = KHR_DF_MODEL_BC5;
+			samples.push_back({ 63u << 16, 0, 0, ~0u });					// Red
+			samples.push_back({ 64u | (63u << 16) | (1u << 24), 0, 0, ~0u });	// Green
+			break;
+		default:
+			throw std::runtime_error("Unsupported cooked texture format");
+		}
+
+		uint32_t blockByteSize = 24 + static_cast<uint32_t>(samples.size() * sizeof(Ktx2Sample));
+		std::vector<uint32_t> dfd =
+		{
+			4 + blockByteSize,										// Total size
+			0,														// Vendor Khronos, basic descriptor type
+			KHR_DF_VERSION | (blockByteSize << 16),
+			model | (KHR_DF_PRIMARIES_BT709 << 8) | (transfer << 16),
+			3 | (3 << 8),											// 4x4 texel blocks (dimension - 1)
+			blockSize,												// Bytes in plane 0
+			0
+		};
+		for (const auto& sample : samples)
+			dfd.insert(dfd.end(), { sample.bitOffsetLengthChannel, sample.samplePosition, sample.sampleLower, sample.sampleUpper });
+		return dfd;
+	}
+
+	CookedTexture::CookedTexture(const std::filesystem::path& cookedPath) :
+		m_file(std::make_unique<MappedFile>(cookedPath))
+	{
+		const uint8_t* base = m_file->getData();
+		size_t fileSize = m_file->getSize();
+
+		if (fileSize < sizeof(Ktx2Header))
+			throw std::runtime_error("Cooked texture is truncated: " + cookedPath.string());
+
+		const auto& header = *reinterpret_cast<const Ktx2Header*>(base);
+		if (!std::equal(KTX2_IDENTIFIER.cbegin(), KTX2_IDENTIFIER.cend(), header.identifier) ||
+			!isSupportedFormat(header.vkFormat) ||
+			header.supercompressionScheme != 0 ||
+			header.pixelDepth != 0 || header.layerCount > 1 || header.levelCount == 0 ||
+			!(header.faceCount == 1 || (header.faceCount == 6 && header.pixelWidth == header.pixelHeight)))
+			throw std::runtime_error("Cooked texture has an unsupported format: " + cookedPath.string());
+
+		if (sizeof(Ktx2Header) + header.levelCount * sizeof(Ktx2LevelIndex) > fileSize)
+			throw std::runtime_error("Cooked texture is truncated: " + cookedPath.string());
+
+		m_format = static_cast<vk::Format>(header.vkFormat);
+		m_width = header.pixelWidth;
+		m_height = header.pixelHeight;
+		m_faceCount = header.faceCount;
+
+		// Levels are written back to back, the smallest one first
+		const auto* levelIndex = reinterpret_cast<const Ktx2LevelIndex*>(base + sizeof(Ktx2Header));
+		uint64_t dataStart = UINT64_MAX;
+		uint64_t dataEnd = 0;
+		for (uint32_t i = 0; i < header.levelCount; ++i)
+		{
+			if (levelIndex[i].byteOffset + levelIndex[i].byteLength > fileSize)
+				throw std::runtime_error("Cooked texture is truncated: " + cookedPath.string());
+			dataStart = std::min(dataStart, levelIndex[i].byteOffset);
+			dataEnd = std::max(dataEnd, levelIndex[i].byteOffset + levelIndex[i].byteLength);
+		}
+
+		m_data = base + dataStart;
+		m_dataSize = static_cast<size_t>(dataEnd - dataStart);
+		m_levels.reserve(header.levelCount);
+		for (uint32_t i = 0; i < header.levelCount; ++i)
+			m_levels.push_back({ static_cast<size_t>(levelIndex[i].byteOffset - dataStart), static_cast<size_t>(levelIndex[i].byteLength) });
+
+		if (static_cast<uint64_t>(header.kvdByteOffset) + header.kvdByteLength > fileSize)
+			throw std::runtime_error("Cooked texture is truncated: " + cookedPath.string());
+
+		// KTX2 files that did not come from our cooker have no hash, those are hashed here once
+		auto contentHash = findContentHash(base + header.kvdByteOffset, header.kvdByteLength);
+		if (!contentHash)
+		{
+			std::vector<std::span<const uint8_t>> levels;
+			for (const auto& level : m_levels)
+				levels.push_back({ m_data + level.offset, level.size });
+			contentHash = hashLevels(m_format, levels);
+		}
+		m_contentHash = *contentHash;
+	}
+
+	CookedTexture::~CookedTexture()
+	{
+	}
+
+	std::filesystem::path CookedTexture::getCookedPath(const TextureSource& source)
+	{
+		auto cookedPath = source.path;
+		switch (source.usage)
+		{
+		case TextureUsage::Color:	cookedPath.replace_extension(".bc7"); break;
+		case TextureUsage::Mask:	cookedPath.replace_extension(".bc4"); break;
+		case TextureUsage::Normal:	cookedPath.replace_extension(".bc5"); break;
+		case TextureUsage::MaskPair:
+			cookedPath.replace_filename(source.path.stem().string() + "+" + source.secondaryPath.stem().string() + ".bc5");
+			break;
+		}
+		cookedPath += s_fileExtension;
+		return cookedPath;
+	}
+
+	vk::Format CookedTexture::getFormat(TextureUsage usage)
+	{
+		switch (usage)
+		{
+		case TextureUsage::Mask:	return vk::Format::eBc4UnormBlock;
+		case TextureUsage::Normal:
+		case TextureUsage::MaskPair:	return vk::Format::eBc5UnormBlock;
+		default:					return vk::Format::eBc7SrgbBlock;
+		}
+	}
+
+	bool CookedTexture::isUpToDate(const std::filesystem::path& cookedPath, const TextureSource& source)
+	{
+		if (!std::filesystem::exists(cookedPath))
+			return false;
+
+		// Sources may not be shipped at all, in which case the cooked file is authoritative
+		auto cookedTime = std::filesystem::last_write_time(cookedPath);
+		for (const auto& sourcePath : { source.path, source.secondaryPath })
+			if (!sourcePath.empty() && std::filesystem::exists(sourcePath) && cookedTime < std::filesystem::last_write_time(sourcePath))
+				return false;
+
+		// Files cooked before the content hash was stored have no key/value data, recooking adds it
+		auto header = readHeader(cookedPath);
+		return std::equal(KTX2_IDENTIFIER.cbegin(), KTX2_IDENTIFIER.cend(), header.identifier) &&
+			header.vkFormat == static_cast<uint32_t>(getFormat(source.usage)) &&
+			header.kvdByteLength != 0;
+	}
+
+	void CookedTexture::cook(const TextureSource& source, const std::filesystem::path& cookedPath)
+	{
+		auto image = ImageData::fromFile(source.path.string());
+		if (source.usage != TextureUsage::MaskPair)
+		{
+			auto mips = compressTexture(image.getPixels(), image.getWidth(), image.getHeight(), source.usage);
+			write(cookedPath, getFormat(source.usage), mips);
+			return;
+		}
+
+		// Pack the two masks into R and G at the larger of the two sizes (point sampled if they differ)
+		auto secondary = ImageData::fromFile(source.secondaryPath.string());
+		uint32_t width = std::max(image.getWidth(), secondary.getWidth());
+		uint32_t height = std::max(image.getHeight(), secondary.getHeight());
+		uint32_t primaryChannel = getMaskChannel(image.getPixels(), image.getWidth(), image.getHeight());
+		uint32_t secondaryChannel = getMaskChannel(secondary.getPixels(), secondary.getWidth(), secondary.getHeight());
+
+		auto sampleMask = [width, height](const ImageData& mask, uint32_t channel, uint32_t x, uint32_t y)
+		{
+			uint32_t maskX = static_cast<uint32_t>(static_cast<uint64_t>(x) * mask.getWidth() / width);
+			uint32_t maskY = static_cast<uint32_t>(static_cast<uint64_t>(y) * mask.getHeight() / height);
+			return mask.getPixels()[(static_cast<size_t>(maskY) * mask.getWidth() + maskX) * 4 + channel];
+		};
+
+		std::vector<uint8_t> packed(static_cast<size_t>(width) * height * 4);
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				uint8_t* dst = packed.data() + (static_cast<size_t>(y) * width + x) * 4;
+				dst[0] = sampleMask(image, primaryChannel, x, y);
+				dst[1] = sampleMask(secondary, secondaryChannel, x, y);
+				dst[2] = 0;
+				dst[3] = 255;
+			}
+		}
+
+		auto mips = compressTexture(packed.data(), width, height, source.usage);
+		write(cookedPath, getFormat(source.usage), mips);
+	}
+
+	std::filesystem::path CookedTexture::getCubeCookedPath(const std::filesystem::path& directory)
+	{
+		auto cookedPath = directory / "cube.bc7";
+		cookedPath += s_fileExtension;
+		return cookedPath;
+	}
+
+	bool CookedTexture::isCubeUpToDate(const std::filesystem::path& cookedPath, const std::array<std::filesystem::path, 6>& facePaths)
+	{
+		for (const auto& facePath : facePaths)
+			if (!isUpToDate(cookedPath, { facePath, {}, TextureUsage::Color }))
+				return false;
+
+		return readHeader(cookedPath).faceCount == 6;
+	}
+
+	void CookedTexture::cookCube(ThreadPool& pool, const std::array<std::filesystem::path, 6>& facePaths, const std::filesystem::path& cookedPath)
+	{
+		std::vector<std::future<std::vector<CompressedMip>>> compressions;
+		compressions.reserve(facePaths.size());
+		for (const auto& facePath : facePaths)
+		{
+			compressions.push_back(pool.submit([facePath]()
+				{
+					auto image = ImageData::fromFile(facePath.string());
+					if (image.getWidth() != image.getHeight())
+						throw std::runtime_error("Cube faces have to be square: " + facePath.string());
+					return compressTexture(image.getPixels(), image.getWidth(), image.getHeight(), TextureUsage::Color);
+				}));
+		}
+
+		// Interleave the faces per level
+		std::vector<CompressedMip> mips;
+		for (auto& compression : compressions)
+		{
+			auto faceMips = compression.get();
+			if (mips.empty())
+			{
+				mips = std::move(faceMips);
+				continue;
+			}
+
+			if (faceMips.size() != mips.size() || faceMips.front().width != mips.front().width)
+				throw std::runtime_error("Cube faces differ in size: " + cookedPath.string());
+			for (size_t level = 0; level < mips.size(); ++level)
+				mips[level].data.insert(mips[level].data.end(), faceMips[level].data.cbegin(), faceMips[level].data.cend());
+		}
+
+		write(cookedPath, getFormat(TextureUsage::Color), mips, static_cast<uint32_t>(facePaths.size()));
+	}
+
+	void CookedTexture::write(const std::filesystem::path& cookedPath, vk::Format format, const std::vector<CompressedMip>& mips, uint32_t faceCount)
+	{
+		if (mips.empty())
+			throw std::runtime_error("Cooked texture has no levels: " + cookedPath.string());
+
+		auto dfd = buildDataFormatDescriptor(format);
+		uint32_t levelCount = static_cast<uint32_t>(mips.size());
+
+		std::vector<std::span<const uint8_t>> levels;
+		for (const auto& mip : mips)
+			levels.push_back(mip.data);
+		auto kvd = buildKeyValueData(hashLevels(format, levels));
+
+		Ktx2Header header{};
+		std::copy(KTX2_IDENTIFIER.cbegin(), KTX2_IDENTIFIER.cend(), header.identifier);
+		header.vkFormat = static_cast<uint32_t>(format);
+		header.typeSize = 1;
+		header.pixelWidth = mips.front().width;
+		header.pixelHeight = mips.front().height;
+		header.faceCount = faceCount;
+		header.levelCount = levelCount;
+		header.dfdByteOffset = static_cast<uint32_t>(sizeof(Ktx2Header) + levelCount * sizeof(Ktx2LevelIndex));
+		header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+		header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+		header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+
+		// Smallest level goes first in the file, the level index is still ordered from the base level
+		std::vector<Ktx2LevelIndex> levelIndex(levelCount);
+		uint64_t offset = getAlignedSize(header.kvdByteOffset + header.kvdByteLength, LEVEL_ALIGNMENT);
+		for (uint32_t i = levelCount; i-- > 0;)
+		{
+			levelIndex[i] = { offset, mips[i].data.size(), mips[i].data.size() };
+			offset += mips[i].data.size();
+			offset += (LEVEL_ALIGNMENT - offset % LEVEL_ALIGNMENT) % LEVEL_ALIGNMENT;
+		}
+
+		// ======== Write to a temporary file first so that a failed cook never leaves a half written file that looks valid
+		auto tmpPath = cookedPath;
+		tmpPath += ".tmp";
+		{
+			std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+				throw std::runtime_error("Could not open cooked texture for writing: " + cookedPath.string());
+
+			const char zeros[LEVEL_ALIGNMENT]{};
+			auto padTo = [&](uint64_t target)
+			{
+				uint64_t current = static_cast<uint64_t>(file.tellp());
+				if (target > current)
+					file.write(zeros, static_cast<std::streamsize>(target - current));
+			};
+
+			file.write(reinterpret_cast<const char*>(&header), sizeof(Ktx2Header));
+			file.write(reinterpret_cast<const char*>(levelIndex.data()), levelIndex.size() * sizeof(Ktx2LevelIndex));
+			file.write(reinterpret_cast<const char*>(dfd.data()), dfd.size() * sizeof(uint32_t));
+			file.write(reinterpret_cast<const char*>(kvd.data()), kvd.size());
+
+			for (uint32_t i = levelCount; i-- > 0;)
+			{
+				padTo(levelIndex[i].byteOffset);
+				file.write(reinterpret_cast<const char*>(mips[i].data.data()), static_cast<std::streamsize>(mips[i].data.size()));
+			}
+
+			if (!file.good())
+				throw std::runtime_error("Failed writing cooked texture: " + cookedPath.string());
+		}
+
+		std::filesystem::rename(tmpPath, cookedPath);
+	}
+
+	vk::Format CookedTexture::getFormat() const
+	{
+		return m_format;
+	}
+
+	uint32_t CookedTexture::getWidth() const
+	{
+		return m_width;
+	}
+
+	uint32_t CookedTexture::getHeight() const
+	{
+		return m_height;
+	}
+
+	uint32_t CookedTexture::getLevelCount() const
+	{
+		return static_cast<uint32_t>(m_levels.size());
+	}
+
+	uint32_t CookedTexture::getFaceCount() const
+	{
+		return m_faceCount;
+	}
+
+	uint64_t CookedTexture::getContentHash() const
+	{
+		return m_contentHash;
+	}
+
+	const uint8_t* CookedTexture::getData() const
+	{
+		return m_data;
+	}
+
+	size_t CookedTexture::getDataSize() const
+	{
+		return m_dataSize;
+	}
+
+	size_t CookedTexture::getLevelOffset(uint32_t level) const
+	{
+		return m_levels[level].offset;
+	}
+
+	size_t CookedTexture::getLevelSize(uint32_t level) const
+	{
+		return m_levels[level].size;
+	}
+
+	void CookedTexture::prefetch(uint32_t firstLevel) const
+	{
+		size_t dataOffset = static_cast<size_t>(m_data - m_file->getData());
+		m_file->prefetch(dataOffset, getLevelOffset(firstLevel) + getLevelSize(firstLevel));
+	}
+
+}
@@ -0,0 +1,96 @@
+#include "pch.h"
+#include "DrawSortKey.h"
+
+#include <numeric>
+
+namespace Nagi
+{
+	static uint64_t getField(uint64_t key, uint32_t shift, uint32_t bits)
+	{
+		return (key >> shift) & ((1ull << bits) - 1);
+	}
+
+	uint64_t DrawSortKey::make(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, uint32_t depth)
+	{
+		if (pass >= (1u << s_passBits) || pipeline >= (1u << s_pipelineBits) || material >= (1u << s_materialBits) ||
+			mesh >= (1u << s_meshBits) || depth >= (1u << s_depthBits))
+			throw std::runtime_error("Draw sort key field out of range");
+
+		return (static_cast<uint64_t>(pass) << s_passShift) |
+			(static_cast<uint64_t>(pipeline) << s_pipelineShift) |
+			(static_cast<uint64_t>(material) << s_materialShift) |
+			(static_cast<uint64_t>(mesh) << s_meshShift) |
+			(static_cast<uint64_t>(depth) << s_depthShift);
+	}
+
+	uint32_t DrawSortKey::quantizeDepth(float normalizedDepth)
+	{
+		constexpr float maxDepth = static_cast<float>((1u << s_depthBits) - 1);
+		return static_cast<uint32_t>(std::clamp(normalizedDepth, 0.f, 1.f) * maxDepth + 0.5f);
+	}
+
+	uint32_t DrawSortKey::getPass(uint64_t key)
+	{
+		return static_cast<uint32_t>(getField(key, s_passShift, s_passBits));
+	}
+
+	uint32_t DrawSortKey::getPipeline(uint64_t key)
+	{
+		return static_cast<uint32_t>(getField(key, s_pipelineShift, s_pipelineBits));
+	}
+
+	uint32_t DrawSortKey::getMaterial(uint64_t key)
+	{
+		return static_cast<uint32_t>(getField(key, s_materialShift, s_materialBits));
+	}
+
+	uint32_t DrawSortKey::getMesh(uint64_t key)
+	{
+		return static_cast<uint32_t>(getField(key, s_meshShift, s_meshBits));
+	}
+
+	uint32_t DrawSortKey::getDepth(uint64_t key)
+	{
+		return static_cast<uint32_t>(getField(key, s_depthShift, s_depthBits));
+	}
+
+	void radixSort(const std::vector<uint64_t>& keys, std::vector<uint32_t>& order)
+	{
+		constexpr uint32_t byteCount = sizeof(uint64_t);
+		const size_t count = keys.size();
+
+		order.resize(count);
+		std::iota(order.begin(), order.end(), 0u);
+		if (count < 2)
+			return;
+
+		std::vector<std::array<uint32_t, 256>> histograms(byteCount, std::array<uint32_t, 256>{});
+		for (auto key : keys)
+		{
+			for (uint32_t byte = 0; byte < byteCount; ++byte)
+				++histograms[byte][(key >> (byte * 8)) & 0xff];
+		}
+
+		std::vector<uint32_t> scratch(count);
+		for (uint32_t byte = 0; byte < byteCount; ++byte)
+		{
+			auto& histogram = histograms[byte];
+			if (histogram[(keys[0] >> (byte * 8)) & 0xff] == count)
+				continue;
+
+			// Histogram to the first output slot of every byte value
+			uint32_t offset = 0;
+			for (auto& bucket : histogram)
+			{
+				uint32_t bucketSize = bucket;
+				bucket = offset;
+				offset += bucketSize;
+			}
+
+			// In order scatter keeps equal bytes in the order of the previous pass (stable)
+			for (auto index : order)
+				scratch[histogram[(keys[index] >> (byte * 8)) & 0xff]++] = index;
+			order.swap(scratch);
+		}
+	}
+}
@@ -0,0 +1,30 @@
+#include "pch.h"
+#include "Frustum.h"
+
+namespace Nagi
+{
+	Frustum Frustum::fromViewProjection(const glm::mat4& viewProj)
+	{
+		// Rows of the matrix (glm is column major)
+		auto row = [&viewProj](int i) { return glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]); };
+
+		Frustum frustum;
+		frustum.m_planes = {
+			row(3) + row(0),		// Left
+			row(3) - row(0),		// Right
+			row(3) + row(1),		// Bottom
+			row(3) - row(1),		// Top
+			row(2),					// Near (z >= 0)
+			row(3) - row(2)			// Far
+		};
+
+		for (auto& plane : frustum.m_planes)
+			plane /= glm::length(glm::vec3(plane));
+		return frustum;
+	}
+
+	const std::array<glm::vec4, 6>& Frustum::getPlanes() const
+	{
+		return m_planes;
+	}
+}
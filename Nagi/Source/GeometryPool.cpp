@@ -0,0 +1,174 @@
+#include "pch.h"
+#include "GeometryPool.h"
+#include "ResourceTypes.h"
+
+namespace Nagi
+{
+	FreeListAllocator::FreeListAllocator(vk::DeviceSize size) :
+		m_size(size)
+	{
+		if (size > 0)
+			m_freeRanges.insert({ 0, size });
+	}
+
+	std::optional<vk::DeviceSize> FreeListAllocator::allocate(vk::DeviceSize size, vk::DeviceSize alignment)
+	{
+		assert(size > 0 && alignment > 0);
+
+		for (auto it = m_freeRanges.begin(); it != m_freeRanges.end(); ++it)
+		{
+			vk::DeviceSize begin = it->first;
+			vk::DeviceSize end = begin + it->second;
+			vk::DeviceSize offset = (begin + alignment - 1) / alignment * alignment;
+			if (offset + size > end)
+				continue;
+
+			// Whatever is left on either side of the allocation stays free
+			m_freeRanges.erase(it);
+			if (offset > begin)
+				m_freeRanges.insert({ begin, offset - begin });
+			if (offset + size < end)
+				m_freeRanges.insert({ offset + size, end - (offset + size) });
+
+			m_usedSize += size;
+			return offset;
+		}
+
+		return std::nullopt;
+	}
+
+	void FreeListAllocator::free(vk::DeviceSize offset, vk::DeviceSize size)
+	{
+		assert(size > 0 && offset + size <= m_size && size <= m_usedSize);
+		m_usedSize -= size;
+
+		auto next = m_freeRanges.lower_bound(offset);
+		assert(next == m_freeRanges.end() || offset + size <= next->first);
+
+		// Merge with the free range right behind it
+		if (next != m_freeRanges.end() && offset + size == next->first)
+		{
+			size += next->second;
+			next = m_freeRanges.erase(next);
+		}
+
+		// and with the one right in front of it
+		if (next != m_freeRanges.begin())
+		{
+			auto prev = std::prev(next);
+			assert(prev->first + prev->second <= offset);
+			if (prev->first + prev->second == offset)
+			{
+				prev->second += size;
+				return;
+			}
+		}
+
+		m_freeRanges.insert(next, { offset, size });
+	}
+
+	vk::DeviceSize FreeListAllocator::getSize() const
+	{
+		return m_size;
+	}
+
+	vk::DeviceSize FreeListAllocator::getUsedSize() const
+	{
+		return m_usedSize;
+	}
+
+	size_t FreeListAllocator::getFreeRangeCount() const
+	{
+		return m_freeRanges.size();
+	}
+
+	uint32_t GeometryRange::getBaseVertex() const
+	{
+		return vertexStride > 0 ? static_cast<uint32_t>(vertexOffset / vertexStride) : 0;
+	}
+
+	uint32_t GeometryRange::getBaseIndex(vk::IndexType indexType) const
+	{
+		return static_cast<uint32_t>(indexOffset / (indexType == vk::IndexType::eUint16 ? sizeof(uint16_t) : sizeof(uint32_t)));
+	}
+
+	GeometryPool::GeometryPool(VulkanContext& context, vk::DeviceSize vertexCapacity, vk::DeviceSize indexCapacity) :
+		m_context(context),
+		m_vertexAllocator(vertexCapacity),
+		m_indexAllocator(indexCapacity)
+	{
+		m_vertexBuffer = Buffer::createDeviceLocal(m_context, vertexCapacity, vk::BufferUsageFlagBits::eVertexBuffer);
+		m_indexBuffer = Buffer::createDeviceLocal(m_context, indexCapacity, vk::BufferUsageFlagBits::eIndexBuffer);
+	}
+
+	GeometryPool::~GeometryPool()
+	{
+	}
+
+	GeometryRange GeometryPool::allocate(vk::DeviceSize vertexSize, uint32_t vertexStride, vk::DeviceSize indexSize)
+	{
+		assert(vertexStride > 0);
+		reclaimFreed();
+
+		// Empty ranges still get a distinct offset, zero sized allocations are not tracked
+		GeometryRange range;
+		range.vertexStride = vertexStride;
+		range.vertexSize = std::max<vk::DeviceSize>(vertexSize, vertexStride);
+		range.indexSize = std::max<vk::DeviceSize>(indexSize, sizeof(uint32_t));
+
+		auto vertexOffset = m_vertexAllocator.allocate(range.vertexSize, vertexStride);
+		if (!vertexOffset)
+			throw std::runtime_error("Geometry pool is out of vertex buffer space");
+
+		auto indexOffset = m_indexAllocator.allocate(range.indexSize, sizeof(uint32_t));
+		if (!indexOffset)
+		{
+			m_vertexAllocator.free(*vertexOffset, range.vertexSize);
+			throw std::runtime_error("Geometry pool is out of index buffer space");
+		}
+
+		range.vertexOffset = *vertexOffset;
+		range.indexOffset = *indexOffset;
+		return range;
+	}
+
+	void GeometryPool::free(const GeometryRange& range)
+	{
+		m_pendingFrees.push_back(range);
+	}
+
+	const vk::Buffer& GeometryPool::getVertexBuffer() const
+	{
+		return m_vertexBuffer->getBuffer();
+	}
+
+	const vk::Buffer& GeometryPool::getIndexBuffer() const
+	{
+		return m_indexBuffer->getBuffer();
+	}
+
+	const FreeListAllocator& GeometryPool::getVertexAllocator() const
+	{
+		return m_vertexAllocator;
+	}
+
+	const FreeListAllocator& GeometryPool::getIndexAllocator() const
+	{
+		return m_indexAllocator;
+	}
+
+	void GeometryPool::reclaimFreed()
+	{
+		if (m_pendingFrees.empty())
+			return;
+
+		// New uploads into the ranges must not overwrite what submitted frames are still drawing
+		m_context.waitForFramesInFlight();
+		for (const auto& range : m_pendingFrees)
+		{
+			m_vertexAllocator.free(range.vertexOffset, range.vertexSize);
+			m_indexAllocator.free(range.indexOffset, range.indexSize);
+		}
+		m_pendingFrees.clear();
+	}
+}
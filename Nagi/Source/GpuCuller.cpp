@@ -0,0 +1,474 @@
+#include "pch.h"
+#include "GpuCuller.h"
+#include "UploadBatch.h"
+#include "Frustum.h"
+#include "DrawSortKey.h"
+#include "Utilities.h"
+
+namespace Nagi
+{
+	// The shader keeps the per LOD index ranges in a uvec4
+	static_assert(Mesh::s_maxLods == 4);
+	static_assert(sizeof(DrawRecordData) == 160);
+
+	GpuCuller::GpuCuller(VulkanContext& context, const GeometryPool& geometryPool, const std::array<float, Mesh::s_maxLods - 1>& lodScreenSizes, float minScreenSize) :
+		m_context(context),
+		m_geometryPool(geometryPool),
+		m_compactCommands(context.hasDrawIndirectCount())
+	{
+		auto dev = m_context.getDevice();
+
+		// Set 0 of the culling pass
+		std::vector<vk::DescriptorSetLayoutBinding> cullBindings{
+			vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),		// Draw records
+			vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),		// Model matrices
+			vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),		// Indirect commands
+			vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),		// Draw count per batch
+			vk::DescriptorSetLayoutBinding(4, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),		// Material coverage
+			vk::DescriptorSetLayoutBinding(5, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),		// Culling result per record
+			vk::DescriptorSetLayoutBinding(6, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),		// Visible records per workgroup
+			vk::DescriptorSetLayoutBinding(7, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute)		// Stats
+		};
+		m_cullSetLayout = dev.createDescriptorSetLayoutUnique(vk::DescriptorSetLayoutCreateInfo({}, cullBindings));
+
+		// Set 3 of the graphics pipelines
+		std::vector<vk::DescriptorSetLayoutBinding> drawBindings{
+			vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex),		// Model matrices
+			vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex)		// Draw records
+		};
+		m_drawSetLayout = dev.createDescriptorSetLayoutUnique(vk::DescriptorSetLayoutCreateInfo({}, drawBindings));
+
+		// Both sets for every frame in flight, reset on rebuild
+		uint32_t frameCount = VulkanContext::getMaxFramesInFlight();
+		std::array<vk::DescriptorPoolSize, 1> poolSizes{
+			vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, static_cast<uint32_t>(cullBindings.size() + drawBindings.size()) * frameCount)
+		};
+		m_descriptorPool = dev.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo({}, 2 * frameCount, poolSizes));
+
+		createPipeline(lodScreenSizes, minScreenSize);
+	}
+
+	GpuCuller::~GpuCuller()
+	{
+	}
+
+	vk::DescriptorSetLayout GpuCuller::getDrawSetLayout() const
+	{
+		return m_drawSetLayout.get();
+	}
+
+	void GpuCuller::build(UploadBatch& batch, Scene& scene, const glm::vec3& viewPosition)
+	{
+		// Buffers and sets of the previous build may still be used by frames in flight
+		if (m_recordBuffer)
+			m_context.waitForFramesInFlight();
+
+		m_scene = &scene;
+		m_entities.clear();
+		m_objectIndices.clear();
+		m_batches.clear();
+		m_materialCount = 0;
+
+		// ======== One record per render unit of every entity, and what its draw has to be sorted by
+		// Index type and pipeline are the state a batch binds, meshes are told apart by their range in the geometry pool
+		using PipelineState = std::pair<vk::IndexType, vk::Pipeline>;
+		using MeshRange = std::tuple<vk::IndexType, uint32_t, int32_t>;
+		struct SortFields
+		{
+			PipelineState pipeline;
+			MeshRange mesh;
+			float depth;
+		};
+
+		std::map<PipelineState, uint32_t> pipelineRanks;
+		std::map<MeshRange, uint32_t> meshRanks;
+		std::vector<DrawRecordData> records;
+		std::vector<SortFields> sortFields;
+		float maxDepth = 0.f;
+
+		auto view = scene.getRegistry().view<TransformComponent, ModelRefComponent>();
+		for (auto e : view)
+		{
+			const RenderModel* model = view.get<ModelRefComponent>(e).model;
+			if (model == nullptr)
+				continue;
+
+			uint32_t objectIndex = static_cast<uint32_t>(m_entities.size());
+			m_entities.push_back(e);
+			m_objectIndices.insert({ e, objectIndex });
+
+			// Distance of the model from the view at build time, instances of a mesh are drawn front to back
+			const auto& transform = view.get<TransformComponent>(e).mat;
+			float depth = glm::distance(viewPosition, glm::vec3(transform * glm::vec4(glm::vec3(model->getBoundingSphere()), 1.f)));
+			maxDepth = std::max(maxDepth, depth);
+
+			for (const auto& renderUnit : model->getRenderUnits())
+			{
+				const auto& mesh = renderUnit.getMesh();
+				const auto& mat = renderUnit.getMaterial();
+
+				DrawRecordData record{};
+				record.aabbMin = glm::vec4(mesh.getAabbMin(), 0.f);
+				record.aabbMax = glm::vec4(mesh.getAabbMax(), 0.f);
+				record.meshSphere = mesh.getBoundingSphere();
+				record.modelSphere = model->getBoundingSphere();
+				record.positionQuantization = model->getPositionQuantization();
+				for (uint32_t lod = 0; lod < Mesh::s_maxLods; ++lod)
+				{
+					record.firstIndex[lod] = mesh.getFirstIndex(lod);
+					record.indexCount[lod] = mesh.getNumIndices(lod);
+				}
+				record.objectIndex = objectIndex;
+				record.materialIndex = mat.getIndex();
+				record.vertexOffset = static_cast<int32_t>(mesh.getVertexBufferOffset());
+
+				SortFields fields{ { mesh.getIndexType(), mat.getPipeline() }, { mesh.getIndexType(), mesh.getFirstIndex(), record.vertexOffset }, depth };
+				pipelineRanks.insert({ fields.pipeline, 0 });
+				meshRanks.insert({ fields.mesh, 0 });
+				records.push_back(record);
+				sortFields.push_back(fields);
+				m_materialCount = std::max(m_materialCount, mat.getIndex() + 1);
+			}
+		}
+
+		// ======== Dense ranks for the key fields, one batch per pipeline state (the index type only changes once)
+		for (auto& [state, rank] : pipelineRanks)
+		{
+			rank = static_cast<uint32_t>(m_batches.size());
+			m_batches.push_back({ state.first, state.second, 0, 0 });
+		}
+
+		uint32_t meshCount = 0;
+		for (auto& [range, rank] : meshRanks)
+			rank = meshCount++;
+
+		std::vector<uint64_t> keys;
+		keys.reserve(records.size());
+		for (size_t i = 0; i < records.size(); ++i)
+		{
+			const auto& fields = sortFields[i];
+			keys.push_back(DrawSortKey::make(s_opaquePass, pipelineRanks[fields.pipeline], records[i].materialIndex, meshRanks[fields.mesh],
+				DrawSortKey::quantizeDepth(maxDepth > 0.f ? fields.depth / maxDepth : 0.f)));
+		}
+
+		std::vector<uint32_t> order;
+		radixSort(keys, order);
+
+		// ======== Records in key order, so batches are consecutive and their commands are laid out like the records
+		// A batch may use as many commands as it has records
+		std::vector<DrawRecordData> recordData;
+		recordData.reserve(records.size());
+		m_materialChanges = 0;
+		for (auto index : order)
+		{
+			auto record = records[index];
+			uint32_t batchIndex = DrawSortKey::getPipeline(keys[index]);
+			auto& drawBatch = m_batches[batchIndex];
+			if (drawBatch.commandCount == 0)
+			{
+				drawBatch.firstCommand = static_cast<uint32_t>(recordData.size());
+				++m_materialChanges;
+			}
+			else if (recordData.back().materialIndex != record.materialIndex)
+			{
+				++m_materialChanges;
+			}
+			++drawBatch.commandCount;
+
+			record.batchIndex = batchIndex;
+			record.batchFirstCommand = drawBatch.firstCommand;
+			recordData.push_back(record);
+		}
+		m_recordCount = static_cast<uint32_t>(recordData.size());
+
+		// Empty buffers are not allowed, an empty scene still gets one element
+		m_recordBuffer = Buffer::createDeviceLocal(m_context, std::max<size_t>(recordData.size(), 1) * sizeof(DrawRecordData), vk::BufferUsageFlagBits::eStorageBuffer);
+		if (!recordData.empty())
+			batch.copyToBuffer(recordData.data(), recordData.size() * sizeof(DrawRecordData), m_recordBuffer->getBuffer(), vk::BufferUsageFlagBits::eStorageBuffer);
+
+		// Every transform once, afterwards only the patched ones
+		std::vector<glm::mat4> transforms;
+		transforms.reserve(m_entities.size());
+		for (auto e : m_entities)
+			transforms.push_back(view.get<TransformComponent>(e).mat);
+
+		m_objectBuffer = Buffer::createDeviceLocal(m_context, std::max<size_t>(transforms.size(), 1) * sizeof(glm::mat4), vk::BufferUsageFlagBits::eStorageBuffer);
+		if (!transforms.empty())
+			batch.copyToBuffer(transforms.data(), transforms.size() * sizeof(glm::mat4), m_objectBuffer->getBuffer(), vk::BufferUsageFlagBits::eStorageBuffer);
+		m_transformObserver.connect(scene.getRegistry(), entt::collector.update<TransformComponent>());
+
+		createFrameData();
+
+		std::cout << "GPU culling: " << m_recordCount << " draw records of " << m_entities.size() << " entities in " << m_batches.size() << " batches, "
+			<< m_materialChanges << " material changes ("
+			<< (m_compactCommands ? "drawIndexedIndirectCount" : m_context.hasMultiDrawIndirect() ? "multi draw indirect" : "single draw indirect") << ")\n";
+	}
+
+	void GpuCuller::cull(vk::CommandBuffer cmd, uint32_t frameIdx, const glm::mat4& viewProj, float screenHeight)
+	{
+		assert(m_scene != nullptr);
+		auto& frame = m_frameData[frameIdx];
+
+		// Written by the last use of this frame index, which has completed
+		m_visibleDraws = *reinterpret_cast<const uint32_t*>(frame.statsBuffer->getMappedData());
+
+		// Transforms patched since the last cull go through this frame's staging (the previous use of it has completed)
+		// Entities without a model (or added after the build) have no object
+		auto& registry = m_scene->getRegistry();
+		auto* staging = reinterpret_cast<glm::mat4*>(frame.transformStaging->getMappedData());
+		std::vector<vk::BufferCopy> transformCopies;
+		for (auto e : m_transformObserver)
+		{
+			auto objectIndex = m_objectIndices.find(e);
+			if (objectIndex == m_objectIndices.end())
+				continue;
+
+			vk::DeviceSize stagingOffset = transformCopies.size() * sizeof(glm::mat4);
+			staging[transformCopies.size()] = registry.get<TransformComponent>(e).mat;
+			transformCopies.push_back(vk::BufferCopy(stagingOffset, objectIndex->second * sizeof(glm::mat4), sizeof(glm::mat4)));
+		}
+		m_transformObserver.clear();
+
+		if (m_recordCount == 0)
+			return;
+
+		// The object buffer is shared, earlier frames have to be done reading it (execution dependency only, they do not write it)
+		if (!transformCopies.empty())
+		{
+			cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eVertexShader, vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, {});
+			cmd.copyBuffer(frame.transformStaging->getBuffer(), m_objectBuffer->getBuffer(), transformCopies);
+		}
+
+		// Coverage and stats start over, the culling phase accumulates into them (batch counts are written by the compaction phase)
+		cmd.fillBuffer(frame.coverageBuffer->getBuffer(), 0, VK_WHOLE_SIZE, 0);
+		cmd.fillBuffer(frame.statsBuffer->getBuffer(), 0, VK_WHOLE_SIZE, 0);
+
+		// Transforms are read by the culling pass and by the vertex shaders of the draws
+		vk::MemoryBarrier clearBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eVertexShader, {}, clearBarrier, {}, {});
+
+		// Clip w is the view depth, the length of the second row is the vertical projection scale (view rotation is orthonormal)
+		CullConstants constants{};
+		constants.planes = Frustum::fromViewProjection(viewProj).getPlanes();
+		constants.depthRow = glm::vec4(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+		constants.projectionScale = glm::length(glm::vec3(viewProj[0][1], viewProj[1][1], viewProj[2][1]));
+		constants.screenHeight = screenHeight;
+		constants.recordCount = m_recordCount;
+
+		uint32_t groupCount = (m_recordCount + s_workGroupSize - 1) / s_workGroupSize;
+		cmd.bindPipeline(vk::PipelineBindPoint::eCompute, m_cullPipeline.get());
+		cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_cullPipelineLayout.get(), 0, frame.cullSet, {});
+		constants.phase = s_cullPhase;
+		cmd.pushConstants<CullConstants>(m_cullPipelineLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, constants);
+		cmd.dispatch(groupCount, 1, 1);
+
+		// Visible commands go to the front of their batch in record order: prefix sum of the visible records of every workgroup, then the scatter
+		if (m_compactCommands)
+		{
+			vk::MemoryBarrier phaseBarrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+			cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, phaseBarrier, {}, {});
+			constants.phase = s_scanPhase;
+			cmd.pushConstants<CullConstants>(m_cullPipelineLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, constants);
+			cmd.dispatch(1, 1, 1);
+
+			cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, phaseBarrier, {}, {});
+			constants.phase = s_compactPhase;
+			cmd.pushConstants<CullConstants>(m_cullPipelineLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, constants);
+			cmd.dispatch(groupCount, 1, 1);
+		}
+
+		// Commands and counts are consumed by the draws of this frame, coverage and stats are read on the CPU once the frame has completed
+		std::array<vk::MemoryBarrier, 1> drawBarrier{ vk::MemoryBarrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eIndirectCommandRead) };
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect, {}, drawBarrier, {}, {});
+		vk::MemoryBarrier hostBarrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead);
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, hostBarrier, {}, {});
+	}
+
+	GpuCuller::DrawStats GpuCuller::draw(vk::CommandBuffer cmd, uint32_t frameIdx, vk::PipelineLayout pipelineLayout)
+	{
+		DrawStats stats{};
+		if (m_recordCount == 0)
+			return stats;
+
+		auto& frame = m_frameData[frameIdx];
+		cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 3, frame.drawSet, {});
+		++stats.descriptorBinds;
+		stats.materialChanges = m_materialChanges;
+		stats.visibleDraws = m_visibleDraws;
+
+		constexpr uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+
+		// Every model is in the pool, the meshes address it with absolute vertex offsets and first indices
+		std::array<vk::Buffer, 1> vbs{ m_geometryPool.getVertexBuffer() };
+		std::array<vk::DeviceSize, 1> offsets{ 0 };
+		cmd.bindVertexBuffers(0, vbs, offsets);
+		++stats.bufferBinds;
+
+		std::optional<vk::IndexType> boundIndexType;
+		vk::Pipeline boundPipeline;
+
+		for (uint32_t i = 0; i < m_batches.size(); ++i)
+		{
+			const auto& batch = m_batches[i];
+
+			// Index buffer holds both 16 and 32-bit ranges, rebind only when the type changes
+			if (boundIndexType != batch.indexType)
+			{
+				cmd.bindIndexBuffer(m_geometryPool.getIndexBuffer(), 0, batch.indexType);
+				boundIndexType = batch.indexType;
+				++stats.bufferBinds;
+			}
+
+			if (batch.pipeline != boundPipeline)
+			{
+				cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, batch.pipeline);
+				boundPipeline = batch.pipeline;
+				++stats.pipelineBinds;
+			}
+
+			vk::DeviceSize offset = static_cast<vk::DeviceSize>(batch.firstCommand) * stride;
+			if (m_compactCommands)
+			{
+				cmd.drawIndexedIndirectCount(frame.commandBuffer->getBuffer(), offset, frame.countBuffer->getBuffer(), i * sizeof(uint32_t), batch.commandCount, stride);
+				++stats.indirectDraws;
+			}
+			else if (m_context.hasMultiDrawIndirect())
+			{
+				// Culled commands are still there, with no instances
+				cmd.drawIndexedIndirect(frame.commandBuffer->getBuffer(), offset, batch.commandCount, stride);
+				++stats.indirectDraws;
+			}
+			else
+			{
+				for (uint32_t command = 0; command < batch.commandCount; ++command)
+					cmd.drawIndexedIndirect(frame.commandBuffer->getBuffer(), offset + command * stride, 1, stride);
+				stats.indirectDraws += batch.commandCount;
+			}
+		}
+
+		return stats;
+	}
+
+	std::span<const float> GpuCuller::getMaterialCoverage(uint32_t frameIdx)
+	{
+		if (m_frameData.empty())
+			return {};
+
+		// Float bits written with atomicMax
+		const auto* pixels = reinterpret_cast<const float*>(m_frameData[frameIdx].coverageBuffer->getMappedData());
+		return std::span<const float>(pixels, m_materialCount);
+	}
+
+	uint32_t GpuCuller::getRecordCount() const
+	{
+		return m_recordCount;
+	}
+
+	uint32_t GpuCuller::getBatchCount() const
+	{
+		return static_cast<uint32_t>(m_batches.size());
+	}
+
+	void GpuCuller::createPipeline(const std::array<float, Mesh::s_maxLods - 1>& lodScreenSizes, float minScreenSize)
+	{
+		auto dev = m_context.getDevice();
+
+		vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullConstants));
+		m_cullPipelineLayout = dev.createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, m_cullSetLayout.get(), pushConstantRange));
+
+		// LOD thresholds and the command layout are fixed for the lifetime of the pipeline
+		struct SpecializationData
+		{
+			std::array<float, Mesh::s_maxLods - 1> lodScreenSizes;
+			float minScreenSize;
+			VkBool32 compactCommands;
+		} specData{ lodScreenSizes, minScreenSize, m_compactCommands ? VK_TRUE : VK_FALSE };
+
+		std::array<vk::SpecializationMapEntry, 5> specEntries{
+			vk::SpecializationMapEntry(0, offsetof(SpecializationData, lodScreenSizes) + 0 * sizeof(float), sizeof(float)),
+			vk::SpecializationMapEntry(1, offsetof(SpecializationData, lodScreenSizes) + 1 * sizeof(float), sizeof(float)),
+			vk::SpecializationMapEntry(2, offsetof(SpecializationData, lodScreenSizes) + 2 * sizeof(float), sizeof(float)),
+			vk::SpecializationMapEntry(3, offsetof(SpecializationData, minScreenSize), sizeof(float)),
+			vk::SpecializationMapEntry(4, offsetof(SpecializationData, compactCommands), sizeof(VkBool32))
+		};
+		vk::SpecializationInfo specInfo(static_cast<uint32_t>(specEntries.size()), specEntries.data(), sizeof(SpecializationData), &specData);
+
+		MappedFile compBin("compiled_shaders/compCull.spv");
+		auto compMod = dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo({}, compBin.getSize(), reinterpret_cast<const uint32_t*>(compBin.getData())));
+		vk::PipelineShaderStageCreateInfo stageCI({}, vk::ShaderStageFlagBits::eCompute, compMod.get(), "main", &specInfo);
+
+		m_cullPipeline = dev.createComputePipelineUnique({}, vk::ComputePipelineCreateInfo({}, stageCI, m_cullPipelineLayout.get())).value;
+	}
+
+	void GpuCuller::createFrameData()
+	{
+		auto dev = m_context.getDevice();
+		dev.resetDescriptorPool(m_descriptorPool.get());
+		m_frameData.clear();
+
+		size_t objectCount = std::max<size_t>(m_entities.size(), 1);
+		size_t commandCount = std::max<uint32_t>(m_recordCount, 1);
+		size_t batchCount = std::max<size_t>(m_batches.size(), 1);
+		size_t materialCount = std::max<uint32_t>(m_materialCount, 1);
+		size_t groupCount = (commandCount + s_workGroupSize - 1) / s_workGroupSize;
+
+		VmaAllocationCreateInfo uploadAllocCI{};
+		uploadAllocCI.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+		VmaAllocationCreateInfo gpuAllocCI{};
+		gpuAllocCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+		VmaAllocationCreateInfo readbackAllocCI{};
+		readbackAllocCI.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+		readbackAllocCI.requiredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;		// Read without invalidating
+
+		auto indirectUsage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer;
+		for (uint32_t i = 0; i < VulkanContext::getMaxFramesInFlight(); ++i)
+		{
+			FrameData frame;
+			frame.transformStaging = std::make_unique<Buffer>(m_context.getAllocator(),
+				vk::BufferCreateInfo({}, objectCount * sizeof(glm::mat4), vk::BufferUsageFlagBits::eTransferSrc), uploadAllocCI);
+			frame.commandBuffer = std::make_unique<Buffer>(m_context.getAllocator(),
+				vk::BufferCreateInfo({}, commandCount * sizeof(vk::DrawIndexedIndirectCommand), indirectUsage), gpuAllocCI);
+			frame.countBuffer = std::make_unique<Buffer>(m_context.getAllocator(),
+				vk::BufferCreateInfo({}, batchCount * sizeof(uint32_t), indirectUsage | vk::BufferUsageFlagBits::eTransferDst), gpuAllocCI);
+			frame.coverageBuffer = std::make_unique<Buffer>(m_context.getAllocator(),
+				vk::BufferCreateInfo({}, materialCount * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst), readbackAllocCI);
+
+			frame.recordStateBuffer = std::make_unique<Buffer>(m_context.getAllocator(),
+				vk::BufferCreateInfo({}, commandCount * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer), gpuAllocCI);
+			frame.groupBuffer = std::make_unique<Buffer>(m_context.getAllocator(),
+				vk::BufferCreateInfo({}, groupCount * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer), gpuAllocCI);
+			frame.statsBuffer = std::make_unique<Buffer>(m_context.getAllocator(),
+				vk::BufferCreateInfo({}, sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst), readbackAllocCI);
+
+			// Nothing is covered or drawn until the first cull of this frame has completed
+			std::memset(frame.coverageBuffer->getMappedData(), 0, materialCount * sizeof(uint32_t));
+			std::memset(frame.statsBuffer->getMappedData(), 0, sizeof(uint32_t));
+
+			std::array<vk::DescriptorSetLayout, 2> layouts{ m_cullSetLayout.get(), m_drawSetLayout.get() };
+			auto sets = dev.allocateDescriptorSets(vk::DescriptorSetAllocateInfo(m_descriptorPool.get(), layouts));
+			frame.cullSet = sets[0];
+			frame.drawSet = sets[1];
+
+			std::array<vk::DescriptorBufferInfo, 8> cullInfos{
+				vk::DescriptorBufferInfo(m_recordBuffer->getBuffer(), 0, VK_WHOLE_SIZE),
+				vk::DescriptorBufferInfo(m_objectBuffer->getBuffer(), 0, VK_WHOLE_SIZE),
+				vk::DescriptorBufferInfo(frame.commandBuffer->getBuffer(), 0, VK_WHOLE_SIZE),
+				vk::DescriptorBufferInfo(frame.countBuffer->getBuffer(), 0, VK_WHOLE_SIZE),
+				vk::DescriptorBufferInfo(frame.coverageBuffer->getBuffer(), 0, VK_WHOLE_SIZE),
+				vk::DescriptorBufferInfo(frame.recordStateBuffer->getBuffer(), 0, VK_WHOLE_SIZE),
+				vk::DescriptorBufferInfo(frame.groupBuffer->getBuffer(), 0, VK_WHOLE_SIZE),
+				vk::DescriptorBufferInfo(frame.statsBuffer->getBuffer(), 0, VK_WHOLE_SIZE)
+			};
+			std::array<vk::DescriptorBufferInfo, 2> drawInfos{ cullInfos[1], cullInfos[0] };
+
+			std::vector<vk::WriteDescriptorSet> writes;
+			for (uint32_t binding = 0; binding < cullInfos.size(); ++binding)
+				writes.push_back(vk::WriteDescriptorSet(frame.cullSet, binding, 0, vk::DescriptorType::eStorageBuffer, {}, cullInfos[binding]));
+			for (uint32_t binding = 0; binding < drawInfos.size(); ++binding)
+				writes.push_back(vk::WriteDescriptorSet(frame.drawSet, binding, 0, vk::DescriptorType::eStorageBuffer, {}, drawInfos[binding]));
+			dev.updateDescriptorSets(writes, {});
+
+			m_frameData.push_back(std::move(frame));
+		}
+	}
+}
@@ -0,0 +1,750 @@
+#include "pch.h"
+#include "MeshOptimizer.h"
+
+namespace Nagi
+{
+	static constexpr uint32_t INVALID_INDEX = ~0u;
+
+	// Triangles using each vertex (CSR layout)
+	struct TriangleAdjacency
+	{
+		std::vector<uint32_t> offsets;		// vertexCount + 1
+		std::vector<uint32_t> triangles;
+	};
+
+	static TriangleAdjacency buildAdjacency(const uint32_t* indices, size_t indexCount, uint32_t vertexCount)
+	{
+		TriangleAdjacency adj;
+		adj.offsets.resize(vertexCount + 1, 0);
+		for (size_t i = 0; i < indexCount; ++i)
+			++adj.offsets[indices[i] + 1];
+		for (uint32_t v = 0; v < vertexCount; ++v)
+			adj.offsets[v + 1] += adj.offsets[v];
+
+		adj.triangles.resize(indexCount);
+		std::vector<uint32_t> fill(adj.offsets.cbegin(), adj.offsets.cend() - 1);
+		for (size_t i = 0; i < indexCount; ++i)
+			adj.triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		return adj;
+	}
+
+	// Vertex attributes snapped to the weld grid
+	using WeldKey = std::array<int64_t, 14>;
+
+	struct WeldKeyHash
+	{
+		size_t operator()(const WeldKey& key) const
+		{
+			uint64_t hash = 14695981039346656037ull;		// FNV-1a over the cells
+			for (auto cell : key)
+			{
+				hash ^= static_cast<uint64_t>(cell);
+				hash *= 1099511628211ull;
+			}
+			return static_cast<size_t>(hash);
+		}
+	};
+
+	static WeldKey makeWeldKey(const AssimpVertex& vert, const WeldEpsilon& eps)
+	{
+		auto snap = [](float value, float cellSize) { return static_cast<int64_t>(std::floor(value / cellSize + 0.5f)); };
+		return WeldKey{
+			snap(vert.position.x, eps.position), snap(vert.position.y, eps.position), snap(vert.position.z, eps.position),
+			snap(vert.normal.x, eps.normal), snap(vert.normal.y, eps.normal), snap(vert.normal.z, eps.normal),
+			snap(vert.uv.x, eps.uv), snap(vert.uv.y, eps.uv),
+			snap(vert.tangent.x, eps.tangent), snap(vert.tangent.y, eps.tangent), snap(vert.tangent.z, eps.tangent),
+			snap(vert.bitangent.x, eps.tangent), snap(vert.bitangent.y, eps.tangent), snap(vert.bitangent.z, eps.tangent)
+		};
+	}
+
+	void weldVertices(std::vector<AssimpVertex>& vertices, std::vector<uint32_t>& indices, std::vector<AssimpMeshSubset>& subsets, const WeldEpsilon& epsilon)
+	{
+		// Process ranges in vertex order so that the welded vertices can be compacted in place
+		std::vector<size_t> order(subsets.size());
+		for (size_t i = 0; i < order.size(); ++i)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return subsets[a].vertexStart < subsets[b].vertexStart; });
+
+		size_t oldVertexCount = vertices.size();
+		std::unordered_map<WeldKey, uint32_t, WeldKeyHash> unique;
+		std::vector<uint32_t> remap;
+		uint32_t writeStart = 0;
+		for (size_t o = 0; o < order.size(); ++o)
+		{
+			auto& subset = subsets[order[o]];
+			uint32_t rangeEnd = o + 1 < order.size() ? subsets[order[o + 1]].vertexStart : static_cast<uint32_t>(vertices.size());
+			uint32_t vertexCount = rangeEnd - subset.vertexStart;
+
+			unique.clear();
+			unique.reserve(vertexCount);
+			remap.resize(vertexCount);
+
+			// First occurrence is kept, writes never overtake reads since writeStart <= vertexStart
+			uint32_t uniqueCount = 0;
+			for (uint32_t v = 0; v < vertexCount; ++v)
+			{
+				const auto vert = vertices[subset.vertexStart + v];
+				auto [it, inserted] = unique.insert({ makeWeldKey(vert, epsilon), uniqueCount });
+				if (inserted)
+					vertices[writeStart + uniqueCount++] = vert;
+				remap[v] = it->second;
+			}
+
+			for (uint32_t i = subset.indexStart; i < subset.indexStart + subset.indexCount; ++i)
+				indices[i] = remap[indices[i]];
+
+			subset.vertexStart = writeStart;
+			writeStart += uniqueCount;
+		}
+
+		vertices.resize(writeStart);
+
+		std::cout << "Welded " << oldVertexCount << " -> " << vertices.size() << " vertices ("
+			<< (oldVertexCount > 0 ? 100.f * (1.f - static_cast<float>(vertices.size()) / static_cast<float>(oldVertexCount)) : 0.f) << "% less)\n";
+	}
+
+	VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize)
+	{
+		VertexCacheStats stats{};
+		if (indexCount == 0)
+			return stats;
+
+		// FIFO: a vertex is in the cache if it was pushed less than cacheSize misses ago
+		std::vector<uint32_t> pushedAt(vertexCount, INVALID_INDEX);
+		std::vector<bool> referenced(vertexCount, false);
+		uint32_t misses = 0;
+		uint32_t uniqueVertices = 0;
+		for (size_t i = 0; i < indexCount; ++i)
+		{
+			uint32_t v = indices[i];
+			if (pushedAt[v] == INVALID_INDEX || misses - pushedAt[v] >= cacheSize)
+				pushedAt[v] = misses++;
+
+			if (!referenced[v])
+			{
+				referenced[v] = true;
+				++uniqueVertices;
+			}
+		}
+
+		stats.acmr = static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+		stats.atvr = static_cast<float>(misses) / static_cast<float>(uniqueVertices);
+		return stats;
+	}
+
+	void optimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize, std::vector<uint32_t>* clusters)
+	{
+		size_t triangleCount = indexCount / 3;
+		if (triangleCount == 0)
+			return;
+
+		auto adj = buildAdjacency(indices, indexCount, vertexCount);
+
+		// Live triangle count per vertex
+		std::vector<uint32_t> live(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; ++v)
+			live[v] = adj.offsets[v + 1] - adj.offsets[v];
+
+		std::vector<uint32_t> cacheTime(vertexCount, 0);
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<uint32_t> deadEnd;
+		std::vector<uint32_t> candidates;
+		std::vector<uint32_t> output;
+		output.reserve(indexCount);
+
+		uint32_t time = cacheSize + 1;
+		uint32_t cursor = 0;
+
+		auto inCache = [&](uint32_t v) { return time - cacheTime[v] <= cacheSize; };
+
+		// Fall back to recently used vertices that still have triangles, then to input order
+		auto skipDeadEnd = [&]() -> uint32_t
+		{
+			while (!deadEnd.empty())
+			{
+				uint32_t d = deadEnd.back();
+				deadEnd.pop_back();
+				if (live[d] > 0)
+					return d;
+			}
+
+			while (cursor < vertexCount)
+			{
+				if (live[cursor] > 0)
+					return cursor;
+				++cursor;
+			}
+			return INVALID_INDEX;
+		};
+
+		uint32_t fanning = skipDeadEnd();
+		if (clusters)
+			clusters->push_back(0);
+
+		while (fanning != INVALID_INDEX)
+		{
+			// Emit all remaining triangles around the fanning vertex
+			candidates.clear();
+			for (uint32_t a = adj.offsets[fanning]; a < adj.offsets[fanning + 1]; ++a)
+			{
+				uint32_t t = adj.triangles[a];
+				if (emitted[t])
+					continue;
+
+				for (uint32_t k = 0; k < 3; ++k)
+				{
+					uint32_t v = indices[t * 3 + k];
+					output.push_back(v);
+					deadEnd.push_back(v);
+					candidates.push_back(v);
+					--live[v];
+					if (!inCache(v))
+						cacheTime[v] = time++;
+				}
+				emitted[t] = true;
+			}
+
+			// Next fanning vertex: the candidate that stays in the cache the longest while its remaining triangles are emitted
+			uint32_t next = INVALID_INDEX;
+			int32_t bestPriority = -1;
+			for (uint32_t v : candidates)
+			{
+				if (live[v] == 0)
+					continue;
+
+				int32_t priority = 0;
+				if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+					priority = static_cast<int32_t>(time - cacheTime[v]);
+				if (priority > bestPriority)
+				{
+					bestPriority = priority;
+					next = v;
+				}
+			}
+
+			if (next == INVALID_INDEX)
+			{
+				next = skipDeadEnd();
+
+				// Restarting outside of the cache is a hard boundary, clusters can be reordered freely across these
+				if (clusters && next != INVALID_INDEX && !inCache(next))
+					clusters->push_back(static_cast<uint32_t>(output.size() / 3));
+			}
+
+			fanning = next;
+		}
+
+		assert(output.size() == triangleCount * 3);
+		std::copy(output.cbegin(), output.cend(), indices);
+	}
+
+	void optimizeOverdraw(uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& clusters, const AssimpVertex* vertices)
+	{
+		size_t triangleCount = indexCount / 3;
+		if (clusters.size() < 2)
+			return;
+
+		auto position = [&](uint32_t index) { const auto& p = vertices[index].position; return glm::vec3(p.x, p.y, p.z); };
+
+		struct ClusterInfo
+		{
+			uint32_t firstTriangle;
+			uint32_t triangleCount;
+			float sortKey;
+		};
+
+		// Area weighted centroid and normal per cluster
+		std::vector<ClusterInfo> infos;
+		infos.reserve(clusters.size());
+		std::vector<glm::vec3> centroids;
+		std::vector<glm::vec3> normals;
+		glm::vec3 meshCentroid(0.f);
+		float meshArea = 0.f;
+		for (size_t c = 0; c < clusters.size(); ++c)
+		{
+			uint32_t first = clusters[c];
+			uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : static_cast<uint32_t>(triangleCount);
+
+			glm::vec3 centroid(0.f), normal(0.f);
+			float area = 0.f;
+			for (uint32_t t = first; t < end; ++t)
+			{
+				auto p0 = position(indices[t * 3 + 0]);
+				auto p1 = position(indices[t * 3 + 1]);
+				auto p2 = position(indices[t * 3 + 2]);
+				auto n = glm::cross(p1 - p0, p2 - p0);
+				float triArea = glm::length(n) * 0.5f;
+				centroid += (p0 + p1 + p2) * (triArea / 3.f);
+				normal += n;
+				area += triArea;
+			}
+
+			meshCentroid += centroid;
+			meshArea += area;
+			centroids.push_back(area > 0.f ? centroid / area : position(indices[first * 3]));
+			normals.push_back(glm::length(normal) > 0.f ? glm::normalize(normal) : glm::vec3(0.f));
+			infos.push_back({ first, end - first, 0.f });
+		}
+
+		if (meshArea > 0.f)
+			meshCentroid /= meshArea;
+
+		// Clusters that face away from the center occlude the rest of the mesh from most view points, draw them first
+		for (size_t c = 0; c < infos.size(); ++c)
+			infos[c].sortKey = glm::dot(centroids[c] - meshCentroid, normals[c]);
+
+		std::stable_sort(infos.begin(), infos.end(), [](const ClusterInfo& a, const ClusterInfo& b) { return a.sortKey > b.sortKey; });
+
+		std::vector<uint32_t> sorted;
+		sorted.reserve(indexCount);
+		for (const auto& info : infos)
+			sorted.insert(sorted.end(), indices + info.firstTriangle * 3, indices + (info.firstTriangle + info.triangleCount) * 3);
+
+		std::copy(sorted.cbegin(), sorted.cend(), indices);
+	}
+
+	std::vector<uint32_t> optimizeVertexFetchRemap(uint32_t* indices, size_t indexCount, uint32_t vertexCount)
+	{
+		std::vector<uint32_t> remap(vertexCount, INVALID_INDEX);
+		uint32_t next = 0;
+		for (size_t i = 0; i < indexCount; ++i)
+		{
+			uint32_t& newIndex = remap[indices[i]];
+			if (newIndex == INVALID_INDEX)
+				newIndex = next++;
+			indices[i] = newIndex;
+		}
+
+		for (auto& newIndex : remap)
+			if (newIndex == INVALID_INDEX)
+				newIndex = next++;
+
+		return remap;
+	}
+
+	void optimizeMesh(std::vector<AssimpVertex>& vertices, std::vector<uint32_t>& indices, const std::vector<AssimpMeshSubset>& subsets, bool reduceOverdraw)
+	{
+		// Vertex ranges are contiguous, a subset owns everything up to the next range
+		std::vector<uint32_t> rangeStarts;
+		rangeStarts.reserve(subsets.size());
+		for (const auto& subset : subsets)
+			rangeStarts.push_back(subset.vertexStart);
+		std::sort(rangeStarts.begin(), rangeStarts.end());
+
+		std::vector<AssimpVertex> remapped;
+		std::vector<uint32_t> clusters;
+		for (size_t s = 0; s < subsets.size(); ++s)
+		{
+			const auto& subset = subsets[s];
+			auto rangeEnd = std::upper_bound(rangeStarts.cbegin(), rangeStarts.cend(), subset.vertexStart);
+			uint32_t vertexCount = (rangeEnd != rangeStarts.cend() ? *rangeEnd : static_cast<uint32_t>(vertices.size())) - subset.vertexStart;
+
+			uint32_t* subsetIndices = indices.data() + subset.indexStart;
+			AssimpVertex* subsetVertices = vertices.data() + subset.vertexStart;
+
+			auto before = analyzeVertexCache(subsetIndices, subset.indexCount, vertexCount);
+
+			clusters.clear();
+			optimizeVertexCache(subsetIndices, subset.indexCount, vertexCount, DEFAULT_VERTEX_CACHE_SIZE, reduceOverdraw ? &clusters : nullptr);
+			if (reduceOverdraw)
+				optimizeOverdraw(subsetIndices, subset.indexCount, clusters, subsetVertices);
+
+			auto remap = optimizeVertexFetchRemap(subsetIndices, subset.indexCount, vertexCount);
+			remapped.resize(vertexCount);
+			for (uint32_t v = 0; v < vertexCount; ++v)
+				remapped[remap[v]] = subsetVertices[v];
+			std::copy(remapped.cbegin(), remapped.cend(), subsetVertices);
+
+			auto after = analyzeVertexCache(subsetIndices, subset.indexCount, vertexCount);
+
+			std::cout << "Subset " << s << " (" << subset.indexCount / 3 << " triangles): "
+				<< "ACMR " << before.acmr << " -> " << after.acmr << ", "
+				<< "ATVR " << before.atvr << " -> " << after.atvr << '\n';
+		}
+	}
+
+	static Meshlet computeMeshletBounds(const AssimpVertex* vertices, const uint32_t* indices, uint32_t firstIndex, uint32_t indexCount)
+	{
+		auto position = [&](uint32_t i) { const auto& p = vertices[indices[i]].position; return glm::vec3(p.x, p.y, p.z); };
+
+		Meshlet meshlet{};
+		meshlet.firstIndex = firstIndex;
+		meshlet.indexCount = indexCount;
+
+		// Sphere around the AABB center (cheap and tight enough for culling)
+		glm::vec3 min(std::numeric_limits<float>::max()), max(std::numeric_limits<float>::lowest());
+		for (uint32_t i = firstIndex; i < firstIndex + indexCount; ++i)
+		{
+			min = glm::min(min, position(i));
+			max = glm::max(max, position(i));
+		}
+
+		glm::vec3 center = (min + max) * 0.5f;
+		float radius = 0.f;
+		for (uint32_t i = firstIndex; i < firstIndex + indexCount; ++i)
+			radius = std::max(radius, glm::length(position(i) - center));
+		meshlet.boundingSphere = glm::vec4(center, radius);
+
+		// Normal cone from the triangle normals
+		std::vector<glm::vec3> normals;
+		normals.reserve(indexCount / 3);
+		glm::vec3 axis(0.f);
+		for (uint32_t i = firstIndex; i < firstIndex + indexCount; i += 3)
+		{
+			auto n = glm::cross(position(i + 1) - position(i), position(i + 2) - position(i));
+			float len = glm::length(n);
+			if (len <= 0.f)
+				continue;		// Degenerate triangles are never visible
+			normals.push_back(n / len);
+			axis += normals.back();
+		}
+
+		meshlet.cone = glm::vec4(0.f, 0.f, 0.f, 1.f);
+		if (normals.empty() || glm::length(axis) <= 0.f)
+			return meshlet;
+
+		axis = glm::normalize(axis);
+		float minDot = 1.f;
+		for (const auto& n : normals)
+			minDot = std::min(minDot, glm::dot(axis, n));
+
+		// Cone is too wide to cull from anywhere (also avoids precision trouble near 90 degrees)
+		if (minDot <= 0.1f)
+			return meshlet;
+
+		// Sine of the cone half angle
+		meshlet.cone = glm::vec4(axis, std::sqrt(1.f - minDot * minDot));
+		return meshlet;
+	}
+
+	std::vector<Meshlet> buildMeshlets(const std::vector<AssimpVertex>& vertices, const std::vector<uint32_t>& indices, std::vector<AssimpMeshSubset>& subsets,
+		uint32_t maxVertices, uint32_t maxTriangles)
+	{
+		assert(maxVertices >= 3 && maxTriangles >= 1);
+
+		std::vector<Meshlet> meshlets;
+		std::vector<uint32_t> vertexMarker;		// Meshlet index + 1 that last used the vertex
+		for (auto& subset : subsets)
+		{
+			const uint32_t* subsetIndices = indices.data() + subset.indexStart;
+			const AssimpVertex* subsetVertices = vertices.data() + subset.vertexStart;
+
+			subset.meshletStart = static_cast<unsigned int>(meshlets.size());
+
+			uint32_t vertexCount = 0;
+			for (uint32_t i = 0; i < subset.indexCount; ++i)
+				vertexCount = std::max(vertexCount, subsetIndices[i] + 1);
+			vertexMarker.assign(vertexCount, 0);
+
+			uint32_t meshletFirst = 0;
+			uint32_t meshletVertices = 0;
+			uint32_t marker = 1;
+			for (uint32_t i = 0; i + 2 < subset.indexCount; i += 3)
+			{
+				uint32_t newVertices = 0;
+				for (uint32_t k = 0; k < 3; ++k)
+					newVertices += vertexMarker[subsetIndices[i + k]] != marker ? 1 : 0;
+
+				uint32_t triangles = (i - meshletFirst) / 3;
+				if (meshletVertices + newVertices > maxVertices || triangles + 1 > maxTriangles)
+				{
+					meshlets.push_back(computeMeshletBounds(subsetVertices, subsetIndices, meshletFirst, i - meshletFirst));
+					meshletFirst = i;
+					meshletVertices = 0;
+					++marker;
+				}
+
+				for (uint32_t k = 0; k < 3; ++k)
+				{
+					uint32_t v = subsetIndices[i + k];
+					if (vertexMarker[v] != marker)
+					{
+						vertexMarker[v] = marker;
+						++meshletVertices;
+					}
+				}
+			}
+
+			if (subset.indexCount > meshletFirst)
+				meshlets.push_back(computeMeshletBounds(subsetVertices, subsetIndices, meshletFirst, subset.indexCount - meshletFirst));
+
+			subset.meshletCount = static_cast<unsigned int>(meshlets.size()) - subset.meshletStart;
+		}
+
+		return meshlets;
+	}
+
+	// Symmetric 4x4 matrix, error of a point p is p^T Q p
+	struct Quadric
+	{
+		double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+		double a11 = 0, a12 = 0, a13 = 0;
+		double a22 = 0, a23 = 0;
+		double a33 = 0;
+
+		static Quadric fromPlane(const glm::dvec3& n, double d, double weight)
+		{
+			Quadric q;
+			q.a00 = n.x * n.x * weight; q.a01 = n.x * n.y * weight; q.a02 = n.x * n.z * weight; q.a03 = n.x * d * weight;
+			q.a11 = n.y * n.y * weight; q.a12 = n.y * n.z * weight; q.a13 = n.y * d * weight;
+			q.a22 = n.z * n.z * weight; q.a23 = n.z * d * weight;
+			q.a33 = d * d * weight;
+			return q;
+		}
+
+		Quadric& operator+=(const Quadric& o)
+		{
+			a00 += o.a00; a01 += o.a01; a02 += o.a02; a03 += o.a03;
+			a11 += o.a11; a12 += o.a12; a13 += o.a13;
+			a22 += o.a22; a23 += o.a23;
+			a33 += o.a33;
+			return *this;
+		}
+
+		double error(const glm::dvec3& p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+				+ a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+				+ a22 * z * z + 2 * a23 * z
+				+ a33;
+			return std::max(e, 0.0);
+		}
+	};
+
+	std::vector<uint32_t> simplifyIndices(const uint32_t* indices, size_t indexCount, const AssimpVertex* vertices, uint32_t vertexCount,
+		size_t targetIndexCount, float targetError, float* resultError)
+	{
+		std::vector<uint32_t> result(indices, indices + indexCount);
+		if (resultError)
+			*resultError = 0.f;
+
+		auto position = [&](uint32_t v) { const auto& p = vertices[v].position; return glm::dvec3(p.x, p.y, p.z); };
+
+		// Errors are relative to the extent so one threshold works for every model scale
+		glm::dvec3 min(std::numeric_limits<double>::max()), max(std::numeric_limits<double>::lowest());
+		for (size_t i = 0; i < indexCount; ++i)
+		{
+			min = glm::min(min, position(indices[i]));
+			max = glm::max(max, position(indices[i]));
+		}
+		double extent = glm::length(max - min);
+		if (extent <= 0.0)
+			return result;
+		double maxError = static_cast<double>(targetError) * extent;
+		double maxQuadricError = maxError * maxError;
+
+		// Plane quadrics (area weighted) per vertex
+		std::vector<Quadric> quadrics(vertexCount);
+		for (size_t i = 0; i + 2 < indexCount; i += 3)
+		{
+			auto p0 = position(indices[i]), p1 = position(indices[i + 1]), p2 = position(indices[i + 2]);
+			auto n = glm::cross(p1 - p0, p2 - p0);
+			double len = glm::length(n);
+			if (len <= 0.0)
+				continue;
+			n /= len;
+			auto q = Quadric::fromPlane(n, -glm::dot(n, p0), len * 0.5);
+			quadrics[indices[i]] += q;
+			quadrics[indices[i + 1]] += q;
+			quadrics[indices[i + 2]] += q;
+		}
+
+		// Lock vertices on open edges (an edge used by one triangle only)
+		auto edgeKey = [](uint32_t a, uint32_t b) { return a < b ? (static_cast<uint64_t>(a) << 32) | b : (static_cast<uint64_t>(b) << 32) | a; };
+		std::unordered_map<uint64_t, uint32_t> edgeUse;
+		edgeUse.reserve(indexCount);
+		for (size_t i = 0; i + 2 < indexCount; i += 3)
+			for (uint32_t k = 0; k < 3; ++k)
+				++edgeUse[edgeKey(indices[i + k], indices[i + (k + 1) % 3])];
+
+		std::vector<bool> locked(vertexCount, false);
+		for (const auto& [key, count] : edgeUse)
+		{
+			if (count != 1)
+				continue;
+			locked[static_cast<uint32_t>(key >> 32)] = true;
+			locked[static_cast<uint32_t>(key & 0xFFFFFFFF)] = true;
+		}
+
+		struct Collapse
+		{
+			uint32_t from;
+			uint32_t to;
+			double error;
+		};
+
+		std::vector<Collapse> collapses;
+		std::vector<uint32_t> remap(vertexCount);
+		std::vector<bool> touched(vertexCount);
+		double largestError = 0.0;
+
+		// Each pass collapses the cheapest independent edges, then the index buffer is rebuilt
+		while (result.size() > targetIndexCount)
+		{
+			auto adj = buildAdjacency(result.data(), result.size(), vertexCount);
+
+			collapses.clear();
+			for (size_t i = 0; i + 2 < result.size(); i += 3)
+			{
+				for (uint32_t k = 0; k < 3; ++k)
+				{
+					uint32_t a = result[i + k], b = result[i + (k + 1) % 3];
+					if (a > b)
+						continue;		// Interior edges are seen twice, keep one direction
+
+					Quadric q = quadrics[a];
+					q += quadrics[b];
+					double errorAB = locked[a] ? std::numeric_limits<double>::max() : q.error(position(b));
+					double errorBA = locked[b] ? std::numeric_limits<double>::max() : q.error(position(a));
+					if (errorAB == std::numeric_limits<double>::max() && errorBA == std::numeric_limits<double>::max())
+						continue;
+
+					if (errorAB <= errorBA)
+						collapses.push_back({ a, b, errorAB });
+					else
+						collapses.push_back({ b, a, errorBA });
+				}
+			}
+
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+
+			for (uint32_t v = 0; v < vertexCount; ++v)
+				remap[v] = v;
+			std::fill(touched.begin(), touched.end(), false);
+
+			size_t triangleCount = result.size() / 3;
+			size_t targetTriangles = targetIndexCount / 3;
+			size_t collapsed = 0;
+			for (const auto& c : collapses)
+			{
+				if (triangleCount <= targetTriangles || c.error > maxQuadricError)
+					break;
+				if (touched[c.from] || touched[c.to])
+					continue;
+
+				// Moving 'from' onto 'to' must not flip any of the triangles that survive
+				bool flips = false;
+				size_t removed = 0;
+				auto target = position(c.to);
+				for (uint32_t a = adj.offsets[c.from]; a < adj.offsets[c.from + 1] && !flips; ++a)
+				{
+					const uint32_t* tri = &result[adj.triangles[a] * 3];
+					if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+					{
+						++removed;
+						continue;
+					}
+
+					glm::dvec3 p[3], moved[3];
+					for (uint32_t k = 0; k < 3; ++k)
+					{
+						p[k] = position(tri[k]);
+						moved[k] = tri[k] == c.from ? target : p[k];
+					}
+					auto before = glm::cross(p[1] - p[0], p[2] - p[0]);
+					auto after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+					// Also reject large rotations, small ones add up over the passes and would eventually fold the surface
+					flips = glm::dot(before, after) <= 0.25 * glm::length(before) * glm::length(after);
+				}
+				if (flips)
+					continue;
+
+				remap[c.from] = c.to;
+				quadrics[c.to] += quadrics[c.from];
+				largestError = std::max(largestError, c.error);
+
+				// Neighbourhood of the collapse is fixed for the rest of the pass so that the flip checks above stay valid
+				for (uint32_t a = adj.offsets[c.from]; a < adj.offsets[c.from + 1]; ++a)
+					for (uint32_t k = 0; k < 3; ++k)
+						touched[result[adj.triangles[a] * 3 + k]] = true;
+
+				triangleCount -= removed;
+				++collapsed;
+			}
+
+			if (collapsed == 0)
+				break;
+
+			// Apply and drop degenerate triangles
+			size_t write = 0;
+			for (size_t i = 0; i + 2 < result.size(); i += 3)
+			{
+				uint32_t a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+				if (a == b || b == c || a == c)
+					continue;
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+			result.resize(write);
+		}
+
+		if (resultError)
+			*resultError = static_cast<float>(std::sqrt(largestError) / extent);
+		return result;
+	}
+
+	void buildLods(const std::vector<AssimpVertex>& vertices, std::vector<uint32_t>& indices, std::vector<AssimpMeshSubset>& subsets, uint32_t maxLods, float targetError)
+	{
+		// Vertex ranges are contiguous, a subset owns everything up to the next range
+		std::vector<uint32_t> rangeStarts;
+		rangeStarts.reserve(subsets.size());
+		for (const auto& subset : subsets)
+			rangeStarts.push_back(subset.vertexStart);
+		std::sort(rangeStarts.begin(), rangeStarts.end());
+
+		size_t baseIndexCount = 0;
+		size_t lodIndexCount = 0;
+		for (auto& subset : subsets)
+		{
+			auto rangeEnd = std::upper_bound(rangeStarts.cbegin(), rangeStarts.cend(), subset.vertexStart);
+			uint32_t vertexCount = (rangeEnd != rangeStarts.cend() ? *rangeEnd : static_cast<uint32_t>(vertices.size())) - subset.vertexStart;
+			baseIndexCount += subset.indexCount;
+
+			subset.lods.clear();
+			std::vector<uint32_t> previous(indices.cbegin() + subset.indexStart, indices.cbegin() + subset.indexStart + subset.indexCount);
+			for (uint32_t lod = 1; lod < maxLods; ++lod)
+			{
+				size_t target = (previous.size() / 6) * 3;
+				if (target == 0)
+					break;
+
+				auto simplified = simplifyIndices(previous.data(), previous.size(), vertices.data() + subset.vertexStart, vertexCount, target, targetError);
+
+				// Not worth another draw range if it barely shrank
+				if (simplified.empty() || simplified.size() * 10 > previous.size() * 9)
+					break;
+
+				optimizeVertexCache(simplified.data(), simplified.size(), vertexCount);
+
+				subset.lods.push_back({ static_cast<unsigned int>(indices.size()), static_cast<unsigned int>(simplified.size()) });
+				indices.insert(indices.end(), simplified.cbegin(), simplified.cend());
+				lodIndexCount += simplified.size();
+				previous = std::move(simplified);
+			}
+		}
+
+		std::cout << "Built LODs: " << baseIndexCount / 3 << " base triangles, " << lodIndexCount / 3 << " LOD triangles\n";
+	}
+
+	glm::vec4 computeBoundingSphere(const std::vector<AssimpVertex>& vertices)
+	{
+		if (vertices.empty())
+			return glm::vec4(0.f);
+
+		glm::vec3 min(std::numeric_limits<float>::max()), max(std::numeric_limits<float>::lowest());
+		for (const auto& vert : vertices)
+		{
+			glm::vec3 p(vert.position.x, vert.position.y, vert.position.z);
+			min = glm::min(min, p);
+			max = glm::max(max, p);
+		}
+
+		glm::vec3 center = (min + max) * 0.5f;
+		float radius = 0.f;
+		for (const auto& vert : vertices)
+			radius = std::max(radius, glm::length(glm::vec3(vert.position.x, vert.position.y, vert.position.z) - center));
+		return glm::vec4(center, radius);
+	}
+}
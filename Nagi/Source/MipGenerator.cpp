@@ -0,0 +1,170 @@
+#include "pch.h"
+#include "MipGenerator.h"
+
+#include <cstring>
+#include <emmintrin.h>
+
+namespace Nagi
+{
+	// Linear to sRGB goes through a table indexed by the linear value, fine enough that every 8-bit step near black is resolved
+	static constexpr uint32_t LINEAR_TO_SRGB_TABLE_SIZE = 8192;
+
+	struct SrgbTables
+	{
+		std::array<float, 256> toLinear;
+		std::array<uint8_t, LINEAR_TO_SRGB_TABLE_SIZE> toSrgb;
+
+		SrgbTables()
+		{
+			for (uint32_t i = 0; i < 256; ++i)
+			{
+				float value = i / 255.f;
+				toLinear[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+			}
+			for (uint32_t i = 0; i < LINEAR_TO_SRGB_TABLE_SIZE; ++i)
+			{
+				float value = i / static_cast<float>(LINEAR_TO_SRGB_TABLE_SIZE - 1);
+				float srgb = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+				toSrgb[i] = static_cast<uint8_t>(std::clamp(srgb, 0.f, 1.f) * 255.f + 0.5f);
+			}
+		}
+	};
+
+	static const SrgbTables& getSrgbTables()
+	{
+		static const SrgbTables tables;
+		return tables;
+	}
+
+	uint32_t getMipLevelCount(uint32_t width, uint32_t height)
+	{
+		return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+	}
+
+	std::vector<size_t> getMipChainOffsets(uint32_t width, uint32_t height)
+	{
+		uint32_t levelCount = getMipLevelCount(width, height);
+		std::vector<size_t> offsets;
+		offsets.reserve(levelCount + 1);
+
+		size_t offset = 0;
+		for (uint32_t level = 0; level < levelCount; ++level)
+		{
+			offsets.push_back(offset);
+			offset += static_cast<size_t>(std::max(width >> level, 1u)) * std::max(height >> level, 1u) * sizeof(uint32_t);
+		}
+		offsets.push_back(offset);
+		return offsets;
+	}
+
+	void downsampleBox(const glm::vec4* src, uint32_t srcWidth, uint32_t srcHeight, glm::vec4* dst)
+	{
+		uint32_t dstWidth = std::max(srcWidth / 2, 1u);
+		uint32_t dstHeight = std::max(srcHeight / 2, 1u);
+		const __m128 quarter = _mm_set1_ps(0.25f);
+
+		for (uint32_t y = 0; y < dstHeight; ++y)
+		{
+			const float* row0 = &src[static_cast<size_t>(std::min(y * 2, srcHeight - 1)) * srcWidth].x;
+			const float* row1 = &src[static_cast<size_t>(std::min(y * 2 + 1, srcHeight - 1)) * srcWidth].x;
+			float* out = &dst[static_cast<size_t>(y) * dstWidth].x;
+
+			for (uint32_t x = 0; x < dstWidth; ++x)
+			{
+				// One pixel (RGBA) per register
+				uint32_t x0 = std::min(x * 2, srcWidth - 1) * 4;
+				uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1) * 4;
+				__m128 top = _mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1));
+				__m128 bottom = _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1));
+				_mm_storeu_ps(out + x * 4, _mm_mul_ps(_mm_add_ps(top, bottom), quarter));
+			}
+		}
+	}
+
+	static void toFloat(const uint8_t* rgba, size_t pixelCount, bool srgb, glm::vec4* dst)
+	{
+		const auto& tables = getSrgbTables();
+		if (srgb)
+		{
+			for (size_t i = 0; i < pixelCount; ++i)
+			{
+				const uint8_t* pixel = rgba + i * 4;
+				dst[i] = glm::vec4(tables.toLinear[pixel[0]], tables.toLinear[pixel[1]], tables.toLinear[pixel[2]], pixel[3] / 255.f);
+			}
+			return;
+		}
+
+		const __m128 scale = _mm_set1_ps(1.f / 255.f);
+		const __m128i zero = _mm_setzero_si128();
+		for (size_t i = 0; i < pixelCount; ++i)
+		{
+			// Widen 4 bytes to 4 floats
+			int packed;
+			std::memcpy(&packed, rgba + i * 4, sizeof(int));
+			__m128i bytes = _mm_cvtsi32_si128(packed);
+			__m128i ints = _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero);
+			_mm_storeu_ps(&dst[i].x, _mm_mul_ps(_mm_cvtepi32_ps(ints), scale));
+		}
+	}
+
+	static void toRGBA8(const glm::vec4* src, size_t pixelCount, bool srgb, uint8_t* dst)
+	{
+		const auto& tables = getSrgbTables();
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.f);
+
+		// Color channels are scaled to table indices for sRGB, alpha (and everything for linear images) straight to 0-255
+		const __m128 scale = srgb ?
+			_mm_setr_ps(LINEAR_TO_SRGB_TABLE_SIZE - 1.f, LINEAR_TO_SRGB_TABLE_SIZE - 1.f, LINEAR_TO_SRGB_TABLE_SIZE - 1.f, 255.f) :
+			_mm_set1_ps(255.f);
+
+		alignas(16) std::array<int32_t, 4> values;
+		for (size_t i = 0; i < pixelCount; ++i)
+		{
+			__m128 pixel = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(&src[i].x), zero), one);
+			_mm_store_si128(reinterpret_cast<__m128i*>(values.data()), _mm_cvtps_epi32(_mm_mul_ps(pixel, scale)));		// Rounds to nearest
+
+			uint8_t* out = dst + i * 4;
+			if (srgb)
+			{
+				out[0] = tables.toSrgb[values[0]];
+				out[1] = tables.toSrgb[values[1]];
+				out[2] = tables.toSrgb[values[2]];
+			}
+			else
+			{
+				out[0] = static_cast<uint8_t>(values[0]);
+				out[1] = static_cast<uint8_t>(values[1]);
+				out[2] = static_cast<uint8_t>(values[2]);
+			}
+			out[3] = static_cast<uint8_t>(values[3]);
+		}
+	}
+
+	void generateMipChain(const uint8_t* rgba, uint32_t width, uint32_t height, bool srgb, uint8_t* dst)
+	{
+		auto offsets = getMipChainOffsets(width, height);
+		uint32_t levelCount = static_cast<uint32_t>(offsets.size() - 1);
+		std::memcpy(dst, rgba, offsets[1]);
+		if (levelCount == 1)
+			return;
+
+		// Filter from the previous float level to avoid accumulating 8-bit rounding, ping-ponging between two buffers
+		std::vector<glm::vec4> current(static_cast<size_t>(width) * height);
+		std::vector<glm::vec4> next(static_cast<size_t>(std::max(width / 2, 1u)) * std::max(height / 2, 1u));
+		toFloat(rgba, current.size(), srgb, current.data());
+
+		uint32_t levelWidth = width;
+		uint32_t levelHeight = height;
+		for (uint32_t level = 1; level < levelCount; ++level)
+		{
+			downsampleBox(current.data(), levelWidth, levelHeight, next.data());
+			levelWidth = std::max(levelWidth / 2, 1u);
+			levelHeight = std::max(levelHeight / 2, 1u);
+
+			size_t pixelCount = static_cast<size_t>(levelWidth) * levelHeight;
+			toRGBA8(next.data(), pixelCount, srgb, dst + offsets[level]);
+			std::swap(current, next);
+		}
+	}
+}
@@ -1,5 +1,11 @@
 #include "pch.h"
 #include "ResourceTypes.h"
+#include "UploadBatch.h"
+#include "CookedTexture.h"
+#include "MipGenerator.h"
+#include "ThreadPool.h"
+
+#include <thread>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -26,18 +32,53 @@ namespace Nagi
 		//char* mappedData = nullptr;
 		
 		// map once and keep it mapped
-		if (m_mappedData == nullptr)
-			vmaMapMemory(m_allocator, alloc, (void**)&m_mappedData);
-		memcpy(m_mappedData + offset, inData, dataSize);
+		memcpy(getMappedData() + offset, inData, dataSize);
 
 		//vmaUnmapMemory(m_allocator, alloc);
 	}
 
+	uint8_t* Buffer::getMappedData()
+	{
+		if (m_mappedData == nullptr)
+			vmaMapMemory(m_allocator, alloc, (void**)&m_mappedData);
+		return reinterpret_cast<uint8_t*>(m_mappedData);
+	}
+
 	const vk::Buffer& Buffer::getBuffer() const
 	{
 		return resource;
 	}
 
+	std::unique_ptr<Buffer> Buffer::loadImmutable(VulkanContext& context, const void* inData, size_t dataSizeInBytes, vk::BufferUsageFlagBits usage)
+	{
+		UploadBatch batch(context);
+		auto immutableBuf = loadImmutable(batch, inData, dataSizeInBytes, usage);
+		batch.submitAndWait();
+		return immutableBuf;
+	}
+
+	std::unique_ptr<Buffer> Buffer::createDeviceLocal(VulkanContext& context, size_t sizeInBytes, vk::BufferUsageFlags usage)
+	{
+		vk::BufferCreateInfo bufCI({}, sizeInBytes, usage | vk::BufferUsageFlagBits::eTransferDst);
+		VmaAllocationCreateInfo bufAllocCI{};
+		bufAllocCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+		return std::make_unique<Buffer>(context.getAllocator(), bufCI, bufAllocCI);
+	}
+
+	std::unique_ptr<Buffer> Buffer::loadImmutable(UploadBatch& batch, const void* inData, size_t dataSizeInBytes, vk::BufferUsageFlagBits usage)
+	{
+		if (!(usage & vk::BufferUsageFlagBits::eVertexBuffer || usage & vk::BufferUsageFlagBits::eIndexBuffer))
+			throw std::runtime_error("loadVkImmutableBuffer suitability with non Vertex/Index buffers have not been checked! (Temporarily disabled for non Vertex/Index buffers");
+
+		// Create immutable buffer (device only) and copy data to it through the batch staging memory
+		auto immutableBuf = createDeviceLocal(batch.getContext(), dataSizeInBytes, usage);
+
+		batch.copyToBuffer(inData, dataSizeInBytes, immutableBuf->getBuffer(), usage);
+
+		return immutableBuf;
+	}
+
 
 
 
@@ -73,36 +114,242 @@ namespace Nagi
 		return m_view;
 	}
 
-	std::unique_ptr<Texture> Texture::fromFile(VulkanContext& context, const std::string& filePath, bool generateMips, bool srgb)
+	// Mip cache file: [MipCacheHeader][RGBA8 levels back to back, level 0 first]
+	static constexpr uint32_t MIP_CACHE_MAGIC = 0x5850494D;		// 'MIPX'
+	static constexpr uint32_t MIP_CACHE_VERSION = 1;
+
+	struct MipCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		uint32_t width;
+		uint32_t height;
+		uint32_t levelCount;
+		uint32_t srgb;
+	};
+
+	static void writeMipCache(const std::filesystem::path& cachePath, const MipCacheHeader& header, const void* data, size_t size)
+	{
+		// The same image may be cached from several threads at once (identical files under different names), so temporaries are per thread
+		auto tmpPath = cachePath;
+		tmpPath += "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+
+		// A failed cache write only costs us the next load, so it is not an error
+		try
+		{
+			std::filesystem::create_directories(cachePath.parent_path());
+			{
+				std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+				file.write(reinterpret_cast<const char*>(&header), sizeof(MipCacheHeader));
+				file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+				if (!file.good())
+					throw std::runtime_error("Failed writing mip cache: " + cachePath.string());
+			}
+			std::filesystem::rename(tmpPath, cachePath);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "Mip cache not written: " << e.what() << '\n';
+			std::error_code ec;
+			std::filesystem::remove(tmpPath, ec);
+		}
+	}
+
+	ImageData::~ImageData()
+	{
+		if (m_pixels != nullptr)
+			stbi_image_free(m_pixels);
+	}
+
+	ImageData::ImageData(ImageData&& other) noexcept :
+		m_pixels(std::exchange(other.m_pixels, nullptr)),
+		m_mipChain(std::move(other.m_mipChain)),
+		m_cacheFile(std::move(other.m_cacheFile)),
+		m_data(std::exchange(other.m_data, nullptr)),
+		m_mipOffsets(std::move(other.m_mipOffsets)),
+		m_width(std::exchange(other.m_width, 0)),
+		m_height(std::exchange(other.m_height, 0))
+	{
+	}
+
+	ImageData& ImageData::operator=(ImageData&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (m_pixels != nullptr)
+				stbi_image_free(m_pixels);
+			m_pixels = std::exchange(other.m_pixels, nullptr);
+			m_mipChain = std::move(other.m_mipChain);
+			m_cacheFile = std::move(other.m_cacheFile);
+			m_data = std::exchange(other.m_data, nullptr);
+			m_mipOffsets = std::move(other.m_mipOffsets);
+			m_width = std::exchange(other.m_width, 0);
+			m_height = std::exchange(other.m_height, 0);
+		}
+		return *this;
+	}
+
+	ImageData ImageData::fromFile(const std::string& filePath, bool generateMips, bool srgb, bool useMipCache)
 	{
-		// ========================== Load image data
 		int texWidth, texHeight, texChannels;
+		ImageData image;
+
+		// Decoding and hashing read the whole file front to back
+		MappedFile source(filePath);
+		source.prefetch();
 
-		stbi_uc* pixels = stbi_load(filePath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+		if (!generateMips)
+		{
+			stbi_uc* pixels = stbi_load_from_memory(source.getData(), static_cast<int>(source.getSize()), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
 
+			if (!pixels)
+				throw std::runtime_error("Can't decode the image resource: " + filePath);
+
+			image.m_pixels = pixels;
+			image.m_data = pixels;
+			image.m_width = static_cast<uint32_t>(texWidth);
+			image.m_height = static_cast<uint32_t>(texHeight);
+			return image;
+		}
+
+		// ======== Cached chain, keyed by the source bytes so renames and copies hit as well
+		uint64_t sourceHash = hashBytes(source.getData(), source.getSize());
+		auto cachePath = getMipCachePath(sourceHash, srgb);
+
+		if (useMipCache && std::filesystem::exists(cachePath))
+		{
+			auto cacheFile = std::make_unique<MappedFile>(cachePath);
+			if (cacheFile->getSize() >= sizeof(MipCacheHeader))
+			{
+				const auto& header = *reinterpret_cast<const MipCacheHeader*>(cacheFile->getData());
+				if (header.magic == MIP_CACHE_MAGIC && header.version == MIP_CACHE_VERSION && header.sourceHash == sourceHash && header.srgb == (srgb ? 1u : 0u))
+				{
+					auto offsets = getMipChainOffsets(header.width, header.height);
+					if (header.levelCount == offsets.size() - 1 && cacheFile->getSize() == sizeof(MipCacheHeader) + offsets.back())
+					{
+						image.m_data = cacheFile->getData() + sizeof(MipCacheHeader);
+						image.m_cacheFile = std::move(cacheFile);
+						image.m_mipOffsets = std::move(offsets);
+						image.m_width = header.width;
+						image.m_height = header.height;
+						return image;
+					}
+				}
+			}
+		}
+
+		// ======== Decode from the mapping and build the chain
+		stbi_uc* pixels = stbi_load_from_memory(source.getData(), static_cast<int>(source.getSize()), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
 		if (!pixels)
-			throw std::runtime_error("Can't find the image resource: " + filePath);
+			throw std::runtime_error("Can't decode the image resource: " + filePath);
 
-		size_t imageSize = texWidth * texHeight * sizeof(uint32_t);
+		image.m_width = static_cast<uint32_t>(texWidth);
+		image.m_height = static_cast<uint32_t>(texHeight);
+		image.m_mipOffsets = getMipChainOffsets(image.m_width, image.m_height);
+		image.m_mipChain.resize(image.m_mipOffsets.back());
+		generateMipChain(pixels, image.m_width, image.m_height, srgb, image.m_mipChain.data());
+		stbi_image_free(pixels);
+		image.m_data = image.m_mipChain.data();
 
-		auto allocator = context.getAllocator();
+		if (useMipCache)
+		{
+			MipCacheHeader header{ MIP_CACHE_MAGIC, MIP_CACHE_VERSION, sourceHash, image.m_width, image.m_height, image.getMipLevelCount(), srgb ? 1u : 0u };
+			writeMipCache(cachePath, header, image.m_mipChain.data(), image.m_mipChain.size());
+		}
 
-		// Get mip levels
-		uint32_t mipLevels = 1;
-		if (generateMips)
-			mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+		return image;
+	}
+
+	std::filesystem::path ImageData::getMipCachePath(uint64_t sourceHash, bool srgb)
+	{
+		std::array<char, 17> hex{};
+		std::snprintf(hex.data(), hex.size(), "%016llx", static_cast<unsigned long long>(sourceHash));
+		return std::filesystem::path(s_mipCacheDirectory) / (std::string(hex.data()) + (srgb ? ".srgb" : ".unorm") + ".mips");
+	}
+
+	const uint8_t* ImageData::getPixels() const
+	{
+		return m_data;
+	}
 
-		// ========================== Create staging buffer and copy data to staging buffer
-		vk::BufferCreateInfo stagingCI({}, imageSize, vk::BufferUsageFlagBits::eTransferSrc);
-		VmaAllocationCreateInfo stagingBufAlloc{};
-		stagingBufAlloc.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+	uint32_t ImageData::getWidth() const
+	{
+		return m_width;
+	}
 
-		Buffer stagingBuffer(allocator, stagingCI, stagingBufAlloc);
+	uint32_t ImageData::getHeight() const
+	{
+		return m_height;
+	}
 
-		stagingBuffer.putData(pixels, imageSize);
+	size_t ImageData::getSizeInBytes() const
+	{
+		return static_cast<size_t>(m_width) * m_height * sizeof(uint32_t);
+	}
 
-		stbi_image_free(pixels);
+	uint32_t ImageData::getMipLevelCount() const
+	{
+		return m_mipOffsets.empty() ? 1 : static_cast<uint32_t>(m_mipOffsets.size() - 1);
+	}
+
+	size_t ImageData::getMipLevelOffset(uint32_t level) const
+	{
+		return m_mipOffsets.empty() ? 0 : m_mipOffsets[level];
+	}
+
+	size_t ImageData::getMipChainSize() const
+	{
+		return m_mipOffsets.empty() ? getSizeInBytes() : m_mipOffsets.back();
+	}
+
+
+
+
+
+	static bool isCookedTexturePath(const std::string& filePath)
+	{
+		return std::filesystem::path(filePath).extension() == CookedTexture::s_fileExtension;
+	}
 
+	std::unique_ptr<Texture> Texture::fromFile(VulkanContext& context, const std::string& filePath, bool generateMips, bool srgb)
+	{
+		if (isCookedTexturePath(filePath))
+		{
+			CookedTexture cooked(filePath);
+			UploadBatch batch(context);
+			auto texture = fromCooked(batch, cooked);
+			batch.submitAndWait();
+			return texture;
+		}
+
+		// ========================== Load image data (mips are built on the CPU or come from the mip cache)
+		return fromImageData(context, ImageData::fromFile(filePath, generateMips, srgb), generateMips, srgb);
+	}
+
+	std::unique_ptr<Texture> Texture::fromImageData(VulkanContext& context, const ImageData& image, bool generateMips, bool srgb)
+	{
+		UploadBatch batch(context);
+		auto texture = fromImageData(batch, image, generateMips, srgb);
+		batch.submitAndWait();
+		return texture;
+	}
+
+	std::unique_ptr<Texture> Texture::fromImageData(UploadBatch& batch, const ImageData& image, bool generateMips, bool srgb)
+	{
+		uint32_t texWidth = image.getWidth();
+		uint32_t texHeight = image.getHeight();
+
+		auto& context = batch.getContext();
+		auto allocator = context.getAllocator();
+
+		// Get mip levels
+		// A chain built on the CPU is copied as is, otherwise (image decoded without mips) we fall back to the blit chain
+		bool cpuMips = image.getMipLevelCount() > 1;
+		bool blitMips = generateMips && !cpuMips;
+		uint32_t mipLevels = image.getMipLevelCount();
+		if (blitMips)
+			mipLevels = getMipLevelCount(texWidth, texHeight);
 
 		// =========================== Create texture
 		auto texExtent = vk::Extent3D(texWidth, texHeight, 1);
@@ -111,7 +358,7 @@ namespace Nagi
 			imageFormat = vk::Format::eR8G8B8A8Unorm;
 
 		auto imageUsageBits = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
-		if (generateMips)
+		if (blitMips)
 			imageUsageBits |= vk::ImageUsageFlagBits::eTransferSrc;
 
 		vk::ImageCreateInfo imgCI({},
@@ -126,194 +373,115 @@ namespace Nagi
 		VmaAllocationCreateInfo texAlloc{};
 		texAlloc.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
-		//Texture texture(allocator, context.getDevice(), imgCI, texAlloc);
 		auto texture = std::make_unique<Texture>(allocator, context.getDevice(), imgCI, texAlloc);
 
 		// ======================================= Initial Layout of image is Undefined, we need to transition its layout!
-		auto& uploadContext = context.getUploadContext();
-
-		// Transition layout, copy buffer, transition again to shader read only optimal
-		uploadContext.submitWork(
-			[&](const vk::CommandBuffer& cmd)
-			{
-				vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, 1);	// mipLevels --> makes sure that all mips get transitioned to linear layout
-
-				vk::ImageMemoryBarrier barrierForTransfer(
-					{},
-					vk::AccessFlagBits::eTransferWrite,		// any transfer ops should wait until the image layout transition has occurred!
-					vk::ImageLayout::eUndefined,
-					vk::ImageLayout::eTransferDstOptimal,	// -> puts into linear layout, best for copying data from buffer to texture
-					{},
-					{},
-					texture->getImage(),
-					range
-				);
-
-				// Transition layout through barrier (after availability ops and before visibility ops)
-				cmd.pipelineBarrier(
-					vk::PipelineStageFlagBits::eTopOfPipe,
-					vk::PipelineStageFlagBits::eTransfer,
-					{},
-					{},
-					{},
-					barrierForTransfer
-				);
-
-				// Now we can do our transfer cmd
-				vk::BufferImageCopy copyRegion({}, {}, {},
-					vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
-					{},
-					texExtent
-				);
-
-				cmd.copyBufferToImage(stagingBuffer.getBuffer(), texture->getImage(), vk::ImageLayout::eTransferDstOptimal, copyRegion);
-
-				// IF we dont generate mips --> Transfer layout to shader read optimal
-				// IF we will generate mips --> Leave layout in Transfer Destination Optimal
-				if (!generateMips)
-				{
-					// Now we can transfer the image layout to optimal for shader usage
-					vk::ImageMemoryBarrier barrierForReading(
-						vk::AccessFlagBits::eTransferWrite,
-						vk::AccessFlagBits::eShaderRead,
-						vk::ImageLayout::eTransferDstOptimal,
-						vk::ImageLayout::eShaderReadOnlyOptimal,
-						{},
-						{},
-						texture->getImage(),
-						range
-					);
-
-					// Transition layout to Read Only Optimal through pipeline barrier (after availability ops and before visibility ops)
-					cmd.pipelineBarrier(
-						vk::PipelineStageFlagBits::eTransfer,
-						vk::PipelineStageFlagBits::eFragmentShader,		// guarantee that transition has happened before any subsequent fragment shader reads
-						{},												// above stage doesnt really matter since we are waiting for a Fence in submitWork which waits until the submitted work has COMPLETED execution
-						{},
-						{},
-						barrierForReading
-					);
-				}
-			});
+		vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, 1);	// mipLevels --> makes sure that all mips get transitioned to linear layout
 
+		// any transfer ops should wait until the image layout transition has occurred!
+		batch.transitionImage(texture->getImage(), range,
+			vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+			vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+			{}, vk::AccessFlagBits::eTransferWrite);
 
-		if (generateMips)
+		// Now we can do our transfer cmd (one region per level that is already on the CPU)
+		std::vector<vk::BufferImageCopy> copyRegions;
+		for (uint32_t level = 0; level < image.getMipLevelCount(); ++level)
 		{
-			// Note that each mip is now still in Transfer Dst Optimal state given that generateMips = true
-				// Generate mips
-			uploadContext.submitWork(
-				[&](const vk::CommandBuffer& cmd)
-				{
-					uint32_t mipWidth = texWidth;
-					uint32_t mipHeight = texHeight;
-
-					for (uint32_t i = 1; i < mipLevels; ++i)
-					{
-						// We choose to transition subres i-1 
-						vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, i - 1, 1, 0, 1);
-
-						vk::ImageMemoryBarrier barrierTransitionForBlit(
-							vk::AccessFlagBits::eTransferWrite,
-							vk::AccessFlagBits::eTransferRead,		// we will be reading from mip[i - 1]
-							vk::ImageLayout::eTransferDstOptimal,
-							vk::ImageLayout::eTransferSrcOptimal,
-							{},
-							{},
-							texture->getImage(),
-							range
-						);
-
-						// Make sure any previous transfer writes has been done (both copy from staging but also previous mip blits)
-						cmd.pipelineBarrier(
-							vk::PipelineStageFlagBits::eTransfer,
-							vk::PipelineStageFlagBits::eTransfer,
-							{},
-							{},
-							{},
-							barrierTransitionForBlit
-						);
-
-
-
-						std::array<vk::Offset3D, 2> srcBounds;
-						srcBounds[0] = vk::Offset3D(0, 0, 0);
-						srcBounds[1] = vk::Offset3D(mipWidth, mipHeight, 1);	// tex dim of i-1 texture (which starts at texWidth and texHeight respectively on 0th mip
-
-						std::array<vk::Offset3D, 2> dstBounds;
-						dstBounds[0] = vk::Offset3D(0, 0, 0);
-						dstBounds[1] = vk::Offset3D(mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1);
+			copyRegions.push_back(vk::BufferImageCopy(image.getMipLevelOffset(level), {}, {},
+				vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1),
+				{},
+				vk::Extent3D(std::max(texWidth >> level, 1u), std::max(texHeight >> level, 1u), 1)
+			));
+		}
+		batch.copyToImage(image.getPixels(), image.getMipChainSize(), texture->getImage(), copyRegions);
 
-						vk::ImageSubresourceLayers srcSubres(vk::ImageAspectFlagBits::eColor, i - 1, 0, 1);
-						vk::ImageSubresourceLayers dstSubres(vk::ImageAspectFlagBits::eColor, i, 0, 1);
+		// IF we dont generate mips --> Transfer layout to shader read optimal
+		// IF we will generate mips --> Leave layout in Transfer Destination Optimal and let the blits take care of it
+		if (blitMips)
+			batch.generateMips(texture->getImage(), texWidth, texHeight, mipLevels);
+		else
+			batch.finalizeImage(texture->getImage(), range);
 
-						// Blit image from i-1 to i
-						vk::ImageBlit blitInfo(srcSubres, srcBounds, dstSubres, dstBounds);
+		// ============================ Create image view
+		vk::ComponentMapping componentMapping(vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA);
+		vk::ImageSubresourceRange subresRange(vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, 1);
 
-						cmd.blitImage(texture->getImage(), vk::ImageLayout::eTransferSrcOptimal, texture->getImage(), vk::ImageLayout::eTransferDstOptimal, blitInfo, vk::Filter::eLinear);
+		vk::ImageViewCreateInfo viewCreateInfo({},
+			texture->getImage(),
+			vk::ImageViewType::e2D,
+			imageFormat,
+			componentMapping,
+			subresRange
+		);
 
+		texture->createView(viewCreateInfo);
 
+		return texture;
+	}
 
+	std::unique_ptr<Texture> Texture::fromCooked(UploadBatch& batch, const CookedTexture& cooked, uint32_t firstLevel)
+	{
+		auto& context = batch.getContext();
+		firstLevel = std::min(firstLevel, cooked.getLevelCount() - 1);
+		uint32_t mipLevels = cooked.getLevelCount() - firstLevel;
+		uint32_t width = std::max(cooked.getWidth() >> firstLevel, 1u);
+		uint32_t height = std::max(cooked.getHeight() >> firstLevel, 1u);
+		vk::Format imageFormat = cooked.getFormat();
+		uint32_t layerCount = cooked.getFaceCount();
+		bool cube = layerCount == 6;
 
-						// Done reading from i-1, lets change its layout to shader read optimal
-						barrierTransitionForBlit.setOldLayout(vk::ImageLayout::eTransferSrcOptimal);
-						barrierTransitionForBlit.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
-						barrierTransitionForBlit.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
-						barrierTransitionForBlit.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+		// =========================== Create texture (every level is already in the file, so no blits and no TransferSrc)
+		vk::ImageCreateInfo imgCI(cube ? vk::ImageCreateFlagBits::eCubeCompatible : vk::ImageCreateFlags{},
+			vk::ImageType::e2D, imageFormat,
+			vk::Extent3D(width, height, 1),
+			mipLevels, layerCount,
+			vk::SampleCountFlagBits::e1,
+			vk::ImageTiling::eOptimal,
+			vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled
+		);
 
-						// We guarantee that the image layout transition happens after blit transfer write and happens before shader read in fragment shader
-						cmd.pipelineBarrier(
-							vk::PipelineStageFlagBits::eTransfer,
-							vk::PipelineStageFlagBits::eFragmentShader,
-							{},
-							{},
-							{},
-							barrierTransitionForBlit
-						);
+		VmaAllocationCreateInfo texAlloc{};
+		texAlloc.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
+		auto texture = std::make_unique<Texture>(context.getAllocator(), context.getDevice(), imgCI, texAlloc);
 
-						if (mipWidth > 1) mipWidth /= 2;
-						if (mipHeight > 1) mipHeight /= 2;
-					}
+		vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, layerCount);
+		batch.transitionImage(texture->getImage(), range,
+			vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+			vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+			{}, vk::AccessFlagBits::eTransferWrite);
 
-					// Handle last mip since for loop doesnt take care of it
-					vk::ImageSubresourceRange lastSubresRange(vk::ImageAspectFlagBits::eColor, mipLevels - 1, 1, 0, 1);
-					vk::ImageMemoryBarrier barrierTransitionForBlit(
-						vk::AccessFlagBits::eTransferWrite,
-						vk::AccessFlagBits::eShaderRead,
-						vk::ImageLayout::eTransferDstOptimal,
-						vk::ImageLayout::eShaderReadOnlyOptimal,
-						{},
-						{},
-						texture->getImage(),
-						lastSubresRange
-					);
-
-					cmd.pipelineBarrier(
-						vk::PipelineStageFlagBits::eTransfer,
-						vk::PipelineStageFlagBits::eFragmentShader,
-						{},
-						{},
-						{},
-						barrierTransitionForBlit
-					);
-
-
-
-				});
+		// One region per mip, straight from the mapped file (the faces of a cube level are stored back to back, one region covers all of them)
+		// Levels are stored smallest first, so the levels we want are the front of the data up to the end of firstLevel
+		std::vector<vk::BufferImageCopy> copyRegions;
+		copyRegions.reserve(mipLevels);
+		for (uint32_t level = 0; level < mipLevels; ++level)
+		{
+			copyRegions.push_back(vk::BufferImageCopy(cooked.getLevelOffset(firstLevel + level), {}, {},
+				vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, layerCount),
+				{},
+				vk::Extent3D(std::max(width >> level, 1u), std::max(height >> level, 1u), 1)
+			));
 		}
+		size_t copySize = cooked.getLevelOffset(firstLevel) + cooked.getLevelSize(firstLevel);
+		batch.copyToImage(cooked.getData(), copySize, texture->getImage(), copyRegions);
+		batch.finalizeImage(texture->getImage(), range);
 
-
-		// NOTE TO SELF: We can extend this later for mipmap generation
 		// ============================ Create image view
+		// Single/dual channel formats are swizzled so that shaders see the same channels as with the uncompressed RGBA textures (Z of normals is reconstructed)
 		vk::ComponentMapping componentMapping(vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA);
-		vk::ImageSubresourceRange subresRange(vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, 1);
+		if (imageFormat == vk::Format::eBc4UnormBlock)
+			componentMapping = vk::ComponentMapping(vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eOne);
+		else if (imageFormat == vk::Format::eBc5UnormBlock)
+			componentMapping = vk::ComponentMapping(vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eZero, vk::ComponentSwizzle::eOne);
 
 		vk::ImageViewCreateInfo viewCreateInfo({},
 			texture->getImage(),
-			vk::ImageViewType::e2D,
+			cube ? vk::ImageViewType::eCube : vk::ImageViewType::e2D,
 			imageFormat,
 			componentMapping,
-			subresRange
+			range
 		);
 
 		texture->createView(viewCreateInfo);
@@ -321,42 +489,56 @@ namespace Nagi
 		return texture;
 	}
 
-	std::unique_ptr<Texture> Texture::cubeFromFile(VulkanContext& context, const std::filesystem::path& path, bool srgb)
+	std::unique_ptr<Texture> Texture::cubeFromFile(VulkanContext& context, ThreadPool& decodePool, const std::filesystem::path& path, bool srgb)
 	{
-		// Get all image data
-		// ========================== Load image data
-		std::array<stbi_uc*, 6> cubeData;
-		std::array<std::string, 6> cubePaths{ "posx.jpg", "negx.jpg", "posy.jpg", "negy.jpg", "posz.jpg", "negz.jpg" };
-		int texWidth, texHeight, texChannels;
-		for (size_t i = 0; i < cubeData.size(); ++i)
-		{
-			auto fpath = path.relative_path().string() + cubePaths[i];
-			stbi_uc* pixels = stbi_load(fpath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
-			if (!pixels)
-				throw std::runtime_error("Can't find the image resource: " + fpath);
+		UploadBatch batch(context);
+		auto texture = cubeFromFile(batch, decodePool, path, srgb);
+		batch.submitAndWait();
+		return texture;
+	}
 
-			cubeData[i] = pixels;
-		}
+	std::array<std::filesystem::path, 6> Texture::getCubeFacePaths(const std::filesystem::path& directory)
+	{
+		return { directory / "posx.jpg", directory / "negx.jpg", directory / "posy.jpg", directory / "negy.jpg", directory / "posz.jpg", directory / "negz.jpg" };
+	}
 
-		size_t imageSize = texWidth * texHeight * sizeof(uint32_t);
+	std::unique_ptr<Texture> Texture::cubeFromFile(UploadBatch& batch, ThreadPool& decodePool, const std::filesystem::path& path, bool srgb)
+	{
+		// ========================== Decode the faces (and build their mip chains) in parallel
+		auto facePaths = getCubeFacePaths(path);
+		std::vector<std::future<ImageData>> decodes;
+		decodes.reserve(facePaths.size());
+		for (const auto& facePath : facePaths)
+			decodes.push_back(decodePool.submit([facePath, srgb]() { return ImageData::fromFile(facePath.string(), true, srgb); }));
 
-		auto allocator = context.getAllocator();
+		std::vector<ImageData> faces;
+		faces.reserve(decodes.size());
+		for (auto& decode : decodes)
+			faces.push_back(decode.get());
 
-		// ========================== Create staging buffer and copy data to staging buffer
-		vk::BufferCreateInfo stagingCI({}, imageSize * cubeData.size(), vk::BufferUsageFlagBits::eTransferSrc);
-		VmaAllocationCreateInfo stagingBufAlloc{};
-		stagingBufAlloc.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+		return cubeFromImageData(batch, faces, srgb);
+	}
 
-		Buffer stagingBuffer(allocator, stagingCI, stagingBufAlloc);
+	std::unique_ptr<Texture> Texture::cubeFromImageData(UploadBatch& batch, const std::vector<ImageData>& faces, bool srgb)
+	{
+		if (faces.size() != 6)
+			throw std::runtime_error("A cube needs exactly six faces");
 
-		for (size_t i = 0; i < cubeData.size(); ++i)
+		uint32_t texWidth = faces[0].getWidth();
+		uint32_t texHeight = faces[0].getHeight();
+		uint32_t mipLevels = faces[0].getMipLevelCount();
+		if (texWidth != texHeight)
+			throw std::runtime_error("Cube faces have to be square");
+		for (const auto& face : faces)
 		{
-			stagingBuffer.putData(cubeData[i], imageSize, i * imageSize);
-			stbi_image_free(cubeData[i]);
+			if (face.getWidth() != texWidth || face.getHeight() != texHeight || face.getMipLevelCount() != mipLevels)
+				throw std::runtime_error("Cube faces differ in size");
 		}
 
-		// ========================== We now want to copy the data from our staging buffer into a texture array
+		auto& context = batch.getContext();
+		auto allocator = context.getAllocator();
+
+		// ========================== We want to copy the data into a texture array
 
 		// Create texture array
 		auto texExtent = vk::Extent3D(texWidth, texHeight, 1);
@@ -369,7 +551,7 @@ namespace Nagi
 			vk::ImageCreateFlagBits::eCubeCompatible,
 			vk::ImageType::e2D, imageFormat,
 			texExtent,
-			1, 6,	// 6
+			mipLevels, 6,	// 6
 			vk::SampleCountFlagBits::e1,
 			vk::ImageTiling::eOptimal,
 			imageUsageBits
@@ -378,98 +560,54 @@ namespace Nagi
 		VmaAllocationCreateInfo texAlloc{};
 		texAlloc.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
-		//Texture texture(allocator, context.getDevice(), imgCI, texAlloc);
 		auto texture = std::make_unique<Texture>(allocator, context.getDevice(), imgCI, texAlloc);
 
-	
 		// Copy buffer data to texture in steps:
 		// 1. Transition texture array layout into TransferDstOptimal
-		// 2. Copy from buffer to texture
+		// 2. Copy from staging to texture (one copy per face with a region per level)
 		// 3. Transition texture array into ShaderReadOnlyOptimal
+		vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, 6);		// 6 layers
 
-		auto& uploadContext = context.getUploadContext();
+		batch.transitionImage(texture->getImage(), range,
+			vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+			vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+			{}, vk::AccessFlagBits::eTransferWrite);
 
-		// Transition layout, copy buffer, transition again to shader read only optimal
-		uploadContext.submitWork(
-			[&](const vk::CommandBuffer& cmd)
+		for (uint32_t i = 0; i < faces.size(); ++i)
+		{
+			std::vector<vk::BufferImageCopy> copyRegions;
+			copyRegions.reserve(mipLevels);
+			for (uint32_t level = 0; level < mipLevels; ++level)
 			{
-				vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 6);		// 6 layers
-
-				vk::ImageMemoryBarrier barrierForTransfer(
-					{},
-					vk::AccessFlagBits::eTransferWrite,		// any transfer ops should wait until the image layout transition has occurred!
-					vk::ImageLayout::eUndefined,
-					vk::ImageLayout::eTransferDstOptimal,	// -> puts into linear layout, best for copying data from buffer to texture
-					{},
-					{},
-					texture->getImage(),
-					range
-				);
-
-				// Transition layout through barrier (after availability ops and before visibility ops)
-				cmd.pipelineBarrier(
-					vk::PipelineStageFlagBits::eTopOfPipe,
-					vk::PipelineStageFlagBits::eTransfer,	// any subsequent transfers should wait for this layout transition
-					{},
-					{},
-					{},
-					barrierForTransfer
-				);
-
-				// Now we can do our transfer cmd
-				vk::BufferImageCopy copyRegion({}, {}, {},
-					vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 6),
-					{},
-					texExtent
-				);
-
-				cmd.copyBufferToImage(stagingBuffer.getBuffer(), texture->getImage(), vk::ImageLayout::eTransferDstOptimal, copyRegion);
-
-				// Transition to shader read only optimal
-				vk::ImageMemoryBarrier barrierForReading(
-					vk::AccessFlagBits::eTransferWrite,
-					vk::AccessFlagBits::eShaderRead,
-					vk::ImageLayout::eTransferDstOptimal,
-					vk::ImageLayout::eShaderReadOnlyOptimal,
+				copyRegions.push_back(vk::BufferImageCopy(faces[i].getMipLevelOffset(level), {}, {},
+					vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, i, 1),
 					{},
-					{},
-					texture->getImage(),
-					range	// for all 6 
-				);
-
-				// Transition layout to Read Only Optimal through pipeline barrier (after availability ops and before visibility ops)
-				cmd.pipelineBarrier(
-					vk::PipelineStageFlagBits::eTransfer,
-					vk::PipelineStageFlagBits::eFragmentShader,		// guarantee that transition has happened before any subsequent fragment shader reads
-					{},												
-					{},
-					{},
-					barrierForReading
-				);
-
+					vk::Extent3D(std::max(texWidth >> level, 1u), std::max(texHeight >> level, 1u), 1)
+				));
+			}
+			batch.copyToImage(faces[i].getPixels(), faces[i].getMipChainSize(), texture->getImage(), copyRegions);
+		}
 
-			});
+		batch.finalizeImage(texture->getImage(), range);
 
 		// Create image view
 		vk::ComponentMapping componentMapping(vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA);
-		vk::ImageSubresourceRange subresRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 6);
 
 		vk::ImageViewCreateInfo viewCreateInfo({},
 			texture->getImage(),
 			vk::ImageViewType::eCube,
 			imageFormat,
 			componentMapping,
-			subresRange
+			range
 		);
 
 		texture->createView(viewCreateInfo);
 
-
 		return texture;
 	}
 
-	Material::Material(vk::Pipeline pipeline, vk::PipelineLayout pipelineLayout, vk::DescriptorSet descriptorSet) :
-		m_pipeline(pipeline), m_pipelineLayout(pipelineLayout), m_descriptorSet(descriptorSet)
+	Material::Material(vk::Pipeline pipeline, vk::PipelineLayout pipelineLayout, uint32_t index) :
+		m_pipeline(pipeline), m_pipelineLayout(pipelineLayout), m_index(index)
 	{
 	}
 
@@ -487,28 +625,45 @@ namespace Nagi
 		return m_pipelineLayout;
 	}
 
-	const vk::DescriptorSet& Material::getDescriptorSet() const
+	uint32_t Material::getIndex() const
+	{
+		return m_index;
+	}
+
+	Mesh::Mesh(uint32_t firstIndex, uint32_t numIndices, uint32_t vbOffset, vk::IndexType indexType, uint32_t firstMeshlet, uint32_t numMeshlets) :
+		m_lods{}, m_lodCount(1), m_vbOffset(vbOffset), m_indexType(indexType),
+		m_firstMeshlet(firstMeshlet), m_numMeshlets(numMeshlets),
+		m_boundingSphere(0.f, 0.f, 0.f, std::numeric_limits<float>::max()),
+		m_aabbMin(std::numeric_limits<float>::lowest()),
+		m_aabbMax(std::numeric_limits<float>::max())
 	{
-		return m_descriptorSet;
+		m_lods[0] = { firstIndex, numIndices };
 	}
 
-	Mesh::Mesh(uint32_t firstIndex, uint32_t numIndices, uint32_t vbOffset) :
-		m_ibFirstIndex(firstIndex), m_numIndices(numIndices), m_vbOffset(vbOffset)
+	void Mesh::addLod(uint32_t firstIndex, uint32_t numIndices)
 	{
+		if (m_lodCount >= s_maxLods)
+			throw std::runtime_error("Mesh has too many LODs");
+		m_lods[m_lodCount++] = { firstIndex, numIndices };
 	}
 
 
 
 
 
-	uint32_t Mesh::getFirstIndex() const
+	uint32_t Mesh::getFirstIndex(uint32_t lod) const
+	{
+		return m_lods[std::min(lod, m_lodCount - 1)].firstIndex;
+	}
+
+	uint32_t Mesh::getNumIndices(uint32_t lod) const
 	{
-		return m_ibFirstIndex;
+		return m_lods[std::min(lod, m_lodCount - 1)].numIndices;
 	}
 
-	uint32_t Mesh::getNumIndices() const
+	uint32_t Mesh::getLodCount() const
 	{
-		return m_numIndices;
+		return m_lodCount;
 	}
 
 	uint32_t Mesh::getVertexBufferOffset() const
@@ -516,6 +671,47 @@ namespace Nagi
 		return m_vbOffset;
 	}
 
+	vk::IndexType Mesh::getIndexType() const
+	{
+		return m_indexType;
+	}
+
+	uint32_t Mesh::getFirstMeshlet() const
+	{
+		return m_firstMeshlet;
+	}
+
+	uint32_t Mesh::getNumMeshlets() const
+	{
+		return m_numMeshlets;
+	}
+
+	void Mesh::setBoundingSphere(const glm::vec4& boundingSphere)
+	{
+		m_boundingSphere = boundingSphere;
+	}
+
+	const glm::vec4& Mesh::getBoundingSphere() const
+	{
+		return m_boundingSphere;
+	}
+
+	void Mesh::setAabb(const glm::vec3& aabbMin, const glm::vec3& aabbMax)
+	{
+		m_aabbMin = aabbMin;
+		m_aabbMax = aabbMax;
+	}
+
+	const glm::vec3& Mesh::getAabbMin() const
+	{
+		return m_aabbMin;
+	}
+
+	const glm::vec3& Mesh::getAabbMax() const
+	{
+		return m_aabbMax;
+	}
+
 
 
 
@@ -539,21 +735,72 @@ namespace Nagi
 
 
 
-	RenderModel::RenderModel(std::unique_ptr<Buffer> vb, std::unique_ptr<Buffer> ib, std::vector<RenderUnit> renderUnits) :
-		m_vb(std::move(vb)), m_ib(std::move(ib)),	// Move ownership
-		m_renderUnits(renderUnits)
+	RenderModel::RenderModel(GeometryPool& geometryPool, const GeometryRange& geometry, std::vector<RenderUnit> renderUnits, const PositionQuantization& quantization,
+		std::vector<Meshlet> meshlets, const glm::vec4& boundingSphere) :
+		m_renderUnits(renderUnits),
+		m_quantization(quantization),
+		m_meshlets(std::move(meshlets)),
+		m_boundingSphere(boundingSphere),
+		m_geometryPool(&geometryPool),
+		m_geometry(geometry)
+	{
+	}
+
+	RenderModel::~RenderModel()
+	{
+		if (m_geometryPool != nullptr)
+			m_geometryPool->free(m_geometry);
+	}
+
+	RenderModel::RenderModel(RenderModel&& other) noexcept :
+		m_renderUnits(std::move(other.m_renderUnits)),
+		m_quantization(other.m_quantization),
+		m_meshlets(std::move(other.m_meshlets)),
+		m_boundingSphere(other.m_boundingSphere),
+		m_geometryPool(std::exchange(other.m_geometryPool, nullptr)),
+		m_geometry(std::exchange(other.m_geometry, {}))
 	{
 	}
 
+	RenderModel& RenderModel::operator=(RenderModel&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (m_geometryPool != nullptr)
+				m_geometryPool->free(m_geometry);
+			m_renderUnits = std::move(other.m_renderUnits);
+			m_quantization = other.m_quantization;
+			m_meshlets = std::move(other.m_meshlets);
+			m_boundingSphere = other.m_boundingSphere;
+			m_geometryPool = std::exchange(other.m_geometryPool, nullptr);
+			m_geometry = std::exchange(other.m_geometry, {});
+		}
+		return *this;
+	}
 
 	const vk::Buffer& RenderModel::getVertexBuffer() const
 	{
-		return m_vb.get()->getBuffer();
+		return m_geometryPool->getVertexBuffer();
 	}
 
 	const vk::Buffer& RenderModel::getIndexBuffer() const
 	{
-		return m_ib->getBuffer();
+		return m_geometryPool->getIndexBuffer();
+	}
+
+	const GeometryRange& RenderModel::getGeometry() const
+	{
+		return m_geometry;
+	}
+
+	const PositionQuantization& RenderModel::getPositionQuantization() const
+	{
+		return m_quantization;
+	}
+
+	const glm::vec4& RenderModel::getBoundingSphere() const
+	{
+		return m_boundingSphere;
 	}
 
 	const std::vector<RenderUnit>& RenderModel::getRenderUnits() const
@@ -561,6 +808,11 @@ namespace Nagi
 		return m_renderUnits;
 	}
 
+	const std::vector<Meshlet>& RenderModel::getMeshlets() const
+	{
+		return m_meshlets;
+	}
+
 	bool operator==(const Buffer& a, const Buffer& b)
 	{
 		return a.getBuffer() == b.getBuffer();
@@ -585,7 +837,7 @@ namespace Nagi
 	{
 		return a.getPipeline() == b.getPipeline() &&
 			a.getPipelineLayout() == b.getPipelineLayout() &&
-			a.getDescriptorSet() == b.getDescriptorSet();
+			a.getIndex() == b.getIndex();
 	}
 
 	bool operator!=(const Material& a, const Material& b)
@@ -595,12 +847,10 @@ namespace Nagi
 
 	bool operator<(const Material& a, const Material& b)
 	{
-		// order priority: pipeline 1st and descriptor set 2nd 
-		if (a.getPipeline() < b.getPipeline())
-			return true;
-		else if (a.getDescriptorSet() < b.getDescriptorSet())
-			return true;
-		return false;
+		// order priority: pipeline 1st and material index 2nd (only among equal pipelines, otherwise this is no strict weak ordering)
+		if (a.getPipeline() != b.getPipeline())
+			return a.getPipeline() < b.getPipeline();
+		return a.getIndex() < b.getIndex();
 	}
 
 	bool operator<(const RenderUnit& a, const RenderUnit& b)
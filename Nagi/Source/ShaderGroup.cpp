@@ -153,9 +153,15 @@ namespace Nagi
 	ShaderGroup& ShaderGroup::addStage(vk::ShaderStageFlagBits stage, const std::filesystem::path& path)
 	{
 		StageInfo info{};
-		info.code = readFile(path.string());
+		info.code = std::make_unique<MappedFile>(path);
 		info.stage = stage;
-		m_stages.push_back(info);
+		m_stages.push_back(std::move(info));
+		return *this;
+	}
+
+	ShaderGroup& ShaderGroup::setVertexLayout(const VertexLayout& layout)
+	{
+		m_vertexLayout = layout;
 		return *this;
 	}
 
@@ -163,7 +169,7 @@ namespace Nagi
 	{
 		for (auto& stage : m_stages)
 		{
-			stage.module = dev.createShaderModule(vk::ShaderModuleCreateInfo({}, stage.code.size(), reinterpret_cast<uint32_t*>(stage.code.data())));
+			stage.module = dev.createShaderModule(vk::ShaderModuleCreateInfo({}, stage.code->getSize(), reinterpret_cast<const uint32_t*>(stage.code->getData())));
 			m_deletionQueue.push_back([dev, &stage]() { dev.destroyShaderModule(stage.module); });
 		}
 
@@ -207,7 +213,7 @@ namespace Nagi
 
 	vk::PipelineVertexInputStateCreateInfo ShaderGroup::getVertexInputStateCI()
 	{
-		return m_vertInputState;
+		return vk::PipelineVertexInputStateCreateInfo({}, m_vertInputBindings, m_vertInputAttributes);
 	}
 
 	void ShaderGroup::reflect()
@@ -215,7 +221,7 @@ namespace Nagi
 
 		for (const auto& stage : m_stages)
 		{
-			spv_reflect::ShaderModule spvMod(stage.code);
+			spv_reflect::ShaderModule spvMod(stage.code->getSize(), stage.code->getData());
 			reflectDescriptorSets(spvMod);
 			reflectPushConstantBlocks(spvMod);	// Simply accumulate all Push Constant Ranges for each shader stage
 			reflectVertexInputState(spvMod);
@@ -345,6 +351,32 @@ namespace Nagi
 			inputVarsRefl.resize(ivCount);
 			spvMod.EnumerateInputVariables(&ivCount, inputVarsRefl.data());
 
+			// Built-ins (gl_VertexIndex, gl_InstanceIndex..) are not fed from vertex buffers
+			inputVarsRefl.erase(std::remove_if(inputVarsRefl.begin(), inputVarsRefl.end(),
+				[](const SpvReflectInterfaceVariable* var) { return var->decoration_flags & SPV_REFLECT_DECORATION_BUILT_IN; }), inputVarsRefl.end());
+			ivCount = static_cast<uint32_t>(inputVarsRefl.size());
+			inputAttrDescs.resize(ivCount);
+
+			// A layout is given: the shader decides which locations are consumed, the layout decides how they are stored
+			// (e.g packed snorm/half attributes which reflection alone can't know about)
+			if (m_vertexLayout.has_value())
+			{
+				const auto& layout = m_vertexLayout.value();
+				for (uint32_t ivIdx = 0; ivIdx < ivCount; ++ivIdx)
+				{
+					const auto ivRefl = inputVarsRefl[ivIdx];
+					auto attr = layout.findAttribute(ivRefl->location);
+					if (attr == nullptr)
+						throw std::runtime_error("Vertex layout has no attribute for shader input location " + std::to_string(ivRefl->location));
+
+					inputAttrDescs[ivIdx] = vk::VertexInputAttributeDescription(attr->location, layout.getBinding(), attr->format, attr->offset);
+				}
+
+				m_vertInputBindings = { layout.getBindingDescription() };
+				m_vertInputAttributes = inputAttrDescs;
+				return;
+			}
+
 			// Hardcoded assumptions
 			/*
 				- All input attr is on VB slot 0
@@ -372,9 +404,9 @@ namespace Nagi
 			// Hardcoded assumption above!
 			// We should probably make sure that this is overridable in the future when we want to use e.g per instance data
 			vk::VertexInputBindingDescription inputBindingDesc(vbBindingSlot, stride, vk::VertexInputRate::eVertex);
-			auto inputBindingDescs = { inputBindingDesc };
 
-			m_vertInputState = vk::PipelineVertexInputStateCreateInfo({}, inputBindingDescs, inputAttrDescs);
+			m_vertInputBindings = { inputBindingDesc };
+			m_vertInputAttributes = inputAttrDescs;
 		}
 
 	}
@@ -0,0 +1,123 @@
+#include "pch.h"
+#include "StagingRing.h"
+#include "ResourceTypes.h"
+
+namespace Nagi
+{
+	StagingRing::StagingRing(VmaAllocator allocator, const UploadContext& uploadContext, vk::DeviceSize size) :
+		m_uploadContext(uploadContext),
+		m_size(size)
+	{
+		vk::BufferCreateInfo stagingCI({}, size, vk::BufferUsageFlagBits::eTransferSrc);
+		VmaAllocationCreateInfo stagingBufAllocCI{};
+		stagingBufAllocCI.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+
+		m_buffer = std::make_unique<Buffer>(allocator, stagingCI, stagingBufAllocCI);
+		m_mapped = m_buffer->getMappedData();
+	}
+
+	StagingRing::~StagingRing()
+	{
+		// Retired uploads may still be reading from the ring
+		for (const auto& region : m_regions)
+			m_uploadContext.wait(region.timelineValue);
+	}
+
+	std::optional<StagingRing::Allocation> StagingRing::allocate(const void* owner, vk::DeviceSize size, vk::DeviceSize alignment)
+	{
+		reclaimCompleted();
+
+		// Oldest first, the tail only moves in allocation order
+		auto offset = findSpace(size, alignment);
+		while (!offset && !m_regions.empty() && m_regions.front().retired)
+		{
+			m_uploadContext.wait(m_regions.front().timelineValue);
+			reclaimCompleted();
+			offset = findSpace(size, alignment);
+		}
+
+		if (!offset)
+			return std::nullopt;
+
+		// Consecutive allocations of one owner are tracked as one region
+		vk::DeviceSize end = *offset + size;
+		if (!m_regions.empty() && m_regions.back().owner == owner && !m_regions.back().retired && m_regions.back().end <= *offset)
+		{
+			m_usedSize += end - m_regions.back().end;
+			m_regions.back().end = end;
+		}
+		else
+		{
+			m_usedSize += size;
+			m_regions.push_back({ *offset, end, owner, false, 0 });
+		}
+		m_head = end;
+		m_peakUsedSize = std::max(m_peakUsedSize, m_usedSize);
+
+		return Allocation{ m_buffer->getBuffer(), *offset, m_mapped + *offset };
+	}
+
+	void StagingRing::retire(const void* owner, uint64_t timelineValue)
+	{
+		for (auto& region : m_regions)
+		{
+			if (region.owner == owner && !region.retired)
+			{
+				region.retired = true;
+				region.timelineValue = timelineValue;
+			}
+		}
+	}
+
+	vk::DeviceSize StagingRing::getSize() const
+	{
+		return m_size;
+	}
+
+	vk::DeviceSize StagingRing::getUsedSize() const
+	{
+		return m_usedSize;
+	}
+
+	vk::DeviceSize StagingRing::getPeakUsedSize() const
+	{
+		return m_peakUsedSize;
+	}
+
+	std::optional<vk::DeviceSize> StagingRing::findSpace(vk::DeviceSize size, vk::DeviceSize alignment) const
+	{
+		if (size > m_size)
+			return std::nullopt;
+		if (m_regions.empty())
+			return 0;
+
+		vk::DeviceSize tail = m_regions.front().begin;
+		vk::DeviceSize offset = (m_head + alignment - 1) / alignment * alignment;
+
+		// Free space is [head, end) + [0, tail) when the used part does not wrap, [head, tail) when it does (head == tail is full)
+		if (m_head > tail)
+		{
+			if (offset + size <= m_size)
+				return offset;
+			if (size <= tail)
+				return 0;
+			return std::nullopt;
+		}
+
+		if (offset + size <= tail)
+			return offset;
+		return std::nullopt;
+	}
+
+	void StagingRing::reclaimCompleted()
+	{
+		while (!m_regions.empty() && m_regions.front().retired && m_uploadContext.isComplete(m_regions.front().timelineValue))
+		{
+			m_usedSize -= m_regions.front().end - m_regions.front().begin;
+			m_regions.pop_front();
+		}
+
+		if (m_regions.empty())
+			m_head = 0;
+	}
+}
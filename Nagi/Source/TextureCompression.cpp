@@ -0,0 +1,384 @@
+#include "pch.h"
+#include "TextureCompression.h"
+#include "MipGenerator.h"
+
+#define STB_DXT_IMPLEMENTATION
+#include <stb_dxt.h>
+
+namespace Nagi
+{
+	// BC7 4-bit index interpolation weights (out of 64)
+	static constexpr std::array<int, 16> BC7_WEIGHTS = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	static constexpr uint32_t BC7_MODE6 = 1u << 6;		// Mode is the position of the first set bit
+
+	// Mode 6 endpoint pair after quantization (7 bits per channel + one shared p-bit per endpoint)
+	struct BC7Mode6Block
+	{
+		std::array<std::array<int, 4>, 2> endpoints{};		// Final 8-bit values
+		std::array<uint32_t, 2> pbits{};
+		std::array<uint32_t, 16> indices{};
+		uint32_t error = ~0u;
+	};
+
+	// Packs bits LSB first, which is the order BC7 fields are laid out in
+	class BitWriter
+	{
+	public:
+		BitWriter(uint8_t* dst) : m_dst(dst) { std::fill_n(m_dst, 16, uint8_t(0)); }
+
+		void write(uint32_t value, uint32_t bitCount)
+		{
+			for (uint32_t i = 0; i < bitCount; ++i, ++m_pos)
+				if ((value >> i) & 1)
+					m_dst[m_pos >> 3] |= static_cast<uint8_t>(1u << (m_pos & 7));
+		}
+
+	private:
+		uint8_t* m_dst;
+		uint32_t m_pos = 0;
+	};
+
+	static int quantizeEndpoint(float value, uint32_t pbit)
+	{
+		int q = static_cast<int>(std::round((value - static_cast<float>(pbit)) * 0.5f));
+		return (std::clamp(q, 0, 127) << 1) | static_cast<int>(pbit);
+	}
+
+	// Quantizes the endpoints with the given p-bits and picks the closest palette entry for every pixel
+	static BC7Mode6Block evaluateMode6(const uint8_t* src, const glm::vec4& lo, const glm::vec4& hi, uint32_t p0, uint32_t p1)
+	{
+		BC7Mode6Block block;
+		block.pbits = { p0, p1 };
+		for (uint32_t c = 0; c < 4; ++c)
+		{
+			block.endpoints[0][c] = quantizeEndpoint(lo[c], p0);
+			block.endpoints[1][c] = quantizeEndpoint(hi[c], p1);
+		}
+
+		std::array<std::array<int, 4>, 16> palette;
+		for (uint32_t i = 0; i < 16; ++i)
+			for (uint32_t c = 0; c < 4; ++c)
+				palette[i][c] = ((64 - BC7_WEIGHTS[i]) * block.endpoints[0][c] + BC7_WEIGHTS[i] * block.endpoints[1][c] + 32) >> 6;
+
+		block.error = 0;
+		for (uint32_t p = 0; p < 16; ++p)
+		{
+			const uint8_t* pixel = src + p * 4;
+			uint32_t bestError = ~0u;
+			for (uint32_t i = 0; i < 16; ++i)
+			{
+				uint32_t error = 0;
+				for (uint32_t c = 0; c < 4; ++c)
+				{
+					int diff = static_cast<int>(pixel[c]) - palette[i][c];
+					error += static_cast<uint32_t>(diff * diff);
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					block.indices[p] = i;
+				}
+			}
+			block.error += bestError;
+		}
+		return block;
+	}
+
+	// Opaque blocks need both p-bits set to reach alpha 255, otherwise all four combinations are tried
+	static BC7Mode6Block evaluateMode6AllPbits(const uint8_t* src, const glm::vec4& lo, const glm::vec4& hi, bool opaque)
+	{
+		BC7Mode6Block best;
+		for (uint32_t p0 = opaque ? 1 : 0; p0 < 2; ++p0)
+			for (uint32_t p1 = opaque ? 1 : 0; p1 < 2; ++p1)
+			{
+				auto candidate = evaluateMode6(src, lo, hi, p0, p1);
+				if (candidate.error < best.error)
+					best = candidate;
+			}
+		return best;
+	}
+
+	void encodeBC7Block(const uint8_t* src, uint8_t* dst)
+	{
+		// ======== Principal axis of the block colors (RGBA treated alike)
+		std::array<glm::vec4, 16> pixels;
+		glm::vec4 mean(0.f);
+		glm::vec4 minColor(255.f);
+		glm::vec4 maxColor(0.f);
+		for (uint32_t p = 0; p < 16; ++p)
+		{
+			pixels[p] = glm::vec4(src[p * 4 + 0], src[p * 4 + 1], src[p * 4 + 2], src[p * 4 + 3]);
+			mean += pixels[p];
+			minColor = glm::min(minColor, pixels[p]);
+			maxColor = glm::max(maxColor, pixels[p]);
+		}
+		mean /= 16.f;
+		bool opaque = minColor.a == 255.f;
+
+		glm::mat4 covariance(0.f);
+		for (const auto& pixel : pixels)
+		{
+			glm::vec4 d = pixel - mean;
+			covariance += glm::outerProduct(d, d);
+		}
+
+		// Power iteration, starting from the bounding box diagonal
+		glm::vec4 axis = maxColor - minColor;
+		for (uint32_t i = 0; i < 8 && glm::dot(axis, axis) > 1e-8f; ++i)
+			axis = glm::normalize(covariance * axis);
+
+		float tMin = 0.f;
+		float tMax = 0.f;
+		if (glm::dot(axis, axis) > 1e-8f)
+		{
+			tMin = FLT_MAX;
+			tMax = -FLT_MAX;
+			for (const auto& pixel : pixels)
+			{
+				float t = glm::dot(pixel - mean, axis);
+				tMin = std::min(tMin, t);
+				tMax = std::max(tMax, t);
+			}
+		}
+
+		glm::vec4 lo = glm::clamp(mean + axis * tMin, 0.f, 255.f);
+		glm::vec4 hi = glm::clamp(mean + axis * tMax, 0.f, 255.f);
+		auto best = evaluateMode6AllPbits(src, lo, hi, opaque);
+
+		// ======== Least squares refit of the endpoints to the chosen indices
+		if (best.error > 0)
+		{
+			float aa = 0.f, ab = 0.f, bb = 0.f;
+			glm::vec4 ax(0.f), bx(0.f);
+			for (uint32_t p = 0; p < 16; ++p)
+			{
+				float w = BC7_WEIGHTS[best.indices[p]] / 64.f;
+				aa += (1.f - w) * (1.f - w);
+				ab += (1.f - w) * w;
+				bb += w * w;
+				ax += (1.f - w) * pixels[p];
+				bx += w * pixels[p];
+			}
+
+			float det = aa * bb - ab * ab;
+			if (std::abs(det) > 1e-6f)
+			{
+				glm::vec4 refitLo = glm::clamp((ax * bb - bx * ab) / det, 0.f, 255.f);
+				glm::vec4 refitHi = glm::clamp((bx * aa - ax * ab) / det, 0.f, 255.f);
+				auto refit = evaluateMode6AllPbits(src, refitLo, refitHi, opaque);
+				if (refit.error < best.error)
+					best = refit;
+			}
+		}
+
+		// ======== Anchor index MSB is implicit zero, swap the endpoints if needed
+		if (best.indices[0] & 8)
+		{
+			std::swap(best.endpoints[0], best.endpoints[1]);
+			std::swap(best.pbits[0], best.pbits[1]);
+			for (auto& index : best.indices)
+				index = 15 - index;
+		}
+
+		// ======== Pack: mode, R0 R1 G0 G1 B0 B1 A0 A1 (7 bits), P0 P1, indices (anchor 3 bits, rest 4 bits)
+		BitWriter writer(dst);
+		writer.write(BC7_MODE6, 7);
+		for (uint32_t c = 0; c < 4; ++c)
+		{
+			writer.write(static_cast<uint32_t>(best.endpoints[0][c]) >> 1, 7);
+			writer.write(static_cast<uint32_t>(best.endpoints[1][c]) >> 1, 7);
+		}
+		writer.write(best.pbits[0], 1);
+		writer.write(best.pbits[1], 1);
+		writer.write(best.indices[0], 3);
+		for (uint32_t p = 1; p < 16; ++p)
+			writer.write(best.indices[p], 4);
+	}
+
+	void encodeBC4Block(const uint8_t* src, uint8_t* dst, uint32_t channel)
+	{
+		std::array<uint8_t, 16> values;
+		for (uint32_t p = 0; p < 16; ++p)
+			values[p] = src[p * 4 + channel];
+		stb_compress_bc4_block(dst, values.data());
+	}
+
+	void encodeBC5Block(const uint8_t* src, uint8_t* dst)
+	{
+		std::array<uint8_t, 32> values;
+		for (uint32_t p = 0; p < 16; ++p)
+		{
+			values[p * 2 + 0] = src[p * 4 + 0];
+			values[p * 2 + 1] = src[p * 4 + 1];
+		}
+		stb_compress_bc5_block(dst, values.data());
+	}
+
+	uint32_t getBlockSize(TextureUsage usage)
+	{
+		return usage == TextureUsage::Mask ? 8 : 16;
+	}
+
+	// ======== Mip chain
+
+	// Mips are filtered in float, in the space the usage wants to average in
+	struct FloatImage
+	{
+		uint32_t width = 0;
+		uint32_t height = 0;
+		std::vector<glm::vec4> pixels;
+	};
+
+	static float srgbToLinear(float value)
+	{
+		return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+	}
+
+	static float linearToSrgb(float value)
+	{
+		return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+	}
+
+	static uint8_t toUnorm8(float value)
+	{
+		return static_cast<uint8_t>(std::clamp(value, 0.f, 1.f) * 255.f + 0.5f);
+	}
+
+	uint32_t getMaskChannel(const uint8_t* rgba, uint32_t width, uint32_t height)
+	{
+		// Alpha if the image actually uses it (opacity stored in alpha), red otherwise
+		size_t pixelCount = static_cast<size_t>(width) * height;
+		for (size_t i = 0; i < pixelCount; ++i)
+			if (rgba[i * 4 + 3] != 255)
+				return 3;
+		return 0;
+	}
+
+	static FloatImage toFloatImage(const uint8_t* rgba, uint32_t width, uint32_t height, TextureUsage usage)
+	{
+		std::array<float, 256> srgbTable;
+		for (uint32_t i = 0; i < 256; ++i)
+			srgbTable[i] = srgbToLinear(i / 255.f);
+
+		size_t pixelCount = static_cast<size_t>(width) * height;
+		uint32_t maskChannel = usage == TextureUsage::Mask ? getMaskChannel(rgba, width, height) : 0;
+
+		FloatImage image{ width, height, std::vector<glm::vec4>(pixelCount) };
+		for (size_t i = 0; i < pixelCount; ++i)
+		{
+			const uint8_t* src = rgba + i * 4;
+			auto& dst = image.pixels[i];
+			switch (usage)
+			{
+			case TextureUsage::Color:
+				dst = glm::vec4(srgbTable[src[0]], srgbTable[src[1]], srgbTable[src[2]], src[3] / 255.f);
+				break;
+			case TextureUsage::Mask:
+				dst = glm::vec4(src[maskChannel] / 255.f, 0.f, 0.f, 1.f);
+				break;
+			case TextureUsage::Normal:
+				dst = glm::vec4(glm::vec3(src[0], src[1], src[2]) / 127.5f - 1.f, 0.f);
+				break;
+			case TextureUsage::MaskPair:
+				dst = glm::vec4(src[0] / 255.f, src[1] / 255.f, 0.f, 1.f);
+				break;
+			}
+		}
+		return image;
+	}
+
+	// Box filtered (SSE), normals are renormalized afterwards
+	static FloatImage downsample(const FloatImage& src, TextureUsage usage)
+	{
+		FloatImage dst{ std::max(src.width / 2, 1u), std::max(src.height / 2, 1u), {} };
+		dst.pixels.resize(static_cast<size_t>(dst.width) * dst.height);
+		downsampleBox(src.pixels.data(), src.width, src.height, dst.pixels.data());
+
+		if (usage == TextureUsage::Normal)
+			for (auto& pixel : dst.pixels)
+				if (glm::dot(glm::vec3(pixel), glm::vec3(pixel)) > 1e-8f)
+					pixel = glm::vec4(glm::normalize(glm::vec3(pixel)), 0.f);
+		return dst;
+	}
+
+	static void toRGBA8(const glm::vec4& pixel, TextureUsage usage, uint8_t* dst)
+	{
+		switch (usage)
+		{
+		case TextureUsage::Color:
+			dst[0] = toUnorm8(linearToSrgb(pixel.r));
+			dst[1] = toUnorm8(linearToSrgb(pixel.g));
+			dst[2] = toUnorm8(linearToSrgb(pixel.b));
+			dst[3] = toUnorm8(pixel.a);
+			break;
+		case TextureUsage::Mask:
+			dst[0] = dst[1] = dst[2] = toUnorm8(pixel.r);
+			dst[3] = 255;
+			break;
+		case TextureUsage::Normal:
+			dst[0] = toUnorm8(pixel.x * 0.5f + 0.5f);
+			dst[1] = toUnorm8(pixel.y * 0.5f + 0.5f);
+			dst[2] = toUnorm8(pixel.z * 0.5f + 0.5f);
+			dst[3] = 255;
+			break;
+		case TextureUsage::MaskPair:
+			dst[0] = toUnorm8(pixel.r);
+			dst[1] = toUnorm8(pixel.g);
+			dst[2] = 0;
+			dst[3] = 255;
+			break;
+		}
+	}
+
+	static CompressedMip compressLevel(const FloatImage& image, TextureUsage usage)
+	{
+		uint32_t blocksX = (image.width + 3) / 4;
+		uint32_t blocksY = (image.height + 3) / 4;
+		uint32_t blockSize = getBlockSize(usage);
+
+		CompressedMip mip{ image.width, image.height, {} };
+		mip.data.resize(static_cast<size_t>(blocksX) * blocksY * blockSize);
+
+		std::array<uint8_t, 64> block;
+		for (uint32_t by = 0; by < blocksY; ++by)
+		{
+			for (uint32_t bx = 0; bx < blocksX; ++bx)
+			{
+				// Partial edge blocks repeat the last row/column
+				for (uint32_t p = 0; p < 16; ++p)
+				{
+					uint32_t x = std::min(bx * 4 + p % 4, image.width - 1);
+					uint32_t y = std::min(by * 4 + p / 4, image.height - 1);
+					toRGBA8(image.pixels[static_cast<size_t>(y) * image.width + x], usage, block.data() + p * 4);
+				}
+
+				uint8_t* dst = mip.data.data() + (static_cast<size_t>(by) * blocksX + bx) * blockSize;
+				switch (usage)
+				{
+				case TextureUsage::Color:	encodeBC7Block(block.data(), dst); break;
+				case TextureUsage::Mask:	encodeBC4Block(block.data(), dst, 0); break;
+				case TextureUsage::Normal:
+				case TextureUsage::MaskPair:	encodeBC5Block(block.data(), dst); break;
+				}
+			}
+		}
+		return mip;
+	}
+
+	std::vector<CompressedMip> compressTexture(const uint8_t* rgba, uint32_t width, uint32_t height, TextureUsage usage)
+	{
+		uint32_t mipLevels = getMipLevelCount(width, height);
+
+		std::vector<CompressedMip> mips;
+		mips.reserve(mipLevels);
+
+		auto level = toFloatImage(rgba, width, height, usage);
+		mips.push_back(compressLevel(level, usage));
+		for (uint32_t i = 1; i < mipLevels; ++i)
+		{
+			level = downsample(level, usage);
+			mips.push_back(compressLevel(level, usage));
+		}
+		return mips;
+	}
+}
@@ -0,0 +1,293 @@
+#include "pch.h"
+#include "TextureStreamer.h"
+#include "ResourceTypes.h"
+#include "CookedTexture.h"
+#include "UploadBatch.h"
+#include "Utilities.h"
+
+#include <numeric>
+#include <cstring>
+
+namespace Nagi
+{
+	// Streaming shares the staging ring with everything else, a smaller budget keeps it from holding on to too much of it
+	static constexpr vk::DeviceSize STREAMING_STAGING_BUDGET = 32ull * 1024 * 1024;
+
+	TextureStreamer::TextureStreamer(VulkanContext& context, vk::DeviceSize budget) :
+		m_context(context),
+		m_batch(std::make_unique<UploadBatch>(context, STREAMING_STAGING_BUDGET)),
+		m_budget(budget)
+	{
+	}
+
+	TextureStreamer::~TextureStreamer()
+	{
+		// Pending images may still be written by the transfer queue
+		m_context.getUploadContext().wait(m_pendingValue);
+	}
+
+	TextureStreamer::Handle TextureStreamer::addTexture(UploadBatch& batch, const std::filesystem::path& cookedPath)
+	{
+		StreamedTexture streamed;
+		streamed.cooked = std::make_unique<CookedTexture>(cookedPath);
+		const auto& cooked = *streamed.cooked;
+
+		// The encoders are deterministic, so identical source pixels with the same usage produce identical block data
+		// The hash comes from the cooked file, so none of the levels are read here
+		uint64_t hash = cooked.getContentHash();
+		auto [first, last] = m_texturesByHash.equal_range(hash);
+		for (auto it = first; it != last; ++it)
+		{
+			if (hasSameContent(*m_textures[it->second].cooked, cooked))
+			{
+				++m_dedupStats.hits;
+				m_dedupStats.bytesSaved += cooked.getDataSize();
+				return it->second;
+			}
+		}
+		++m_dedupStats.misses;
+
+		streamed.tailLevel = 0;
+		while (streamed.tailLevel + 1 < cooked.getLevelCount() &&
+			std::max(cooked.getWidth() >> streamed.tailLevel, cooked.getHeight() >> streamed.tailLevel) > s_residentTailSize)
+			++streamed.tailLevel;
+
+		streamed.texture = Texture::fromCooked(batch, cooked, streamed.tailLevel);
+		streamed.residentLevel = streamed.tailLevel;
+		streamed.pendingLevel = streamed.tailLevel;
+		m_residentSize += getSizeFrom(streamed, streamed.residentLevel);
+
+		m_textures.push_back(std::move(streamed));
+		auto handle = static_cast<Handle>(m_textures.size() - 1);
+		m_texturesByHash.insert({ hash, handle });
+		return handle;
+	}
+
+	void TextureStreamer::addBinding(Handle handle, const FrameDescriptorSets& descriptorSets, uint32_t binding, uint32_t arrayElement, vk::Sampler sampler)
+	{
+		assert(handle < m_textures.size());
+		auto& texture = m_textures[handle];
+		texture.bindings.push_back({ descriptorSets, binding, arrayElement, sampler });
+
+		const auto& newBinding = texture.bindings.back();
+		vk::DescriptorImageInfo imageInfo(newBinding.sampler, texture.texture->getImageView(), vk::ImageLayout::eShaderReadOnlyOptimal);
+		std::vector<vk::WriteDescriptorSet> writes;
+		for (auto descriptorSet : newBinding.descriptorSets)
+			writes.push_back(vk::WriteDescriptorSet(descriptorSet, newBinding.binding, newBinding.arrayElement, vk::DescriptorType::eCombinedImageSampler, imageInfo, {}, {}));
+		m_context.getDevice().updateDescriptorSets(writes, {});
+	}
+
+	void TextureStreamer::request(Handle handle, float screenPixels)
+	{
+		assert(handle < m_textures.size());
+		auto& texture = m_textures[handle];
+		texture.requestedPixels = std::max(texture.requestedPixels, screenPixels);
+	}
+
+	void TextureStreamer::update(uint32_t frameIdx)
+	{
+		assert(frameIdx < VulkanContext::getMaxFramesInFlight());
+
+		// The fence of this frame index has signaled, frames submitted up to its last use are done
+		// with the images swapped out back then, and this frame's sets are no longer read
+		m_retiredTextures[frameIdx].clear();
+		for (auto& texture : m_textures)
+		{
+			if (texture.staleFrames & (1u << frameIdx))
+			{
+				writeBindings(texture, frameIdx);
+				texture.staleFrames &= ~(1u << frameIdx);
+			}
+		}
+
+		// One round of uploads at a time, requests keep accumulating until it has landed
+		if (m_pendingValue != 0)
+		{
+			if (!m_context.getUploadContext().isComplete(m_pendingValue))
+				return;
+
+			swapPendingTextures(frameIdx);
+			m_pendingValue = 0;
+			m_batch->trim();
+		}
+
+		// Largest screen coverage first
+		std::vector<uint32_t> order(m_textures.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return m_textures[a].requestedPixels > m_textures[b].requestedPixels; });
+
+		// Tails are always resident, the rest of the budget goes to the desired levels by priority (coarser if the full request does not fit)
+		std::vector<uint32_t> targetLevels(m_textures.size());
+		vk::DeviceSize allotted = 0;
+		for (const auto& texture : m_textures)
+			allotted += getSizeFrom(texture, texture.tailLevel);
+
+		for (auto idx : order)
+		{
+			const auto& texture = m_textures[idx];
+			vk::DeviceSize tailSize = getSizeFrom(texture, texture.tailLevel);
+
+			uint32_t level = getDesiredLevel(texture);
+			while (level < texture.tailLevel && allotted + getSizeFrom(texture, level) - tailSize > m_budget)
+				++level;
+
+			allotted += getSizeFrom(texture, level) - tailSize;
+			targetLevels[idx] = level;
+		}
+
+		// Mips that are already resident are kept while everything fits, otherwise the least important textures drop to their target first
+		std::vector<uint32_t> newLevels(m_textures.size());
+		vk::DeviceSize newSize = 0;
+		for (size_t i = 0; i < m_textures.size(); ++i)
+		{
+			newLevels[i] = std::min(m_textures[i].residentLevel, targetLevels[i]);
+			newSize += getSizeFrom(m_textures[i], newLevels[i]);
+		}
+
+		for (auto it = order.rbegin(); it != order.rend() && newSize > m_budget; ++it)
+		{
+			const auto& texture = m_textures[*it];
+			if (newLevels[*it] >= targetLevels[*it])
+				continue;
+
+			newSize -= getSizeFrom(texture, newLevels[*it]) - getSizeFrom(texture, targetLevels[*it]);
+			newLevels[*it] = targetLevels[*it];
+		}
+
+		// Start the uploads, more detail goes in priority order up to the per update limit (at least one texture so that large ones still make it)
+		// Evictions only copy the small levels and always go through
+		vk::DeviceSize streamed = 0;
+		bool started = false;
+		for (auto idx : order)
+		{
+			auto& texture = m_textures[idx];
+			uint32_t level = newLevels[idx];
+			if (level == texture.residentLevel)
+				continue;
+
+			if (level < texture.residentLevel)
+			{
+				vk::DeviceSize size = getSizeFrom(texture, level);
+				if (streamed != 0 && streamed + size > s_maxStreamedPerUpdate)
+				{
+					// Has to wait for a later update, have the levels in the page cache by then
+					texture.cooked->prefetch(level);
+					continue;
+				}
+				streamed += size;
+			}
+
+			texture.pendingTexture = Texture::fromCooked(*m_batch, *texture.cooked, level);
+			texture.pendingLevel = level;
+			started = true;
+		}
+
+		if (started)
+		{
+			// The batch may already have submitted part of the work early when it ran out of staging memory
+			uint64_t value = m_batch->submit();
+			m_pendingValue = value != 0 ? value : m_batch->getLastSubmittedValue();
+		}
+
+		for (auto& texture : m_textures)
+			texture.requestedPixels = 0.f;
+	}
+
+	void TextureStreamer::setBudget(vk::DeviceSize budget)
+	{
+		m_budget = budget;
+	}
+
+	vk::DeviceSize TextureStreamer::getBudget() const
+	{
+		return m_budget;
+	}
+
+	vk::DeviceSize TextureStreamer::getResidentSize() const
+	{
+		return m_residentSize;
+	}
+
+	uint32_t TextureStreamer::getTextureCount() const
+	{
+		return static_cast<uint32_t>(m_textures.size());
+	}
+
+	uint32_t TextureStreamer::getStreamingCount() const
+	{
+		return static_cast<uint32_t>(std::count_if(m_textures.cbegin(), m_textures.cend(), [](const StreamedTexture& texture) { return texture.pendingTexture != nullptr; }));
+	}
+
+	const TextureStreamer::DedupStats& TextureStreamer::getDedupStats() const
+	{
+		return m_dedupStats;
+	}
+
+	vk::DeviceSize TextureStreamer::getSizeFrom(const StreamedTexture& texture, uint32_t level)
+	{
+		// Levels are stored smallest first, so everything from 'level' down is the front of the data
+		return texture.cooked->getLevelOffset(level) + texture.cooked->getLevelSize(level);
+	}
+
+	uint32_t TextureStreamer::getDesiredLevel(const StreamedTexture& texture)
+	{
+		if (texture.requestedPixels <= 0.f)
+			return texture.tailLevel;
+
+		// Finest level that still has at least one texel per covered pixel
+		float texels = static_cast<float>(std::max(texture.cooked->getWidth(), texture.cooked->getHeight()));
+		float ratio = texels / texture.requestedPixels;
+		uint32_t level = ratio <= 1.f ? 0 : static_cast<uint32_t>(std::floor(std::log2(ratio)));
+		return std::min(level, texture.tailLevel);
+	}
+
+	bool TextureStreamer::hasSameContent(const CookedTexture& a, const CookedTexture& b)
+	{
+		// Only called for equal content hashes, a 64 bit hash match with the same layout is taken as a match
+		// Debug builds still compare the blocks, a failure there is an actual collision
+		bool sameContent = a.getFormat() == b.getFormat() &&
+			a.getWidth() == b.getWidth() &&
+			a.getHeight() == b.getHeight() &&
+			a.getLevelCount() == b.getLevelCount() &&
+			a.getDataSize() == b.getDataSize();
+		assert(!sameContent || std::memcmp(a.getData(), b.getData(), a.getDataSize()) == 0);
+		return sameContent;
+	}
+
+	void TextureStreamer::swapPendingTextures(uint32_t frameIdx)
+	{
+		// Frames in flight may still read the old images through their own sets, which are rewritten when those frames come around again
+		// Only this frame's sets are written now, the old images are kept until this frame index starts again
+		constexpr uint32_t allFrames = (1u << VulkanContext::getMaxFramesInFlight()) - 1;
+		for (auto& texture : m_textures)
+		{
+			if (!texture.pendingTexture)
+				continue;
+
+			m_residentSize -= getSizeFrom(texture, texture.residentLevel);
+			m_residentSize += getSizeFrom(texture, texture.pendingLevel);
+
+			m_retiredTextures[frameIdx].push_back(std::move(texture.texture));
+			texture.texture = std::move(texture.pendingTexture);
+			texture.residentLevel = texture.pendingLevel;
+			writeBindings(texture, frameIdx);
+			texture.staleFrames = allFrames & ~(1u << frameIdx);
+		}
+	}
+
+	void TextureStreamer::writeBindings(const StreamedTexture& texture, uint32_t frameIdx)
+	{
+		std::vector<vk::DescriptorImageInfo> imageInfos;
+		imageInfos.reserve(texture.bindings.size());
+		for (const auto& binding : texture.bindings)
+			imageInfos.push_back(vk::DescriptorImageInfo(binding.sampler, texture.texture->getImageView(), vk::ImageLayout::eShaderReadOnlyOptimal));
+
+		std::vector<vk::WriteDescriptorSet> writes;
+		writes.reserve(texture.bindings.size());
+		for (size_t i = 0; i < texture.bindings.size(); ++i)
+			writes.push_back(vk::WriteDescriptorSet(texture.bindings[i].descriptorSets[frameIdx], texture.bindings[i].binding, texture.bindings[i].arrayElement,
+				vk::DescriptorType::eCombinedImageSampler, imageInfos[i], {}, {}));
+
+		m_context.getDevice().updateDescriptorSets(writes, {});
+	}
+}
@@ -0,0 +1,57 @@
+#include "pch.h"
+#include "ThreadPool.h"
+
+namespace Nagi
+{
+	ThreadPool::ThreadPool(uint32_t threadCount)
+	{
+		threadCount = std::max(threadCount, 1u);
+		m_workers.reserve(threadCount);
+		for (uint32_t i = 0; i < threadCount; ++i)
+			m_workers.emplace_back([this]() { workerLoop(); });
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_cv.notify_all();
+
+		// Workers drain the remaining tasks before exiting so that no future is left without a result
+		for (auto& worker : m_workers)
+			worker.join();
+	}
+
+	uint32_t ThreadPool::getThreadCount() const
+	{
+		return static_cast<uint32_t>(m_workers.size());
+	}
+
+	uint32_t ThreadPool::getDefaultThreadCount()
+	{
+		uint32_t hwThreads = std::thread::hardware_concurrency();
+		return hwThreads > 1 ? hwThreads - 1 : 1;
+	}
+
+	void ThreadPool::workerLoop()
+	{
+		while (true)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cv.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+
+				if (m_tasks.empty())
+					return;		// Stopping and nothing left to do
+
+				task = std::move(m_tasks.front());
+				m_tasks.pop_front();
+			}
+
+			task();
+		}
+	}
+}
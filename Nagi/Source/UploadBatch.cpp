@@ -0,0 +1,405 @@
+#include "pch.h"
+#include "UploadBatch.h"
+#include "ResourceTypes.h"
+#include "StagingRing.h"
+
+namespace Nagi
+{
+	// Satisfies the copy offset rules for every format we upload (4 byte texels, 8/16 byte compressed blocks)
+	static constexpr vk::DeviceSize STAGING_ALIGNMENT = 16;
+
+	// Copies larger than this are split so that a single upload never needs more than a part of the ring
+	static constexpr vk::DeviceSize STAGING_PIECE_SIZE = 16ull * 1024 * 1024;
+
+	// Stages and accesses that read a buffer created with the given usage
+	static std::pair<vk::PipelineStageFlags, vk::AccessFlags> getBufferReaders(vk::BufferUsageFlags usage)
+	{
+		constexpr auto shaderStages = vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader;
+
+		vk::PipelineStageFlags stages;
+		vk::AccessFlags access;
+		if (usage & vk::BufferUsageFlagBits::eVertexBuffer)
+		{
+			stages |= vk::PipelineStageFlagBits::eVertexInput;
+			access |= vk::AccessFlagBits::eVertexAttributeRead;
+		}
+		if (usage & vk::BufferUsageFlagBits::eIndexBuffer)
+		{
+			stages |= vk::PipelineStageFlagBits::eVertexInput;
+			access |= vk::AccessFlagBits::eIndexRead;
+		}
+		if (usage & vk::BufferUsageFlagBits::eUniformBuffer)
+		{
+			stages |= shaderStages;
+			access |= vk::AccessFlagBits::eUniformRead;
+		}
+		if (usage & vk::BufferUsageFlagBits::eStorageBuffer)
+		{
+			stages |= shaderStages;
+			access |= vk::AccessFlagBits::eShaderRead;
+		}
+		if (usage & vk::BufferUsageFlagBits::eIndirectBuffer)
+		{
+			stages |= vk::PipelineStageFlagBits::eDrawIndirect;
+			access |= vk::AccessFlagBits::eIndirectCommandRead;
+		}
+		if (usage & vk::BufferUsageFlagBits::eTransferSrc)
+		{
+			stages |= vk::PipelineStageFlagBits::eTransfer;
+			access |= vk::AccessFlagBits::eTransferRead;
+		}
+
+		assert(stages && "Buffer usage has no reader to hand the data over to");
+		return { stages, access };
+	}
+
+	UploadBatch::UploadBatch(VulkanContext& context, vk::DeviceSize stagingBudget) :
+		m_context(context),
+		m_stagingBudget(stagingBudget)
+	{
+	}
+
+	UploadBatch::~UploadBatch()
+	{
+		// Anything recorded but never submitted is simply dropped, nothing has reached the GPU yet
+		// Submitted work may still be reading from the staging memory though
+		m_context.getUploadContext().getStagingRing().retire(this, 0);
+		m_context.getUploadContext().wait(m_lastSubmittedValue);
+	}
+
+	void UploadBatch::copyToBuffer(const void* data, vk::DeviceSize size, vk::Buffer dst, vk::BufferUsageFlags dstUsage, vk::DeviceSize dstOffset)
+	{
+		const auto* bytes = static_cast<const uint8_t*>(data);
+		for (vk::DeviceSize offset = 0; offset < size; offset += STAGING_PIECE_SIZE)
+		{
+			vk::DeviceSize pieceSize = std::min(STAGING_PIECE_SIZE, size - offset);
+			std::memcpy(mapBufferCopy(pieceSize, dst, dstUsage, dstOffset + offset), bytes + offset, pieceSize);
+		}
+	}
+
+	void* UploadBatch::mapBufferCopy(vk::DeviceSize size, vk::Buffer dst, vk::BufferUsageFlags dstUsage, vk::DeviceSize dstOffset)
+	{
+		assert(size > 0);
+
+		auto staging = stage(size, STAGING_ALIGNMENT);
+		m_transferCommands.push_back(
+			[staging, dst, dstOffset, size](const vk::CommandBuffer& cmd)
+			{
+				vk::BufferCopy copyRegion(staging.offset, dstOffset, size);
+				cmd.copyBuffer(staging.buffer, dst, copyRegion);
+			});
+
+		// Pieces of one copy are consecutive, they extend the last handoff instead of adding barriers
+		auto handoff = std::find_if(m_bufferHandoffs.begin(), m_bufferHandoffs.end(),
+			[dst, dstOffset](const BufferHandoff& h) { return h.buffer == dst && h.offset + h.size == dstOffset; });
+		if (handoff != m_bufferHandoffs.end())
+		{
+			handoff->size += size;
+		}
+		else
+		{
+			auto [dstStage, dstAccess] = getBufferReaders(dstUsage);
+			m_bufferHandoffs.push_back({ dst, dstOffset, size, dstStage, dstAccess });
+		}
+
+		return staging.mapped;
+	}
+
+	void UploadBatch::copyToImage(const void* data, vk::DeviceSize size, vk::Image dst, const std::vector<vk::BufferImageCopy>& regions)
+	{
+		const auto* bytes = static_cast<const uint8_t*>(data);
+		if (size <= STAGING_PIECE_SIZE)
+		{
+			recordImageCopy(bytes, size, dst, regions);
+			return;
+		}
+
+		// Split at region boundaries (a region reads up to the next one in memory), single regions larger than a piece stay whole
+		auto sortedRegions = regions;
+		std::sort(sortedRegions.begin(), sortedRegions.end(), [](const auto& a, const auto& b) { return a.bufferOffset < b.bufferOffset; });
+		auto getRegionEnd = [&](size_t idx) { return idx + 1 < sortedRegions.size() ? sortedRegions[idx + 1].bufferOffset : size; };
+
+		size_t first = 0;
+		while (first < sortedRegions.size())
+		{
+			vk::DeviceSize begin = sortedRegions[first].bufferOffset;
+			size_t last = first;
+			while (last + 1 < sortedRegions.size() && getRegionEnd(last + 1) - begin <= STAGING_PIECE_SIZE)
+				++last;
+
+			std::vector<vk::BufferImageCopy> pieceRegions(sortedRegions.begin() + first, sortedRegions.begin() + last + 1);
+			for (auto& region : pieceRegions)
+				region.bufferOffset -= begin;
+			recordImageCopy(bytes + begin, getRegionEnd(last) - begin, dst, std::move(pieceRegions));
+
+			first = last + 1;
+		}
+	}
+
+	void UploadBatch::transitionImage(vk::Image image, const vk::ImageSubresourceRange& range,
+		vk::ImageLayout oldLayout, vk::ImageLayout newLayout,
+		vk::PipelineStageFlags srcStage, vk::PipelineStageFlags dstStage,
+		vk::AccessFlags srcAccess, vk::AccessFlags dstAccess)
+	{
+		m_transferCommands.push_back(
+			[=](const vk::CommandBuffer& cmd)
+			{
+				vk::ImageMemoryBarrier barrier(srcAccess, dstAccess, oldLayout, newLayout, {}, {}, image, range);
+				cmd.pipelineBarrier(srcStage, dstStage, {}, {}, {}, barrier);
+			});
+	}
+
+	void UploadBatch::finalizeImage(vk::Image image, const vk::ImageSubresourceRange& range)
+	{
+		// guarantee that transition has happened before any subsequent fragment shader reads
+		m_imageHandoffs.push_back({ image, range, vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead });
+	}
+
+	void UploadBatch::generateMips(vk::Image image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t layerCount)
+	{
+		// Blits need a graphics capable queue, hand all levels over as they are and blit there
+		vk::ImageSubresourceRange allLevels(vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, layerCount);
+		m_imageHandoffs.push_back({ image, allLevels, vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite });
+
+		m_graphicsCommands.push_back(
+			[=](const vk::CommandBuffer& cmd)
+			{
+				uint32_t mipWidth = width;
+				uint32_t mipHeight = height;
+
+				for (uint32_t i = 1; i < mipLevels; ++i)
+				{
+					// We choose to transition subres i-1
+					vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, i - 1, 1, 0, layerCount);
+
+					vk::ImageMemoryBarrier barrierTransitionForBlit(
+						vk::AccessFlagBits::eTransferWrite,
+						vk::AccessFlagBits::eTransferRead,		// we will be reading from mip[i - 1]
+						vk::ImageLayout::eTransferDstOptimal,
+						vk::ImageLayout::eTransferSrcOptimal,
+						{},
+						{},
+						image,
+						range
+					);
+
+					// Make sure any previous transfer writes has been done (both copy from staging but also previous mip blits)
+					cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, barrierTransitionForBlit);
+
+					std::array<vk::Offset3D, 2> srcBounds;
+					srcBounds[0] = vk::Offset3D(0, 0, 0);
+					srcBounds[1] = vk::Offset3D(mipWidth, mipHeight, 1);	// tex dim of i-1 texture (which starts at width and height respectively on 0th mip
+
+					std::array<vk::Offset3D, 2> dstBounds;
+					dstBounds[0] = vk::Offset3D(0, 0, 0);
+					dstBounds[1] = vk::Offset3D(mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1);
+
+					vk::ImageSubresourceLayers srcSubres(vk::ImageAspectFlagBits::eColor, i - 1, 0, layerCount);
+					vk::ImageSubresourceLayers dstSubres(vk::ImageAspectFlagBits::eColor, i, 0, layerCount);
+
+					// Blit image from i-1 to i
+					vk::ImageBlit blitInfo(srcSubres, srcBounds, dstSubres, dstBounds);
+					cmd.blitImage(image, vk::ImageLayout::eTransferSrcOptimal, image, vk::ImageLayout::eTransferDstOptimal, blitInfo, vk::Filter::eLinear);
+
+					// Done reading from i-1, lets change its layout to shader read optimal
+					barrierTransitionForBlit.setOldLayout(vk::ImageLayout::eTransferSrcOptimal);
+					barrierTransitionForBlit.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+					barrierTransitionForBlit.setSrcAccessMask(vk::AccessFlagBits::eTransferRead);
+					barrierTransitionForBlit.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+
+					cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {}, barrierTransitionForBlit);
+
+					if (mipWidth > 1) mipWidth /= 2;
+					if (mipHeight > 1) mipHeight /= 2;
+				}
+
+				// Handle last mip since for loop doesnt take care of it
+				vk::ImageSubresourceRange lastSubresRange(vk::ImageAspectFlagBits::eColor, mipLevels - 1, 1, 0, layerCount);
+				vk::ImageMemoryBarrier lastBarrier(
+					vk::AccessFlagBits::eTransferWrite,
+					vk::AccessFlagBits::eShaderRead,
+					vk::ImageLayout::eTransferDstOptimal,
+					vk::ImageLayout::eShaderReadOnlyOptimal,
+					{},
+					{},
+					image,
+					lastSubresRange
+				);
+
+				cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {}, lastBarrier);
+			});
+	}
+
+	uint64_t UploadBatch::submit()
+	{
+		if (isEmpty())
+			return 0;
+
+		auto& uploadContext = m_context.getUploadContext();
+		bool dedicatedTransfer = uploadContext.hasDedicatedTransferQueue();
+		uint32_t srcFamily = dedicatedTransfer ? uploadContext.getTransferQueueFamily() : VK_QUEUE_FAMILY_IGNORED;
+		uint32_t dstFamily = dedicatedTransfer ? uploadContext.getGraphicsQueueFamily() : VK_QUEUE_FAMILY_IGNORED;
+
+		// Ownership transfer barriers, the release (transfer queue) and acquire (graphics queue) halves must match
+		// With a shared family the acquire half is simply a regular barrier/layout transition
+		std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+		bufferBarriers.reserve(m_bufferHandoffs.size());
+		vk::PipelineStageFlags acquireStages;
+		for (const auto& handoff : m_bufferHandoffs)
+		{
+			bufferBarriers.push_back(vk::BufferMemoryBarrier(
+				vk::AccessFlagBits::eTransferWrite, handoff.dstAccess,
+				srcFamily, dstFamily,
+				handoff.buffer, handoff.offset, handoff.size));
+			acquireStages |= handoff.dstStage;
+		}
+
+		std::vector<vk::ImageMemoryBarrier> imageBarriers;
+		imageBarriers.reserve(m_imageHandoffs.size());
+		for (const auto& handoff : m_imageHandoffs)
+		{
+			imageBarriers.push_back(vk::ImageMemoryBarrier(
+				vk::AccessFlagBits::eTransferWrite, handoff.dstAccess,
+				vk::ImageLayout::eTransferDstOptimal, handoff.newLayout,
+				srcFamily, dstFamily,
+				handoff.image, handoff.range));
+			acquireStages |= handoff.dstStage;
+		}
+
+		bool hasHandoffs = !bufferBarriers.empty() || !imageBarriers.empty();
+
+		auto transferWork = [&](const vk::CommandBuffer& cmd)
+		{
+			for (const auto& command : m_transferCommands)
+				command(cmd);
+
+			// Release, dst access is ignored on this queue
+			if (dedicatedTransfer && hasHandoffs)
+			{
+				auto releaseBuffers = bufferBarriers;
+				for (auto& barrier : releaseBuffers)
+					barrier.setDstAccessMask({});
+				auto releaseImages = imageBarriers;
+				for (auto& barrier : releaseImages)
+					barrier.setDstAccessMask({});
+
+				cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, releaseBuffers, releaseImages);
+			}
+		};
+
+		auto graphicsWork = [&](const vk::CommandBuffer& cmd)
+		{
+			// Acquire, src access is ignored on this queue (the timeline wait already covers the transfer queue writes)
+			if (hasHandoffs)
+			{
+				if (dedicatedTransfer)
+				{
+					for (auto& barrier : bufferBarriers)
+						barrier.setSrcAccessMask({});
+					for (auto& barrier : imageBarriers)
+						barrier.setSrcAccessMask({});
+				}
+
+				cmd.pipelineBarrier(
+					dedicatedTransfer ? vk::PipelineStageFlagBits::eTopOfPipe : vk::PipelineStageFlagBits::eTransfer,
+					acquireStages,
+					{}, {}, bufferBarriers, imageBarriers);
+			}
+
+			for (const auto& command : m_graphicsCommands)
+				command(cmd);
+		};
+
+		m_lastSubmittedValue = uploadContext.submitAsync(transferWork, graphicsWork);
+
+		// Everything staged so far is read by this submit
+		uploadContext.getStagingRing().retire(this, m_lastSubmittedValue);
+		for (auto& staging : m_dedicatedStaging)
+			if (staging.lastUseValue == 0)
+				staging.lastUseValue = m_lastSubmittedValue;
+
+		m_transferCommands.clear();
+		m_graphicsCommands.clear();
+		m_bufferHandoffs.clear();
+		m_imageHandoffs.clear();
+
+		m_stagedThisBatch = 0;
+
+		return m_lastSubmittedValue;
+	}
+
+	void UploadBatch::submitAndWait()
+	{
+		m_context.getUploadContext().wait(submit());
+	}
+
+	void UploadBatch::trim()
+	{
+		const auto& uploadContext = m_context.getUploadContext();
+		m_dedicatedStaging.erase(std::remove_if(m_dedicatedStaging.begin(), m_dedicatedStaging.end(),
+			[&uploadContext](const DedicatedStaging& staging) { return staging.lastUseValue != 0 && uploadContext.isComplete(staging.lastUseValue); }),
+			m_dedicatedStaging.end());
+	}
+
+	bool UploadBatch::isEmpty() const
+	{
+		return m_transferCommands.empty() && m_graphicsCommands.empty() && m_bufferHandoffs.empty() && m_imageHandoffs.empty();
+	}
+
+	uint64_t UploadBatch::getLastSubmittedValue() const
+	{
+		return m_lastSubmittedValue;
+	}
+
+	VulkanContext& UploadBatch::getContext() const
+	{
+		return m_context;
+	}
+
+	UploadBatch::StagingAllocation UploadBatch::stage(vk::DeviceSize size, vk::DeviceSize alignment)
+	{
+		// Submit early rather than holding on to a large part of the ring
+		if (m_stagedThisBatch > 0 && m_stagedThisBatch + size > m_stagingBudget)
+			submit();
+
+		// A full ring with our own staging in it frees up once that is submitted
+		auto& ring = m_context.getUploadContext().getStagingRing();
+		auto allocation = ring.allocate(this, size, alignment);
+		if (!allocation && m_stagedThisBatch > 0)
+		{
+			submit();
+			allocation = ring.allocate(this, size, alignment);
+		}
+
+		m_stagedThisBatch += size;
+		if (allocation)
+			return { allocation->buffer, allocation->offset, allocation->mapped };
+
+		// Larger than the ring, or the ring is held by staging another batch has not submitted yet
+		trim();
+		vk::BufferCreateInfo stagingCI({}, size, vk::BufferUsageFlagBits::eTransferSrc);
+		VmaAllocationCreateInfo stagingBufAllocCI{};
+		stagingBufAllocCI.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+
+		m_dedicatedStaging.push_back({ std::make_unique<Buffer>(m_context.getAllocator(), stagingCI, stagingBufAllocCI), 0 });
+		auto& staging = m_dedicatedStaging.back();
+		return { staging.buffer->getBuffer(), 0, staging.buffer->getMappedData() };
+	}
+
+	void UploadBatch::recordImageCopy(const uint8_t* data, vk::DeviceSize size, vk::Image dst, std::vector<vk::BufferImageCopy> regions)
+	{
+		auto staging = stage(size, STAGING_ALIGNMENT);
+		std::memcpy(staging.mapped, data, size);
+
+		// Rebase the regions onto the staging memory
+		for (auto& region : regions)
+			region.bufferOffset += staging.offset;
+
+		m_transferCommands.push_back(
+			[staging, dst, regions](const vk::CommandBuffer& cmd)
+			{
+				cmd.copyBufferToImage(staging.buffer, dst, vk::ImageLayout::eTransferDstOptimal, regions);
+			});
+	}
+
+}
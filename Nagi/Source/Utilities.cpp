@@ -1,31 +1,226 @@
 #include "pch.h"
 #include "Utilities.h"
 
+#include <cstring>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <Windows.h>
+	#include <Psapi.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/resource.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
 namespace Nagi
 {
 
-std::vector<uint8_t> readFile(const std::string& filePath)
+uint32_t getAlignedSize(uint32_t size, uint32_t toAlignWith)
 {
-	std::ifstream file(filePath, std::ios::ate | std::ios::binary);
-	if (!file.is_open())
-		assert(false);	// failed to open file
+	return size % toAlignWith == 0 ?
+		size :
+		size + (toAlignWith - (size % toAlignWith));
+}
+
+
+MappedFile::MappedFile(const std::filesystem::path& filePath)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Could not open file for mapping: " + filePath.string());
+	m_fileHandle = file;
+
+	LARGE_INTEGER fileSize{};
+	GetFileSizeEx(file, &fileSize);
+	m_size = static_cast<size_t>(fileSize.QuadPart);
+
+	// Zero sized files can't be mapped, we simply expose an empty range
+	if (m_size == 0)
+		return;
+
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		throw std::runtime_error("Could not create file mapping: " + filePath.string());
+	}
+	m_mappingHandle = mapping;
 
-	size_t fileSize = static_cast<size_t>(file.tellg());
-	std::vector<uint8_t> buffer(fileSize);
+	m_data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (m_data == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		throw std::runtime_error("Could not map view of file: " + filePath.string());
+	}
+#else
+	m_fd = open(filePath.c_str(), O_RDONLY);
+	if (m_fd < 0)
+		throw std::runtime_error("Could not open file for mapping: " + filePath.string());
 
-	file.seekg(0);  // go back to the beginning
-	file.read((char*)buffer.data(), fileSize);     // read "filSize" from file, put into buffer.data()
+	struct stat st{};
+	fstat(m_fd, &st);
+	m_size = static_cast<size_t>(st.st_size);
 
-	file.close();
+	if (m_size == 0)
+		return;
 
-	return buffer;
+	void* mapped = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if (mapped == MAP_FAILED)
+	{
+		close(m_fd);
+		throw std::runtime_error("Could not map file: " + filePath.string());
+	}
+	m_data = static_cast<const uint8_t*>(mapped);
+#endif
 }
 
-uint32_t getAlignedSize(uint32_t size, uint32_t toAlignWith)
+MappedFile::~MappedFile()
 {
-	return size % toAlignWith == 0 ?
-		size :
-		size + (toAlignWith - (size % toAlignWith));
+#ifdef _WIN32
+	if (m_data != nullptr)
+		UnmapViewOfFile(m_data);
+	if (m_mappingHandle != nullptr)
+		CloseHandle(m_mappingHandle);
+	if (m_fileHandle != nullptr)
+		CloseHandle(m_fileHandle);
+#else
+	if (m_data != nullptr)
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+	if (m_fd >= 0)
+		close(m_fd);
+#endif
+}
+
+size_t getPeakMemoryUsage()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters{};
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage{};
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;		// KB on Linux
+#endif
+}
+
+// XXH64 (https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md)
+static constexpr uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ull;
+static constexpr uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ull;
+static constexpr uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ull;
+static constexpr uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ull;
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+template<typename T>
+static T readUnaligned(const uint8_t* p)
+{
+	T value;
+	std::memcpy(&value, p, sizeof(T));
+	return value;
+}
+
+static uint64_t xxhRound(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+static uint64_t xxhMergeRound(uint64_t acc, uint64_t val)
+{
+	acc ^= xxhRound(0, val);
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	const uint8_t* end = p + size;
+	uint64_t hash;
+
+	if (size >= 32)
+	{
+		// Four independent lanes over 32 byte stripes
+		uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+		uint64_t v2 = seed + XXH_PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - XXH_PRIME64_1;
+		for (; p + 32 <= end; p += 32)
+		{
+			v1 = xxhRound(v1, readUnaligned<uint64_t>(p));
+			v2 = xxhRound(v2, readUnaligned<uint64_t>(p + 8));
+			v3 = xxhRound(v3, readUnaligned<uint64_t>(p + 16));
+			v4 = xxhRound(v4, readUnaligned<uint64_t>(p + 24));
+		}
+		hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		hash = xxhMergeRound(hash, v1);
+		hash = xxhMergeRound(hash, v2);
+		hash = xxhMergeRound(hash, v3);
+		hash = xxhMergeRound(hash, v4);
+	}
+	else
+		hash = seed + XXH_PRIME64_5;
+
+	hash += static_cast<uint64_t>(size);
+
+	// Tail
+	for (; p + 8 <= end; p += 8)
+		hash = rotl64(hash ^ xxhRound(0, readUnaligned<uint64_t>(p)), 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	if (p + 4 <= end)
+	{
+		hash = rotl64(hash ^ (readUnaligned<uint32_t>(p) * XXH_PRIME64_1), 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; ++p)
+		hash = rotl64(hash ^ (*p * XXH_PRIME64_5), 11) * XXH_PRIME64_1;
+
+	// Avalanche
+	hash ^= hash >> 33;
+	hash *= XXH_PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= XXH_PRIME64_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+const uint8_t* MappedFile::getData() const
+{
+	return m_data;
+}
+
+size_t MappedFile::getSize() const
+{
+	return m_size;
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const
+{
+	if (m_data == nullptr || offset >= m_size)
+		return;
+	size = std::min(size, m_size - offset);
+
+#ifdef _WIN32
+	WIN32_MEMORY_RANGE_ENTRY range{ const_cast<uint8_t*>(m_data + offset), size };
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+	// madvise wants a page aligned start
+	size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t alignedOffset = offset - offset % pageSize;
+	madvise(const_cast<uint8_t*>(m_data + alignedOffset), size + (offset - alignedOffset), MADV_WILLNEED);
+#endif
 }
 
 
@@ -0,0 +1,75 @@
+#include "pch.h"
+#include "VertexLayout.h"
+
+namespace Nagi
+{
+	VertexLayout::VertexLayout(uint32_t stride, std::vector<Attribute> attributes, uint32_t binding) :
+		m_stride(stride),
+		m_binding(binding),
+		m_attributes(std::move(attributes))
+	{
+	}
+
+	uint32_t VertexLayout::getStride() const
+	{
+		return m_stride;
+	}
+
+	uint32_t VertexLayout::getBinding() const
+	{
+		return m_binding;
+	}
+
+	const std::vector<VertexLayout::Attribute>& VertexLayout::getAttributes() const
+	{
+		return m_attributes;
+	}
+
+	const VertexLayout::Attribute* VertexLayout::findAttribute(uint32_t location) const
+	{
+		auto it = std::find_if(m_attributes.cbegin(), m_attributes.cend(), [location](const Attribute& attr) { return attr.location == location; });
+		return it != m_attributes.cend() ? &(*it) : nullptr;
+	}
+
+	vk::VertexInputBindingDescription VertexLayout::getBindingDescription() const
+	{
+		return vk::VertexInputBindingDescription(m_binding, m_stride, vk::VertexInputRate::eVertex);
+	}
+
+	PositionQuantization PositionQuantization::fromBounds(const glm::vec3& min, const glm::vec3& max)
+	{
+		PositionQuantization quantization;
+		glm::vec3 halfExtent = (max - min) * 0.5f;
+
+		// Flat axes would otherwise divide by zero
+		for (int i = 0; i < 3; ++i)
+			if (halfExtent[i] <= 0.f)
+				halfExtent[i] = 1.f;
+
+		quantization.scale = glm::vec4(halfExtent, 1.f);
+		quantization.offset = glm::vec4((max + min) * 0.5f, 0.f);
+		return quantization;
+	}
+
+	glm::vec3 PositionQuantization::quantize(const glm::vec3& position) const
+	{
+		return glm::clamp((position - glm::vec3(offset)) / glm::vec3(scale), glm::vec3(-1.f), glm::vec3(1.f));
+	}
+
+	glm::vec2 octEncode(const glm::vec3& n)
+	{
+		float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+		if (l1 == 0.f)
+			return glm::vec2(0.f);
+
+		// Project onto the octahedron and fold the lower hemisphere over the diagonals
+		glm::vec2 p = glm::vec2(n.x, n.y) / l1;
+		if (n.z < 0.f)
+		{
+			p = glm::vec2(
+				(1.f - std::abs(p.y)) * (p.x >= 0.f ? 1.f : -1.f),
+				(1.f - std::abs(p.x)) * (p.y >= 0.f ? 1.f : -1.f));
+		}
+		return p;
+	}
+}
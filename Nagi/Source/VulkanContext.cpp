@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "VulkanContext.h"
 #include "Window.h"
+#include "StagingRing.h"
 
 // VMA
 #define VMA_IMPLEMENTATION
@@ -54,8 +55,8 @@ VulkanContext::VulkanContext(const Window& win, bool debugLayer) :
 			createCommandBuffers(m_device, m_gfxCmdPools[i]);
 		}
 
-		// Create an upload context to send data to GPU (We are using the graphics queue)
-		m_uploadContext = std::make_unique<UploadContext>(m_device, m_gfxQueue, m_queueFamilies.gphIdx.value());
+		// Create an upload context to send data to GPU (Uses the transfer queue if there is a dedicated one)
+		m_uploadContext = std::make_unique<UploadContext>(m_device, m_allocator, m_gfxQueue, m_queueFamilies.gphIdx.value(), m_transferQueue, m_queueFamilies.transferIdx.value());
 
 	}
 	catch (vk::SystemError& err)
@@ -193,6 +194,17 @@ void VulkanContext::submitQueue(const vk::SubmitInfo& info)
 	}
 }
 
+void VulkanContext::waitForFramesInFlight()
+{
+	// Fences of frames that were never submitted start out signaled, so this can't block forever
+	std::vector<vk::Fence> fences;
+	fences.reserve(m_frameSyncResources.size());
+	for (const auto& res : m_frameSyncResources)
+		fences.push_back(res.inFlightFence);
+
+	auto waitRes = m_device.waitForFences(fences, VK_TRUE, std::numeric_limits<uint64_t>::max());
+}
+
 void VulkanContext::endFrame()
 {
 	try
@@ -232,6 +244,16 @@ const vk::PhysicalDeviceProperties& VulkanContext::getPhysicalDeviceProperties()
 	return m_physicalDeviceProperties;
 }
 
+bool VulkanContext::hasDrawIndirectCount() const
+{
+	return m_drawIndirectCount;
+}
+
+bool VulkanContext::hasMultiDrawIndirect() const
+{
+	return m_multiDrawIndirect;
+}
+
 uint32_t VulkanContext::getSwapchainImageCount() const
 {
 	return m_swapchainImageCount;
@@ -273,7 +295,7 @@ VKAPI_ATTR VkBool32 VKAPI_CALL VulkanContext::debugCallback(VkDebugUtilsMessageS
 
 void VulkanContext::createInstance(std::vector<const char*> requiredExtensions, bool debugLayer)
 {
-	vk::ApplicationInfo appInfo("Nagi App", 1, "Nagi Engine", 1, VK_API_VERSION_1_1);
+	vk::ApplicationInfo appInfo("Nagi App", 1, "Nagi Engine", 1, VK_API_VERSION_1_2);		// 1.2 for timeline semaphores
 
 	std::vector<const char*> validationLayers;
 	if (debugLayer)
@@ -388,6 +410,28 @@ QueueFamilies VulkanContext::findQueueFamilies(const vk::PhysicalDevice& physica
 			}
 	}
 
+	// Get transfer family
+	// Prefer a transfer-only family (DMA engine), then any non-graphics family with transfer. Otherwise uploads share the graphics queue.
+	auto transferFamIt = std::find_if(qfps.begin(), qfps.end(),
+		[](vk::QueueFamilyProperties const& qfp)
+		{
+			return (qfp.queueFlags & vk::QueueFlagBits::eTransfer) &&
+				!(qfp.queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute));
+		}
+	);
+	if (transferFamIt == qfps.end())
+		transferFamIt = std::find_if(qfps.begin(), qfps.end(),
+			[](vk::QueueFamilyProperties const& qfp)
+			{
+				return (qfp.queueFlags & vk::QueueFlagBits::eTransfer) && !(qfp.queueFlags & vk::QueueFlagBits::eGraphics);
+			}
+		);
+
+	if (transferFamIt != qfps.end())
+		qfms.transferIdx = static_cast<uint32_t>(std::distance(qfps.begin(), transferFamIt));
+	else
+		qfms.transferIdx = qfms.gphIdx;
+
 	if (!qfms.isComplete())
 		throw std::runtime_error("Couldn't find all queue families!");
 
@@ -460,7 +504,7 @@ void VulkanContext::createLogicalDevice(const vk::PhysicalDevice& physicalDevice
 	// The Vulkan spec states: The queueFamilyIndex member of each element of pQueueCreateInfos must be unique within pQueueCreateInfos (hence we use set)
 	// (https://vulkan.lunarg.com/doc/view/1.2.176.1/windows/1.2-extensions/vkspec.html#VUID-VkDeviceCreateInfo-queueFamilyIndex-00372)
 	std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
-	std::set<uint32_t> uniqueQfs = { qfs.gphIdx.value(), qfs.presentIdx.value() };
+	std::set<uint32_t> uniqueQfs = { qfs.gphIdx.value(), qfs.presentIdx.value(), qfs.transferIdx.value() };
 
 	queueCreateInfos.reserve(queueCreateInfos.size());
 	float queuePriority = 1.0f;
@@ -476,19 +520,58 @@ void VulkanContext::createLogicalDevice(const vk::PhysicalDevice& physicalDevice
 	// Enable device specific extension
 	std::vector<const char*> enabledExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 
+	// What the device supports, required features that are missing fail device creation with a clear error instead of at first use
+	if (physicalDevice.getProperties().apiVersion < VK_API_VERSION_1_2)
+		throw std::runtime_error("Device does not support Vulkan 1.2");
+	auto supported = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+	const auto& supportedFeatures = supported.get<vk::PhysicalDeviceFeatures2>().features;
+	const auto& supported12Features = supported.get<vk::PhysicalDeviceVulkan12Features>();
+	if (!supported12Features.timelineSemaphore)
+		throw std::runtime_error("Device does not support timelineSemaphore");
+
 	// Enable anisotropic filtering (currently not doing checks to see if we do support it..)
 	vk::PhysicalDeviceFeatures physDevFeatures;
 	physDevFeatures.setSamplerAnisotropy(true);
+	if (!supportedFeatures.textureCompressionBC)
+		throw std::runtime_error("Device does not support textureCompressionBC");
+	physDevFeatures.setTextureCompressionBC(true);		// Cooked textures are BC4/BC5/BC7 (every desktop GPU has it)
 	//physDevFeatures.setImageCubeArray(true);		// for SampledCubeArray	https://vulkan.lunarg.com/doc/view/1.2.182.0/windows/1.2-extensions/vkspec.html#spirvenv-capabilities-table
 
-	
+	// GPU driven draws: the culling pass writes the indirect commands, firstInstance is the draw record read by the vertex shader
+	// Drawing many commands per call and the GPU written draw count are optional (software ICDs may lack them), the draws fall back without them
+	if (!supportedFeatures.drawIndirectFirstInstance)
+		throw std::runtime_error("Device does not support drawIndirectFirstInstance");
+	m_multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	m_drawIndirectCount = supported12Features.drawIndirectCount;
+
+	physDevFeatures.setDrawIndirectFirstInstance(true);
+	physDevFeatures.setMultiDrawIndirect(m_multiDrawIndirect);
 
-	m_device = physicalDevice.createDevice(vk::DeviceCreateInfo(vk::DeviceCreateFlags(), queueCreateInfos, enabledLayers, enabledExtensions, &physDevFeatures));
+	// 1.2 features
+	vk::PhysicalDeviceVulkan12Features vk12Features;
+	vk12Features.setTimelineSemaphore(true);		// Upload completion is tracked with a timeline semaphore
+	vk12Features.setDrawIndirectCount(m_drawIndirectCount);
+
+	// Bindless textures: one large sparsely filled (and update after bind for the higher limits) texture array indexed per material
+	// The index is the same for the whole draw (dynamically uniform), so non uniform indexing is not needed
+	if (!supportedFeatures.shaderSampledImageArrayDynamicIndexing || !supported12Features.runtimeDescriptorArray ||
+		!supported12Features.descriptorBindingPartiallyBound || !supported12Features.descriptorBindingSampledImageUpdateAfterBind)
+		throw std::runtime_error("Device does not support the descriptor indexing features needed for bindless textures");
+	physDevFeatures.setShaderSampledImageArrayDynamicIndexing(true);
+	vk12Features.setRuntimeDescriptorArray(true);
+	vk12Features.setDescriptorBindingPartiallyBound(true);
+	vk12Features.setDescriptorBindingSampledImageUpdateAfterBind(true);
+
+	vk::DeviceCreateInfo deviceCI(vk::DeviceCreateFlags(), queueCreateInfos, enabledLayers, enabledExtensions, &physDevFeatures);
+	deviceCI.setPNext(&vk12Features);
+
+	m_device = physicalDevice.createDevice(deviceCI);
 
 
 	// Retrieve the queues
 	m_gfxQueue = m_device.getQueue(qfs.gphIdx.value(), 0);
 	m_presentQueue = m_device.getQueue(qfs.presentIdx.value(), 0);
+	m_transferQueue = m_device.getQueue(qfs.transferIdx.value(), 0);
 
 }
 
@@ -777,9 +860,12 @@ void VulkanContext::createCommandBuffers(const vk::Device& logicalDevice, const
 }
 
 
-UploadContext::UploadContext(vk::Device& dev, vk::Queue& queue, uint32_t queueFamily) :
+UploadContext::UploadContext(vk::Device& dev, VmaAllocator allocator, vk::Queue& gfxQueue, uint32_t gfxFamily, vk::Queue& transferQueue, uint32_t transferFamily) :
 	m_dev(dev),
-	m_queue(queue)
+	m_gfxQueue(gfxQueue),
+	m_transferQueue(transferQueue),
+	m_gfxFamily(gfxFamily),
+	m_transferFamily(transferFamily)
 {
 	try
 	{
@@ -788,8 +874,19 @@ UploadContext::UploadContext(vk::Device& dev, vk::Queue& queue, uint32_t queueFa
 		m_fence = dev.createFenceUnique(fCI);
 
 		// Create command pool - We will use this pool to allocate a command buffer when we need to do some work
-		vk::CommandPoolCreateInfo cmdPCI({}, queueFamily);
+		vk::CommandPoolCreateInfo cmdPCI({}, gfxFamily);
 		m_pool = dev.createCommandPoolUnique(cmdPCI);
+
+		// Async pools, command buffers are freed individually once their timeline value has been reached
+		m_asyncTransferPool = dev.createCommandPoolUnique(vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eTransient, transferFamily));
+		m_asyncGfxPool = dev.createCommandPoolUnique(vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eTransient, gfxFamily));
+
+		vk::SemaphoreTypeCreateInfo timelineCI(vk::SemaphoreType::eTimeline, 0);
+		vk::SemaphoreCreateInfo semCI;
+		semCI.setPNext(&timelineCI);
+		m_timeline = dev.createSemaphoreUnique(semCI);
+
+		m_stagingRing = std::make_unique<StagingRing>(allocator, *this);
 	}
 	catch (vk::SystemError& err)
 	{
@@ -798,6 +895,12 @@ UploadContext::UploadContext(vk::Device& dev, vk::Queue& queue, uint32_t queueFa
 	}
 }
 
+UploadContext::~UploadContext()
+{
+	// Command buffers may still be executing, pools and semaphore are destroyed right after
+	wait(m_lastSubmittedValue);
+}
+
 void UploadContext::submitWork(const std::function<void(const vk::CommandBuffer&)>& work)
 {
 	try
@@ -813,7 +916,7 @@ void UploadContext::submitWork(const std::function<void(const vk::CommandBuffer&
 
 		// Submit work and signal fence when done
 		vk::SubmitInfo submitInfo({}, {}, cmd);
-		m_queue.submit(submitInfo, m_fence.get());
+		m_gfxQueue.submit(submitInfo, m_fence.get());
 
 		// Wait for submitted work to finish
 		auto res = m_dev.waitForFences(m_fence.get(), true, std::numeric_limits<uint64_t>::max());
@@ -830,6 +933,129 @@ void UploadContext::submitWork(const std::function<void(const vk::CommandBuffer&
 
 }
 
+uint64_t UploadContext::submitAsync(const std::function<void(const vk::CommandBuffer&)>& transferWork, const std::function<void(const vk::CommandBuffer&)>& graphicsWork)
+{
+	try
+	{
+		reclaimCompleted();
+
+		vk::CommandBufferBeginInfo begInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+		auto gfxCmd = m_dev.allocateCommandBuffers(vk::CommandBufferAllocateInfo(m_asyncGfxPool.get(), vk::CommandBufferLevel::ePrimary, 1)).front();
+
+		if (!hasDedicatedTransferQueue())
+		{
+			// Single family: everything goes in one command buffer on the graphics queue
+			uint64_t doneValue = ++m_lastSubmittedValue;
+
+			gfxCmd.begin(begInfo);
+			transferWork(gfxCmd);
+			graphicsWork(gfxCmd);
+			gfxCmd.end();
+
+			vk::TimelineSemaphoreSubmitInfo timelineInfo({}, doneValue);
+			vk::SubmitInfo submitInfo({}, {}, gfxCmd, m_timeline.get());
+			submitInfo.setPNext(&timelineInfo);
+			m_gfxQueue.submit(submitInfo);
+
+			m_inFlight.push_back({ doneValue, nullptr, gfxCmd });
+			return doneValue;
+		}
+
+		// Transfer queue copies and releases ownership, graphics queue waits on the timeline and acquires
+		uint64_t transferDoneValue = ++m_lastSubmittedValue;
+		uint64_t doneValue = ++m_lastSubmittedValue;
+
+		auto transferCmd = m_dev.allocateCommandBuffers(vk::CommandBufferAllocateInfo(m_asyncTransferPool.get(), vk::CommandBufferLevel::ePrimary, 1)).front();
+		transferCmd.begin(begInfo);
+		transferWork(transferCmd);
+		transferCmd.end();
 
+		vk::TimelineSemaphoreSubmitInfo transferTimelineInfo({}, transferDoneValue);
+		vk::SubmitInfo transferSubmit({}, {}, transferCmd, m_timeline.get());
+		transferSubmit.setPNext(&transferTimelineInfo);
+		m_transferQueue.submit(transferSubmit);
+
+		gfxCmd.begin(begInfo);
+		graphicsWork(gfxCmd);
+		gfxCmd.end();
+
+		vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands;
+		vk::TimelineSemaphoreSubmitInfo gfxTimelineInfo(transferDoneValue, doneValue);
+		vk::SubmitInfo gfxSubmit(m_timeline.get(), waitStage, gfxCmd, m_timeline.get());
+		gfxSubmit.setPNext(&gfxTimelineInfo);
+		m_gfxQueue.submit(gfxSubmit);
+
+		m_inFlight.push_back({ doneValue, transferCmd, gfxCmd });
+		return doneValue;
+	}
+	catch (vk::SystemError& err)
+	{
+		std::cout << "vk::SystemError: " << err.what() << std::endl;
+		assert(false);
+	}
+
+	return m_lastSubmittedValue;
+}
+
+bool UploadContext::isComplete(uint64_t timelineValue) const
+{
+	return m_dev.getSemaphoreCounterValue(m_timeline.get()) >= timelineValue;
+}
+
+void UploadContext::wait(uint64_t timelineValue) const
+{
+	if (timelineValue == 0)
+		return;
+
+	vk::SemaphoreWaitInfo waitInfo({}, m_timeline.get(), timelineValue);
+	auto res = m_dev.waitSemaphores(waitInfo, std::numeric_limits<uint64_t>::max());
 }
 
+const vk::Semaphore& UploadContext::getTimelineSemaphore() const
+{
+	return m_timeline.get();
+}
+
+uint64_t UploadContext::getLastSubmittedValue() const
+{
+	return m_lastSubmittedValue;
+}
+
+bool UploadContext::hasDedicatedTransferQueue() const
+{
+	return m_transferFamily != m_gfxFamily;
+}
+
+uint32_t UploadContext::getGraphicsQueueFamily() const
+{
+	return m_gfxFamily;
+}
+
+uint32_t UploadContext::getTransferQueueFamily() const
+{
+	return m_transferFamily;
+}
+
+StagingRing& UploadContext::getStagingRing() const
+{
+	return *m_stagingRing;
+}
+
+void UploadContext::reclaimCompleted()
+{
+	if (m_inFlight.empty())
+		return;
+
+	uint64_t completedValue = m_dev.getSemaphoreCounterValue(m_timeline.get());
+	while (!m_inFlight.empty() && m_inFlight.front().timelineValue <= completedValue)
+	{
+		auto& upload = m_inFlight.front();
+		if (upload.transferCmd)
+			m_dev.freeCommandBuffers(m_asyncTransferPool.get(), upload.transferCmd);
+		m_dev.freeCommandBuffers(m_asyncGfxPool.get(), upload.gfxCmd);
+		m_inFlight.pop_front();
+	}
+}
+
+
+}
@@ -204,10 +204,10 @@ namespace Nagi
         //ImGui_ImplVulkan_CreateShaderModules(device, allocator);
 
         // Create Vert/Frag shader modules
-        auto vertBin = readFile("compiled_shaders/imguiVert.spv");
-        auto fragBin = readFile("compiled_shaders/imguiFrag.spv");
-        auto vertMod = dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo({}, vertBin.size(), reinterpret_cast<uint32_t*>(vertBin.data())));
-        auto fragMod = dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo({}, fragBin.size(), reinterpret_cast<uint32_t*>(fragBin.data())));
+        MappedFile vertBin("compiled_shaders/imguiVert.spv");
+        MappedFile fragBin("compiled_shaders/imguiFrag.spv");
+        auto vertMod = dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo({}, vertBin.getSize(), reinterpret_cast<const uint32_t*>(vertBin.getData())));
+        auto fragMod = dev.createShaderModuleUnique(vk::ShaderModuleCreateInfo({}, fragBin.getSize(), reinterpret_cast<const uint32_t*>(fragBin.getData())));
 
         VkPipelineShaderStageCreateInfo stage[2] = {};
         stage[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;